@@ -36,9 +36,15 @@
 #include <errno.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <setjmp.h>
 #if defined(_WIN32) || defined(_WIN64)
     #include <conio.h>   // Windows-specific header
+#else
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #include <pthread.h>
 #endif
+#include "blitz.h"
 
 /* SWAP_BYTES (int)  -->  int
 **
@@ -63,6 +69,33 @@
 #define SWAP_BYTES(x) (x)
 #endif
 
+/* MEMORY_WORD (int)  -->  int
+** MEMORY_BYTE_ADDR (int)  -->  int
+**
+** Normally, the BLITZ physical memory ("memory") is kept in BLITZ (Big Endian)
+** order, so every word moving between "memory" and the emulator must be
+** passed through SWAP_BYTES.  If BLITZ_HOST_ORDER_MEMORY is defined, each word
+** in "memory" is kept in host order instead, and word loads and stores are
+** plain host loads and stores.
+**
+** In that case, the bytes of a word are not at their BLITZ addresses, so
+** data moving between "memory" and a file (the a.out loader, the DISK)
+** must be converted with swapMemoryWords, and a byte at a BLITZ address must
+** be accessed at MEMORY_BYTE_ADDR (addr).  Loadb and storeb need no change,
+** since they isolate the byte within the word value.
+*/
+#ifdef BLITZ_HOST_ORDER_MEMORY
+#define MEMORY_WORD(x) (x)
+#ifdef BLITZ_HOST_IS_LITTLE_ENDIAN
+#define MEMORY_BYTE_ADDR(addr) ((addr) ^ 3)
+#else
+#define MEMORY_BYTE_ADDR(addr) (addr)
+#endif
+#else
+#define MEMORY_WORD(x) SWAP_BYTES(x)
+#define MEMORY_BYTE_ADDR(addr) (addr)
+#endif
+
 
 
 typedef struct TableEntry TableEntry;
@@ -119,13 +152,10 @@ int systemTrapNumber;             /* Set by the syscall exception */
 int pageInvalidOffendingAddress;  /* Used by Page Invalid exception */
 int pageReadonlyOffendingAddress; /* Used by Page Readonly exception */
 int translateCausedException;     /* Set by translate () */
-int currentTime;                  /* Measured in "clicks": 1,2,3,... */
-int timeSpentAsleep;              /* Incremented by "wait" instruction */
-int timeOfNextEvent;              /* Minimum of disk, serial, and timer */
-int timeOfNextTimerEvent;         /* Zero = now, MAX = never */
-int timeOfNextDiskEvent;          /* Zero = now, MAX = never */
-int timeOfNextSerialInEvent;      /* Zero = now, MAX = never */
-int timeOfNextSerialOutEvent;     /* Zero = now, MAX = never */
+long long currentTime;            /* Measured in "clicks": 1,2,3,... */
+long long timeSpentAsleep;        /* Incremented by "wait" instruction */
+long long timeOfNextEvent;        /* Time of the first event in the event queue */
+int instructionsLeftInSlice;      /* Used by commandGo; see suspendExecution */
 int executionHalted;              /* 0=continue executing; 1=halted */
 int controlCPressed;              /* 0=not pressed; 1=pressed */
 int wantPrintingInSingleStep;     /* Used by singleStep to control verbosity. */
@@ -158,13 +188,16 @@ int typeAheadBufferOut;           /* Next pos to get from */
 **   values.  The default values are in the "setSimulationConstants()" routine.
 **
 ** All times are in terms of instruction "cycles."  Except for interrupts, there
-**   will be one instruction executed per cycle.  For a 1MHz machine, each
-**   cycle corresponds to 1 microsecond.
+**   will be one instruction executed per cycle, unless the cost model (below)
+**   is used.  For a 1MHz machine, each cycle corresponds to 1 microsecond.
 **    
 ** To simulate human typing on the serial input, we might use
 **     KEYBOARD_WAIT_TIME = 1000    KEYBOARD_WAIT_TIME_VARIATION = 100000
 ** To simulate an output rate of 19 KBaud on the serial output, we might use
 **     TERM_OUT_DELAY = 500         TERM_OUT_DELAY_VARIATION = 10
+** SERIAL_FIFO_DEPTH, if not 0, gives the serial device a receive FIFO and a
+**   transmit FIFO of this many characters (see Serial FIFOs).  The receive
+**   FIFO signals an interrupt when it holds SERIAL_FIFO_THRESHOLD characters.
 ** To switch processes about 200 times per second, we might use
 **     TIME_SLICE = 5000            TIME_SLICE_VARIATION = 10
 **   (To turn off Timer Interrupts, use TIME_SLICE = 0.)
@@ -199,13 +232,38 @@ int typeAheadBufferOut;           /* Next pos to get from */
 **   DISK_MEMORY_ADDRESS_REGISTER
 **   DISK_SECTOR_NUMBER_REGISTER
 **   DISK_SECTOR_COUNT_REGISTER
-**  
+**   PERF_COUNTER_ADDRESS (the first of the 13 words of the performance
+**     counter device; see Performance Counters)
+**   CPU_DEVICE_ADDRESS (the first of the 4 words of the CPU device; see
+**     Multiprocessor)
+**   DMA_CONTROLLER_ADDRESS (the first of the 9 words of the DMA disk
+**     controller; see DMA Disk Controller)
+**   TIMER_DEVICE_ADDRESS (the first of the 4 words of the timer device;
+**     see Timer Device)
+**
+** The remaining constants describe an optional cost model, which makes some
+**   instructions take more than 1 cycle.  With the defaults, it is not used.
+** MUL_CYCLES, DIV_CYCLES (div and rem), FLOAT_CYCLES (fadd, fsub, fmul, fcmp,
+**   itof, ftoi, fneg and fabs) and FLOAT_DIV_CYCLES (fdiv and fsqrt) are the
+**   number of cycles taken by these instructions.  All others take 1 cycle.
+** ICACHE_SETS and ICACHE_WAYS give the size of an instruction cache, and
+**   DCACHE_SETS and DCACHE_WAYS the size of a data cache.  Both have lines of
+**   CACHE_LINE_SIZE bytes (a power of 2) and use LRU replacement.  Every miss
+**   adds CACHE_MISS_PENALTY cycles.  With 0 sets, a cache is not modeled.
+**   The caches hold physical addresses; the Memory Mapped Area is never cached.
+** BRANCH_PREDICTOR_SIZE is the number of 2-bit counters in a table, indexed
+**   by the address of the branch, which predicts whether each conditional
+**   branch will be taken.  Each wrong prediction adds BRANCH_MISPREDICT_PENALTY
+**   cycles.  With 0 counters, branches are not predicted.
+**
 */
 
 int KEYBOARD_WAIT_TIME = -1;
 int KEYBOARD_WAIT_TIME_VARIATION = -1;
 int TERM_OUT_DELAY = -1;
 int TERM_OUT_DELAY_VARIATION = -1;
+int SERIAL_FIFO_DEPTH = -1;
+int SERIAL_FIFO_THRESHOLD = -1;
 int TIME_SLICE = -1;
 int TIME_SLICE_VARIATION = -1;
 int DISK_SEEK_TIME = -1;
@@ -225,6 +283,22 @@ int DISK_COMMAND_WORD_ADDRESS = -1;
 int DISK_MEMORY_ADDRESS_REGISTER = -1;
 int DISK_SECTOR_NUMBER_REGISTER = -1;
 int DISK_SECTOR_COUNT_REGISTER = -1;
+int PERF_COUNTER_ADDRESS = -1;
+int CPU_DEVICE_ADDRESS = -1;
+int DMA_CONTROLLER_ADDRESS = -1;
+int TIMER_DEVICE_ADDRESS = -1;
+int MUL_CYCLES = -1;
+int DIV_CYCLES = -1;
+int FLOAT_CYCLES = -1;
+int FLOAT_DIV_CYCLES = -1;
+int CACHE_LINE_SIZE = -1;
+int ICACHE_SETS = -1;
+int ICACHE_WAYS = -1;
+int DCACHE_SETS = -1;
+int DCACHE_WAYS = -1;
+int CACHE_MISS_PENALTY = -1;
+int BRANCH_PREDICTOR_SIZE = -1;
+int BRANCH_MISPREDICT_PENALTY = -1;
 
 
 
@@ -358,9 +432,16 @@ int numberOfDiskWrites = 0;                      /* How many since last reset (n
 #define ALIGNMENT_EXCEPTION              2048
 #define EXCEPTION_DURING_INTERRUPT       4096
 #define SYSCALL_TRAP                     8192
+#define INTERPROCESSOR_INTERRUPT        16384
+
+/* The interrupts which are ignored while interrupts are disabled. */
+#define MASKABLE_INTERRUPTS (TIMER_INTERRUPT | DISK_INTERRUPT | \
+                             SERIAL_INTERRUPT | ARITHMETIC_EXCEPTION | \
+                             SYSCALL_TRAP | INTERPROCESSOR_INTERRUPT)
 
 
 #define MAX 2147483647
+#define MAX_TIME 0x7fffffffffffffffLL  /* Times are 64 bits; MAX_TIME = never */
 int MIN;                 /* Initialized in main to -2147483648 */
 
 
@@ -388,6 +469,1005 @@ int numberOfLabels = 0;
 
 
 
+/*****  Decoded Instruction Cache  *****
+**
+** To avoid re-extracting the fields of each instruction every time it is
+** executed, instructions are decoded once and kept in a cache.  There is one
+** array of DecodedInstructions for each page frame of physical memory from
+** which instructions have been fetched; these are allocated on demand.
+** The cache is indexed by physical address, so changing the page tables
+** (e.g., with "ldptbr") does not affect it.  Whenever a word of memory is
+** altered (by a store, by a disk read, or by loading the a.out file), the
+** corresponding entries are invalidated.
+*/
+typedef struct DecodedInstruction DecodedInstruction;
+
+struct DecodedInstruction {
+  int   valid;            /* 0=must be decoded from memory before use */
+  int   instr;            /* The instruction word itself */
+  int   opcode;           /* Bits 31:24 */
+  int   ra;               /* Register number from bits 19:16 */
+  int   rb;               /* Register number from bits 15:12 */
+  int   rc;               /* Register number from bits 23:20 */
+  int   data16;           /* Bits 15:0, sign-extended */
+  int   data24;           /* Bits 23:0, sign-extended */
+  int   endsBlock;        /* 1=may change the flow of control or the mode */
+  int   covered;          /* 1=already recorded in the coverage bitmap */
+};
+
+#define INSTRS_PER_PAGE (PAGE_SIZE / 4)
+DecodedInstruction ** decodedPages = NULL;   /* One pointer per frame, or NULL */
+int numberOfDecodedPages = 0;                /* Size of the decodedPages array */
+DecodedInstruction uncachedInstruction;      /* Used for memory-mapped fetches */
+
+
+
+/*****  Translation Lookaside Buffer  *****
+**
+** To avoid walking the page table on every fetch, load and store when paging
+** is turned on, "translate" keeps a host-side TLB of recently used page table
+** entries.  It is direct-mapped and indexed by the low bits of the virtual
+** page number.  An entry is only created after a successful translation has
+** written the page table entry back to memory, so it records the entry as it
+** now appears in memory.  A translation is satisfied from the TLB only when
+** no bit in the page table entry would change, i.e., the R bit is already
+** set and, for a write, the D bit is also set.  Otherwise the page table is
+** walked as before.
+**
+** Entries are only valid for the current page table; the TLB is flushed
+** whenever ptbr or ptlr changes.  A store into the page table invalidates
+** the corresponding entry, and a disk read or a reset flushes it entirely.
+**
+** Each CPU has its own TLB (see Multiprocessor); "tlb" points to the TLB of
+** the current CPU.  A store into the page table of any other CPU invalidates
+** the entry in that CPU's TLB, and flushTLB flushes the TLBs of all CPUs.
+*/
+typedef struct TLBEntry TLBEntry;
+
+struct TLBEntry {
+  int   valid;            /* 0=empty */
+  int   page;             /* Virtual address of the page (virtAddr & 0x00ffe000) */
+  int   tableEntryAddr;   /* Physical address of the page table entry */
+  int   tableEntry;       /* Contents of the page table entry */
+};
+
+#define TLB_SIZE 256      /* Number of entries; must be a power of 2 */
+int tlbGeneration = 0;    /* Incremented whenever any TLB entry is invalidated */
+
+
+
+/*****  Multiprocessor  *****
+**
+** With the "-cpus n" option, the machine has "n" CPUs sharing the memory,
+** the I/O devices and the event queue.  Each CPU has its own registers,
+** status bits, page table registers, signaled interrupts and TLB.
+**
+** The CPUs do not run in separate host threads.  Instead, they take turns,
+** one machine cycle each, in order of CPU number; a round of all CPUs takes
+** one cycle of time.  (See multiprocessorStep.)  So execution remains
+** exactly repeatable for a given random seed, and since no two instructions
+** ever overlap, "tset" and every other instruction is atomic.  The
+** registers of the current CPU are kept in the usual global variables
+** ("pc", "userRegisters", etc.); those of the other CPUs are kept here.
+**
+** All device interrupts go to CPU 0, even when the device register that
+** caused one was touched by another CPU; the devices use signalCpu for
+** this.  The timer interrupt goes to every CPU that has been started.  When a CPU executes a "wait" instruction, it does
+** nothing until it is interrupted.  When all CPUs are waiting, the machine
+** sleeps until the next event, as for "wait" with one CPU.
+**
+** The CPU device occupies CPU_DEVICE_BYTES in the memory-mapped area,
+** beginning at CPU_DEVICE_ADDRESS:
+**
+**     +0    the number of the CPU reading this word (read only)
+**     +4    the number of CPUs (read only)
+**     +8    write "n" to signal an INTERPROCESSOR_INTERRUPT on CPU "n"
+**     +12   write "n" to start CPU "n"
+**
+** At reset, only CPU 0 is running; the others are stopped, so a program
+** written for one CPU runs as before.  When a stopped CPU is started, it
+** begins with a POWER_ON_RESET interrupt, in system mode with all registers
+** zero, and must use the CPU number to find its own stack, etc.  A CPU may
+** only be started once.  The INTERPROCESSOR_INTERRUPT is maskable and uses
+** the interrupt vector at 0x00000038.
+**
+** The "-batch", "-acct" and "-ws" options, snapshots and the cost model may
+** not be used with more than one CPU.
+*/
+#define MAX_CPUS 16
+#define CPU_RUNNING 0
+#define CPU_WAITING 1      /* Executed a "wait"; interrupts will be enabled */
+#define CPU_STOPPED 2      /* Not yet started */
+#define CPU_DEVICE_BYTES 16
+#define CPU_NUMBER_REGISTER 0
+#define CPU_COUNT_REGISTER 4
+#define CPU_IPI_REGISTER 8
+#define CPU_START_REGISTER 12
+
+typedef struct Cpu Cpu;
+
+struct Cpu {
+  int       userRegisters [16];    /* The saved state, when not current... */
+  int       systemRegisters [16];
+  double    floatRegisters [16];
+  int       pc;
+  int       ptbr;
+  int       ptlr;
+  int       statusN, statusV, statusZ, statusP, statusS, statusI;
+  int       interruptsSignaled;
+  int       systemTrapNumber;
+  int       pageInvalidOffendingAddress;
+  int       pageReadonlyOffendingAddress;
+  int       state;                 /* CPU_RUNNING, CPU_WAITING, CPU_STOPPED */
+  long long busyCycles;            /* Cycles spent running */
+  long long idleCycles;            /* Cycles spent waiting or stopped */
+  TLBEntry  tlb [TLB_SIZE];
+};
+
+int numberOfCpus = 1;
+int commandOptionCpus = 0;          /* Set by the "-cpus" option */
+Cpu cpus [MAX_CPUS];
+int currentCpu = 0;                 /* Whose registers are in the globals */
+TLBEntry * tlb = cpus [0].tlb;      /* The TLB of the current CPU */
+
+
+
+/*****  Frame Flags  *****
+**
+** Accesses to most of physical memory need no special handling, but a few
+** page frames must be checked more carefully: those containing any part of
+** the memory-mapped area, and those in the buffer of a disk operation that
+** is in progress.  There is one byte of flags for each page frame, so that
+** getPhysicalWord and putPhysicalWord can screen out both cases with a single
+** test.  Only when a frame's flags are non-zero are the exact checks
+** (inMemoryMappedArea and checkDiskBufferError) made.
+*/
+#define FRAME_MEMORY_MAPPED  0x01   /* Frame overlaps the memory-mapped area */
+#define FRAME_DISK_BUSY      0x02   /* Frame overlaps a busy disk buffer */
+
+char * frameFlags = NULL;        /* One byte per frame */
+int numberOfFrames = 0;          /* Size of the frameFlags array */
+int diskBusyFrameLow = 0;        /* Frames marked FRAME_DISK_BUSY are... */
+int diskBusyFrameHigh = 0;       /* ... diskBusyFrameLow to diskBusyFrameHigh-1 */
+
+
+
+/*****  Basic Blocks  *****
+**
+** When the "-batch" option is given, the "go" command executes instructions
+** in runs, called basic blocks, rather than one at a time.  A basic block is
+** a sequence of instructions within one page, ending with the first
+** instruction that may transfer control or change the status register or
+** page table registers (branches, call, ret, reti, syscall, seti, setp, wait,
+** debug, ldptbr, etc.).  See "runBlock".
+**
+** Within a block, singleStep's per-cycle work is skipped whenever it can
+** have no effect.  No event can fall due, since the block stops one cycle
+** before timeOfNextEvent.  No interrupt can be taken, since the block stops
+** as soon as an instruction signals one.  The instruction fetch needs no
+** translation, since the pc stays within a page whose translation has
+** already been done (and whose R bit has been set).  Since "currentTime" is
+** still advanced by exactly one per instruction, interrupt timing is
+** identical to that of singleStep.  No host code is generated: each
+** instruction is still executed by executeInstruction, from the decoded
+** instruction cache.
+*/
+int commandOptionBatch = 0;         /* Set if "-batch" was on command line */
+
+
+
+/*****  Memory-Mapped DISK  *****
+**
+** When the "-mmap" option is given, the DISK file is mapped into the
+** emulator's address space once it has been opened and checked.  Sectors are
+** then transferred by copying between "memory" and the mapping, rather than
+** with fseek, fread, and fwrite.  Sector 0 begins 4 bytes into the mapping,
+** just after the magic number.
+**
+** Changes to the mapping reach the file whenever the host OS writes them
+** back.  With "-msync n", the mapping is also flushed explicitly (with
+** "msync") after every n DISK writes.  It is always flushed on "quit".
+*/
+int commandOptionMmap = 0;          /* Set if "-mmap" was on command line */
+int commandOptionMsync = 0;         /* DISK writes between msyncs; 0=quit only */
+char * diskMapping = NULL;          /* The mapped DISK file, or NULL */
+size_t diskMappingLength = 0;       /* Size of the mapping, in bytes */
+int diskWritesSinceSync = 0;        /* Used with "-msync" */
+
+
+
+/*****  Asynchronous DISK I/O  *****
+**
+** Normally, performDiskIO moves the data between "memory" and the DISK file
+** immediately, although the BLITZ program will not see the operation
+** complete until the disk event occurs.  When the "-async" option is given,
+** the transfer is instead done by a separate host thread, while emulation
+** continues.  The thread is joined (see waitForDiskIO) when the disk event
+** occurs, or earlier if the BLITZ program touches the buffer, if another
+** disk operation is started, or before any emulator command is executed.
+** Thus neither the BLITZ program nor the user can observe any difference,
+** except that host I/O errors are reported when the thread is joined.
+** This includes msync failures from the "-msync" option; unlike the other
+** errors, these are reported but leave the DISK enabled.
+**
+** Only the thread touches the DISK file and the buffer while the transfer
+** is in progress.  The details of the transfer are copied into the
+** diskTransfer... variables before the thread is started.
+*/
+#define DISK_TRANSFER_OK            0
+#define DISK_TRANSFER_SEEK_ERROR    1
+#define DISK_TRANSFER_READ_ERROR    2
+#define DISK_TRANSFER_WRITE_ERROR   3
+#define DISK_TRANSFER_SYNC_ERROR    4
+
+int commandOptionAsync = 0;         /* Set if "-async" was on command line */
+int diskTransferInProgress = 0;     /* 1=the thread has not been joined */
+int diskTransferCommand;            /* DISK_READ_COMMAND or DISK_WRITE_COMMAND */
+int diskTransferSector;             /* First sector to transfer */
+int diskTransferCount;              /* Number of sectors to transfer */
+int diskTransferLow;                /* The buffer in physical memory... */
+int diskTransferHigh;               /* ... from low to high-1 */
+int diskTransferResult;             /* DISK_TRANSFER_OK, ..._SEEK_ERROR, etc. */
+int diskTransferErrno;              /* Value of errno after a failed transfer */
+#if !defined(_WIN32) && !defined(_WIN64)
+pthread_t diskThread;               /* The thread doing the transfer */
+#endif
+
+
+
+/*****  Snapshots  *****
+**
+** The "snapshot" command saves the entire state of the BLITZ machine in a
+** file, and the "restore" command (or the "-restore" command line option)
+** puts the machine back into that state.  A snapshot file contains:
+**
+**     magic number 0x424C5A73 (ASCII "BLZs")
+**     format version, SNAPSHOT_VERSION (which must match when restoring)
+**     MEMORY_SIZE and PAGE_SIZE (which must match when restoring)
+**     the machine state (see snapshotMachineState)
+**     the number of non-zero page frames, N
+**     the frame numbers of these N frames
+**     zero-filled padding, up to a multiple of PAGE_SIZE
+**     the contents of the N frames, in order
+**
+** All numbers are 32-bit Big Endian words, and the frames are in BLITZ byte
+** order, as on the DISK.  Since each frame begins at a multiple of PAGE_SIZE
+** within the file, the file may be mapped directly.  Neither the contents of
+** the DISK file nor the label table are saved.
+**
+** SNAPSHOT_VERSION must be increased whenever the state saved by
+** snapshotMachineState changes, so that an older snapshot is rejected
+** rather than restored into the wrong variables.
+*/
+#define SNAPSHOT_MAGIC 0x424C5A73
+#define SNAPSHOT_VERSION 1
+
+char * restoreFileName = NULL;      /* Set by the "-restore" option */
+FILE * snapshotFile;                /* The file being saved or restored */
+int snapshotReading;                /* 1=restoring, 0=saving */
+int snapshotFailed;                 /* Set if any read or write fails */
+
+
+
+/*****  Profiler  *****
+**
+** When the "-prof" option is given, the emulator counts the number of times
+** each instruction is executed.  The counts are kept by physical address, in
+** one array of INSTRS_PER_PAGE counters for each page frame from which an
+** instruction has been fetched; no space is used for other frames.
+**
+** At exit (on "quit", or when a "-g" run halts), the counts are totalled by
+** function, using the label table.  Each address in the .text segment is
+** charged to the nearest label at or below it, ignoring the "_Label_..."
+** labels that the KPL compiler generates within routines.  Any other
+** address (e.g., a user program loaded by the OS) is charged to
+** "(no label)".  The busiest functions are printed, and the complete report,
+** with an annotated listing of the hottest functions, is written to the
+** file "blitz.prof".
+*/
+#define PROFILE_FILE_NAME "blitz.prof"
+#define PROFILE_FUNCTIONS_TO_PRINT 20     /* Printed at exit */
+#define PROFILE_FUNCTIONS_TO_LIST 10      /* Listed in the file */
+
+typedef struct ProfileEntry ProfileEntry;
+
+struct ProfileEntry {
+  char * name;            /* The label naming this function */
+  int    low;             /* The address of the label */
+  int    high;            /* The address of the next function */
+  long long count;        /* Instructions executed from low to high-4 */
+};
+
+int commandOptionProf = 0;          /* Set if "-prof" was on command line */
+long long ** profilePages = NULL;   /* One pointer per frame, or NULL */
+int numberOfProfilePages = 0;       /* Size of the profilePages array */
+
+
+
+/*****  Stack Sampling  *****
+**
+** When the "-sample n" option is given, the KPL calling stack is sampled
+** every n cycles while the BLITZ program is running.  Each sample appends one
+** line to the file "blitz.folded", in the "folded stack" format used by
+** flame graph tools:
+**
+**     [system];main;Foo;Bar 1
+**
+** The first element is the mode, "[system]" or "[user]"; then come the names
+** of the active KPL routines, outermost first, found by following the frame
+** pointer (r14) as "printFrame" does; last is the number of samples.  When
+** there is no valid KPL frame (e.g., in an assembly language routine), the
+** nearest label at or below the pc is used instead.
+**
+** commandGo ends a slice at each sample time, so nothing is done between
+** samples.  The stack is read without any side effects (using translate with
+** doUpdates=0, and avoiding frames that need special handling), and
+** "currentTime" is not changed.  When a 'wait' instruction sleeps through
+** several sample times, one line is written, with a larger count.
+*/
+#define SAMPLE_FILE_NAME "blitz.folded"
+#define MAX_SAMPLE_DEPTH 100        /* Deeper frames are ignored */
+#define MAX_SAMPLE_NAME 100         /* Longer routine names are truncated */
+
+int commandOptionSample = 0;        /* Cycles between samples; 0=no sampling */
+long long timeOfNextSample = 0;     /* When the next sample is due */
+FILE * sampleFile = NULL;           /* The "blitz.folded" file */
+
+
+
+/*****  Memory-Access Trace  *****
+**
+** With the "-trace filename" option, every instruction fetch, load and store
+** made by the BLITZ program is recorded in the named file.  (Accesses made
+** by the hardware itself, such as page table updates, interrupt processing
+** and disk transfers, are not.)  Records are collected in traceBuffer and
+** written in blocks of TRACE_BUFFER_SIZE records.  The file contains:
+**
+**     magic number 0x424C5A74 (ASCII "BLZt")
+**     TRACE_RECORD_SIZE (16), PAGE_SIZE and MEMORY_SIZE
+**     the records, each of which is 4 words:
+**         the cycle (currentTime), high-order word
+**         the cycle, low-order word
+**         bits 31:30 - TRACE_FETCH, TRACE_LOAD or TRACE_STORE
+**         bit  29    - the S bit (1=system mode)
+**         bit  28    - the P bit (1=paging on)
+**         bits 27:24 - the size of the access in bytes (1 or 4)
+**         bits 23:0  - the virtual address
+**         the physical address
+**
+** All numbers are 32-bit Big Endian words.  The "dumpTrace" program reads
+** these files.
+**
+** Accesses are recorded by translate, the one routine through which every
+** fetch, load and store passes, which calls memoryAccess.  (The cost model
+** uses the same hook for its caches.)  Since translate is only given the
+** word address, "fetchingInstruction" tells it when an instruction is being
+** fetched and, for byte loads and stores, "traceByteAddr" gives it the
+** address of the byte.  Within a basic block ("-batch"), instructions are
+** fetched without calling translate, so runBlock records those itself.
+*/
+#define TRACE_MAGIC 0x424C5A74
+#define TRACE_RECORD_SIZE 16
+#define TRACE_BUFFER_SIZE 65536         /* Records per block (1 MByte) */
+#define TRACE_FETCH 0
+#define TRACE_LOAD  1
+#define TRACE_STORE 2
+
+char * traceFileName = NULL;            /* Set by the "-trace" option */
+FILE * traceFile = NULL;                /* NULL when not tracing */
+int * traceBuffer = NULL;               /* 4 words per record, Big Endian */
+int traceBufferCount = 0;               /* Number of records in traceBuffer */
+int fetchingInstruction = 0;            /* Set while translating the pc */
+int traceByteAddr = -1;                 /* Set before translating for loadb, etc. */
+
+
+
+/*****  Cost Model  *****
+**
+** When the cost model is configured in the ".blitzrc" file (see the
+** Simulation Constants), some instructions take more than 1 cycle.  After
+** each instruction, chargeCycles adds the extra cycles to "currentTime"
+** and to "stallCycles".  The instructions executed are then "currentTime"
+** less "timeSpentAsleep" and "stallCycles".
+**
+** The caches are looked up by memoryAccess, which translate calls for every
+** fetch, load and store (see Memory-Access Trace), whenever
+** "watchingAccesses" is set.  A miss adds to "pendingStallCycles", which
+** chargeCycles then adds to the cost of the instruction.  Only the tags are
+** kept; the data always comes from memory.  The caches are emptied by
+** "reset" and when a snapshot is restored.
+*/
+typedef struct CacheLine CacheLine;
+typedef struct Cache Cache;
+
+struct CacheLine {
+  int tag;                  /* Physical address / CACHE_LINE_SIZE; -1=empty */
+  long long lastUsed;       /* Value of useCount when last accessed */
+};
+
+struct Cache {
+  int sets;                 /* 0=the cache is not modeled */
+  int ways;
+  CacheLine * lines;        /* sets*ways lines; each set is contiguous */
+  long long useCount;       /* Incremented on every access; for LRU */
+  long long hits;
+  long long misses;
+};
+
+Cache instructionCache = {0, 0, NULL, 0, 0, 0};
+Cache dataCache = {0, 0, NULL, 0, 0, 0};
+int opcodeCycles [256];                  /* Cost of each instruction */
+int isConditionalBranch [256];           /* 1=predicted by branchCounters */
+unsigned char * branchCounters = NULL;   /* BRANCH_PREDICTOR_SIZE counters */
+int costModelEnabled = 0;                /* 1=chargeCycles must be called */
+int watchingAccesses = 0;                /* 1=translate must call memoryAccess */
+int pendingStallCycles = 0;              /* Cache misses for this instruction */
+long long stallCycles;                   /* Total cycles added by the model */
+long long branchesExecuted;              /* Conditional branches predicted */
+long long branchesMispredicted;
+
+
+
+/*****  Performance Counters  *****
+**
+** The performance counter device lets the BLITZ program measure itself.  It
+** occupies PERF_COUNTER_BYTES in the memory-mapped area, beginning at
+** PERF_COUNTER_ADDRESS:
+**
+**     +0    control word
+**     +4    cycles (high word, then low word)
+**     +12   instructions executed
+**     +20   cycles spent executing instructions in user mode
+**     +28   all other cycles, except those spent sleeping (system mode)
+**     +36   page invalid exceptions
+**     +44   page readonly exceptions
+**
+** Each counter is 64 bits.  Reading the high word latches the low word, so
+** a counter should be read high word first.  The instructions executed are
+** as in "Instructions Executed" (see printFinalStats).  With the cost model,
+** the stall cycles of each instruction are added to the mode it ran in.
+**
+** Writing PERF_RESET to the control word sets all counters to zero.  Writing
+** PERF_FREEZE stops them, and writing a value without it starts them again;
+** reading the control word returns PERF_FREEZE if they are stopped.  The
+** counters are only words in the memory-mapped area; each is kept as the
+** difference between some running value (see perfCounterValue) and a base.
+*/
+#define PERF_COUNTER_BYTES 52
+#define NUMBER_OF_PERF_COUNTERS 6
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_USER_CYCLES 2
+#define PERF_SYSTEM_CYCLES 3
+#define PERF_PAGE_INVALID 4
+#define PERF_PAGE_READONLY 5
+#define PERF_RESET 0x00000001
+#define PERF_FREEZE 0x00000002
+
+long long userCycles;               /* Cycles spent executing in user mode */
+long long perfCounterBase [NUMBER_OF_PERF_COUNTERS];    /* Value at zero */
+long long perfCounterFrozen [NUMBER_OF_PERF_COUNTERS];  /* Value when frozen */
+int perfCountersFrozen;             /* 1=PERF_FREEZE was written */
+int perfLatchedCounter;             /* Counter whose high word was read, or -1 */
+int perfLatchedLowWord;             /* Its low word at that time */
+
+
+
+/*****  Address Space Accounting  *****
+**
+** With the "-acct" option, the emulator charges cycles, page faults and disk
+** requests to address spaces, which are identified by the value of the ptbr.
+** (A BLITZ kernel normally gives each user process its own page table.)  At
+** exit, and with the "acct" command, a table is printed, busiest first.
+**
+** Everything is charged to the ptbr in effect at the time.  User cycles are
+** those spent executing instructions in user mode (see Performance
+** Counters); all other cycles, except time spent sleeping, are system
+** cycles.  So the time the kernel spends in a system call, or handling a
+** page fault, is charged to the process it was working for, as long as the
+** kernel does not change the ptbr.
+**
+** Nothing is done as instructions execute.  Instead, the running counters
+** are noted whenever the ptbr is about to change, and what has happened
+** since the last change is charged to the old ptbr.  Only the first
+** MAX_ADDRESS_SPACES-1 ptbr values get their own entries; the rest are
+** lumped together.
+*/
+#define MAX_ADDRESS_SPACES 64
+
+typedef struct AddressSpace AddressSpace;
+
+struct AddressSpace {
+  int ptbr;                         /* -1 for the "other" entry */
+  long long userCycles;
+  long long systemCycles;
+  long long pageFaults;             /* Page invalid and readonly exceptions */
+  long long diskRequests;           /* Disk reads and writes */
+};
+
+int commandOptionAcct = 0;          /* Set if "-acct" was on command line */
+AddressSpace addressSpaces [MAX_ADDRESS_SPACES];
+int numberOfAddressSpaces = 0;
+long long acctUserCycles;           /* The running counters when last */
+long long acctSystemCycles;         /*   charged (see markAccounting) */
+long long acctPageFaults;
+long long acctDiskRequests;
+
+
+
+/*****  Working Set Analysis  *****
+**
+** With the "-ws n" option, the emulator divides time into intervals of n
+** cycles and records which virtual pages of each address space (identified
+** by the ptbr, as for "-acct") are referenced and dirtied in each interval.
+** It keeps its own Referenced and Dirty bits, set as translate sets those in
+** the page table entries, so the bits used by the kernel are not disturbed.
+** Only accesses made with paging turned on are counted.
+**
+** At the end of each interval, one line is written to the file "blitz.ws"
+** for each address space used in that interval, giving the number of
+** pages referenced (the working set), the number dirtied, and the number
+** referenced for the first time.  The bits are then cleared.  At exit, a
+** summary is added for each address space, including a histogram of the
+** reuse distance: the number of intervals between one interval in which a
+** page is referenced and the next.
+**
+** The pages are looked at by referencePage, which is called from
+** recordAccess (see Memory-Access Trace).  An interval ends at the first
+** access after its last cycle.
+*/
+#define WORKING_SET_FILE_NAME "blitz.ws"
+#define VIRTUAL_PAGES (0x01000000 / PAGE_SIZE)
+#define REUSE_BUCKETS 16            /* 1, 2-3, 4-7, ... */
+#define WS_REFERENCED 0x01
+#define WS_DIRTY 0x02
+
+typedef struct WorkingSet WorkingSet;
+
+struct WorkingSet {
+  int ptbr;                         /* -1 for the "other" entry */
+  unsigned char * pages;            /* WS_REFERENCED and WS_DIRTY bits */
+  long long * lastInterval;         /* When each page was last referenced */
+  int referenced;                   /* Pages referenced in this interval */
+  int dirtied;                      /* Pages dirtied in this interval */
+  int newPages;                     /* Pages referenced for the first time */
+  long long intervals;              /* Intervals in which pages were used */
+  long long totalReferenced;
+  long long totalDirtied;
+  int maxReferenced;
+  long long reuseHistogram [REUSE_BUCKETS];
+};
+
+int commandOptionWorkingSet = 0;    /* Cycles per interval; 0=no analysis */
+FILE * workingSetFile = NULL;       /* The "blitz.ws" file */
+WorkingSet workingSets [MAX_ADDRESS_SPACES];
+int numberOfWorkingSets = 0;
+WorkingSet * currentWorkingSet = NULL;   /* Entry for the ptbr, or NULL */
+long long workingSetInterval;       /* Number of the current interval, 1,2,.. */
+long long endOfWorkingSetInterval;  /* The first cycle of the next interval */
+
+
+
+/*****  Seed Sweep  *****
+**
+** With the "-sweep n" option, the program is run n times, each time as with
+** "-g" but with a different random seed, so that the timer, disk, and serial
+** timing differs from run to run.  The seeds are 1, 2, ..., n, or start at
+** the value given with "-r".  Up to "-j k" runs (by default, one for each
+** host processor) are done at once, each in a separate host process.
+**
+** Each run sees the DISK file as it was when the sweep started: the file is
+** opened read-only and mapped copy-on-write (MAP_PRIVATE), so that sectors
+** written by one run are not seen by the others or saved.  The output of
+** each run (stdout and stderr, which includes both the serial device and
+** the "debug2" print functions) goes to a temporary file.  When a run ends,
+** whether by halting, by stopping (at a "debug" instruction or an error),
+** or by reaching the "-limit", the child process records its outcome in a
+** shared table, including a hash of the output up to the emulator's final
+** "Done!" message.  The parent then prints one line per run and the
+** distinct outputs seen.
+**
+** Since emulation is deterministic for a given seed, any run may be repeated
+** with "-r seed".
+*/
+#define SWEEP_NOT_FINISHED  0       /* Child exited without recording */
+#define SWEEP_HALTED        1       /* A "wait" with nothing scheduled */
+#define SWEEP_STOPPED       2       /* Debug instruction or error */
+#define SWEEP_LIMIT         3       /* Reached the "-limit" */
+#define SWEEP_FAILED        4       /* Child exited; see exitStatus */
+#define SWEEP_KILLED        5       /* Child killed; exitStatus=signal */
+
+#define SWEEP_HASH_BASIS    0xcbf29ce484222325ULL   /* 64-bit FNV-1a */
+#define SWEEP_HASH_PRIME    0x00000100000001b3ULL
+
+typedef struct SweepRun SweepRun;
+
+struct SweepRun {
+  int seed;
+  int pid;
+  int result;                       /* SWEEP_HALTED, SWEEP_STOPPED, etc. */
+  int exitStatus;
+  int pc;                           /* Where a stopped run stopped */
+  long long instructions;
+  long long elapsedTime;
+  int diskReads;
+  int diskWrites;
+  long long outputBytes;            /* Length of the output */
+  unsigned long long outputHash;    /* FNV-1a hash of the output */
+};
+
+int commandOptionSweep = 0;         /* Number of runs; 0=no sweep */
+int commandOptionJobs = 0;          /* Runs at once, from "-j" */
+long long commandOptionLimit = 0;   /* Cycles per run; 0=no limit */
+SweepRun * sweepRuns = NULL;        /* Shared with the children */
+SweepRun * sweepRun = NULL;         /* In a child, this run's entry */
+int diskCopyOnWrite = 0;            /* Map the DISK file MAP_PRIVATE */
+FILE * sweepOutputFile = NULL;      /* In a child, where the output goes */
+
+
+
+/*****  Library Interface  *****
+**
+** When compiled with "-DBLITZ_LIBRARY", "main" is left out and another
+** program may drive the emulator with the routines declared in "blitz.h"
+** (blitzCreate, blitzLoad, blitzRun, etc.), which are at the end of this
+** file.  This is only a wrapper around a single machine: the machine state
+** is still kept in the globals above, so only one BlitzMachine may exist at
+** a time in a process.  A second blitzCreate fails, and the other routines
+** refuse any BlitzMachine but the current one (see libraryMachineOk).
+** Running several machines in one process would mean moving all of that
+** state into the BlitzMachine, and is not supported.  Since the "-async"
+** DISK I/O thread may be used, programs must be linked with "-lpthread".
+**
+** During a library call, "libraryErrorJump" is set, and errorExit returns
+** to the call with longjmp rather than exiting.  The machine is then marked
+** as failed and may not be run until an a.out file is loaded again.
+*/
+struct BlitzMachine {
+  int failed;                       /* 1=must load an a.out before running */
+  jmp_buf errorJump;                /* Where errorExit goes during a call */
+  char * executableFileName;        /* Copies of the names passed in */
+  char * diskFileName;
+};
+
+BlitzMachine * libraryMachine = NULL;    /* The machine, if one exists */
+jmp_buf * libraryErrorJump = NULL;       /* Set during library calls */
+
+
+
+/*****  DMA Disk Controller  *****
+**
+** The DMA disk controller is a second way to use the DISK.  Instead of one
+** request at a time, through the DISK registers, the program puts requests
+** into a ring of descriptors in memory, and the controller puts a completion
+** into a second ring as each finishes.  Several requests may be outstanding,
+** and each may transfer to or from any set of page frames.  The controller
+** occupies DMA_CONTROLLER_BYTES in the memory-mapped area, beginning at
+** DMA_CONTROLLER_ADDRESS:
+**
+**     +0    physical address of the request ring
+**     +4    physical address of the completion ring
+**     +8    number of entries in each ring (0..DMA_MAX_RING_SIZE; 0=off)
+**     +12   request tail: the program stores the index after its last
+**           request, which starts the controller on any new requests
+**     +16   completion head: the program stores the index after the last
+**           completion it has dealt with
+**     +20   request head: the next request the controller will take (read only)
+**     +24   completion tail: the index after the last completion (read only)
+**     +28   interrupt count (see below)
+**     +32   interrupt delay, in cycles (see below)
+**
+** Each request descriptor is DMA_REQUEST_BYTES long:
+**
+**     +0    DISK_READ_COMMAND or DISK_WRITE_COMMAND
+**     +4    the first sector number
+**     +8    the number of sectors, N (1..DMA_MAX_SECTORS)
+**     +12   a tag, returned in the completion
+**     +16   the physical addresses of N page frames, one per sector
+**
+** Each completion is two words: the tag and the status, which is
+** OPERATION_COMPLETED_OK or one of the errors of the DISK (1: a bad count or
+** a frame not page-aligned, 2: a frame not in memory, or a descriptor in
+** the buffer of a DISK operation in progress, 3: no such sectors,
+** 4: a simulated error, 5: a bad command).  The ring addresses may only be
+** changed while the ring size is 0, and the ring size only while the
+** controller is idle; storing the size sets all the indexes to zero and
+** checks that both rings are in memory.  A ring with N entries holds at
+** most N-1 requests
+** or completions, and the controller never takes a request unless there
+** will be room for its completion.
+**
+** The controller copies each new request as soon as it sees it.  Of the
+** requests it holds, it serves the one which the head can reach soonest
+** (given the seek and rotational delays of the DISK), so requests may
+** complete in a different order than they were given.  The data is moved
+** when the request completes; the program must not touch the frames before
+** then.
+**
+** Completions are batched: the DISK_INTERRUPT is signaled when the number
+** of completions since the last interrupt reaches the interrupt count, when
+** the interrupt delay has passed since the first of them, or when the
+** controller has nothing more to do.  An interrupt count of 0 or 1 gives
+** an interrupt for every completion, and an interrupt delay of 0 means no
+** time limit.
+*/
+#define DMA_CONTROLLER_BYTES 36
+#define DMA_MAX_RING_SIZE 64
+#define DMA_MAX_SECTORS 16
+#define DMA_REQUEST_BYTES (4 * (4 + DMA_MAX_SECTORS))
+#define DMA_COMPLETION_BYTES 8
+
+#define DMA_REQUEST_RING_REGISTER 0
+#define DMA_COMPLETION_RING_REGISTER 4
+#define DMA_RING_SIZE_REGISTER 8
+#define DMA_REQUEST_TAIL_REGISTER 12
+#define DMA_COMPLETION_HEAD_REGISTER 16
+#define DMA_REQUEST_HEAD_REGISTER 20
+#define DMA_COMPLETION_TAIL_REGISTER 24
+#define DMA_INTERRUPT_COUNT_REGISTER 28
+#define DMA_INTERRUPT_DELAY_REGISTER 32
+
+typedef struct DmaRequest DmaRequest;
+
+struct DmaRequest {
+  int       command;
+  int       sector;
+  int       count;
+  int       tag;
+  int       frames [DMA_MAX_SECTORS];
+  int       status;           /* OPERATION_COMPLETED_OK or an error */
+};
+
+int dmaRequestRing;                  /* The controller registers... */
+int dmaCompletionRing;
+int dmaRingSize;
+int dmaRequestTail;
+int dmaCompletionHead;
+int dmaRequestHead;
+int dmaCompletionTail;
+int dmaInterruptCount;
+int dmaInterruptDelay;
+DmaRequest dmaPending [DMA_MAX_RING_SIZE];  /* Taken, but not yet started */
+int dmaNumberPending;
+DmaRequest dmaActive;                /* The request being served */
+int dmaActiveValid;                  /* 1=dmaActive is being served */
+long long dmaActiveTime;             /* When dmaActive will finish */
+int dmaCompletionsSinceInterrupt;
+long long dmaInterruptTime;          /* When the delay is up; or MAX_TIME */
+
+
+
+/*****  Timer Device  *****
+**
+** The timer device lets a kernel control the TIMER_INTERRUPT at runtime.  It
+** occupies TIMER_DEVICE_BYTES in the memory-mapped area, beginning at
+** TIMER_DEVICE_ADDRESS:
+**
+**     +0    control word
+**     +4    the current time, in cycles (high word, then low word)
+**     +12   one-shot delay, in cycles
+**
+** Writing TIMER_NO_TICK to the control word turns off the periodic timer
+** interrupt (every TIME_SLICE cycles); writing 0 turns it back on, with the
+** next tick one time slice from now.  As with the performance counters,
+** reading the high word of the time latches the low word.
+**
+** Writing N > 0 to the one-shot delay arms the one-shot timer, which will
+** signal a TIMER_INTERRUPT once, N cycles from now, on the CPU that wrote
+** it.  Writing 0 disarms it.  Reading returns the cycles remaining, or 0 if
+** it is not armed.  A "wait" instruction sleeps until the one-shot timer
+** goes off, if nothing else happens first, so a kernel with no periodic
+** tick can sleep straight to its next deadline.
+*/
+#define TIMER_DEVICE_BYTES 16
+#define TIMER_CONTROL_REGISTER 0
+#define TIMER_TIME_HIGH_REGISTER 4
+#define TIMER_TIME_LOW_REGISTER 8
+#define TIMER_ONE_SHOT_REGISTER 12
+#define TIMER_NO_TICK 0x00000001
+
+int timerTickDisabled;               /* 1=TIMER_NO_TICK was written */
+int timerLowWordLatched;             /* 1=the high word of the time was read */
+int timerLatchedLowWord;             /* The low word at that time */
+int oneShotCpu;                      /* The CPU which armed the one-shot */
+
+
+
+/*****  Serial FIFOs  *****
+**
+** If SERIAL_FIFO_DEPTH is not zero, the serial device works somewhat like a
+** 16550 UART, with a receive FIFO and a transmit FIFO, each holding up to
+** SERIAL_FIFO_DEPTH characters.  (With zero, the device handles one character
+** at a time, as always, and none of this applies.)
+**
+** At each keyboard check, as many characters as are available and will fit
+** are moved from the input into the receive FIFO.  A serial interrupt is
+** signaled when the receive FIFO holds SERIAL_FIFO_THRESHOLD or more
+** characters, or when it holds any and no more input has arrived (the
+** "timeout" interrupt).  While the FIFO is full, input simply waits, so no
+** character is ever lost.  Reading the SERIAL_DATA_WORD removes the first
+** character from the FIFO.
+**
+** Storing into the SERIAL_DATA_WORD adds a character to the transmit FIFO;
+** an overrun occurs only when it is full.  The characters are sent one after
+** another, each taking TERM_OUT_DELAY cycles, and one serial interrupt is
+** signaled when the transmit FIFO becomes empty.
+**
+** In the SERIAL_STATUS_WORD, bit 0 (0x00000001) is set when the receive FIFO
+** is not empty and bit 1 (0x00000002) when the transmit FIFO is not full.  In
+** addition, bits 8..15 give the number of characters in the receive FIFO and
+** bits 16..23 the free space in the transmit FIFO, so the program can move
+** many characters for each interrupt.
+**
+** In FIFO mode, the output file is not flushed after every character; the
+** characters are written in blocks whenever execution stops or the machine
+** sleeps (or the host buffer fills).
+*/
+#define SERIAL_FIFO_MAX 255
+
+char serialReceiveFifo [SERIAL_FIFO_MAX];
+int serialReceiveCount;           /* Number of characters in the receive FIFO */
+int serialReceiveOut;             /* Index of the first one */
+int serialTransmitCount;          /* Number of characters in the transmit FIFO */
+
+
+
+/*****  Coverage  *****
+**
+** With the "-coverage filename" option, the emulator records which words of
+** the .text segment have been executed, in a bitmap with one bit per word.
+** (Bit 7 of byte 0 is for the word at textAddr, bit 6 for the next word, and
+** so on.)  At exit, the named file is written, containing a summary line for
+** each function (see findFunctions), followed by the bitmap itself in hex.
+** Instructions executed from outside the .text segment are not recorded.
+**
+** To keep the cost low, each DecodedInstruction has a "covered" flag, which
+** is set once the word has been recorded.  Since the decoded instruction
+** cache is indexed by physical address, the bitmap is normally touched only
+** the first time each word is executed.
+*/
+char * coverageFileName = NULL;          /* Set by the "-coverage" option */
+unsigned char * coverageBitmap = NULL;   /* One bit per word of .text */
+
+
+
+/*****  Statistics  *****
+**
+** The following counters are kept as the BLITZ program runs.  The "stats"
+** command prints them in JSON format.  With the "-stats filename" option,
+** they are also written to the named file, in the same format, at exit.
+** (The output of printFinalStats is unchanged.)  All are zeroed by "reset".
+**
+** The instruction mix is kept by opcode, separately for system and user mode.
+** Interrupts are counted as they are taken, by interrupt vector.  Page table
+** walks are the translations done with paging turned on that could not be
+** satisfied from the TLB; TLB hits are those that were.  (With "-batch", the
+** instruction fetches within a basic block need no translation at all and
+** are counted as neither.)  The disk latency of an operation is the number
+** of cycles from the store into the DISK_COMMAND_WORD until the disk
+** interrupt.  The host MIPS figure covers only the time spent executing
+** BLITZ instructions with "go" and related commands.
+*/
+#define NUMBER_OF_INTERRUPT_VECTORS 15
+
+char * statsFileName = NULL;             /* Set by the "-stats" option */
+long long instructionMix [2] [256];      /* [statusS] [opcode] */
+long long interruptsTaken [NUMBER_OF_INTERRUPT_VECTORS];  /* By vector/4 */
+long long tlbHits;                       /* Translations using the TLB */
+long long pageTableWalks;                /* Translations reading the table */
+long long pageInvalidExceptions;         /* Signaled by translate */
+long long pageReadonlyExceptions;        /* Signaled by translate */
+long long serialCharsIn;                 /* Characters read by the program */
+long long serialCharsOut;                /* Characters written by the program */
+long long diskSectorsRead;
+long long diskSectorsWritten;
+long long diskLatencyTotal;              /* Sum over all reads and writes */
+long long instructionsWhileTimed;        /* Executed during commandGo */
+double hostSecondsWhileTimed;            /* Host time spent in commandGo */
+
+/* These are the names of the interrupts, in interrupt vector order. */
+char * interruptNames [NUMBER_OF_INTERRUPT_VECTORS] = {
+  "POWER_ON_RESET", "TIMER_INTERRUPT", "DISK_INTERRUPT", "SERIAL_INTERRUPT",
+  "HARDWARE_FAULT", "ILLEGAL_INSTRUCTION", "ARITHMETIC_EXCEPTION",
+  "ADDRESS_EXCEPTION", "PAGE_INVALID_EXCEPTION", "PAGE_READONLY_EXCEPTION",
+  "PRIVILEGED_INSTRUCTION", "ALIGNMENT_EXCEPTION",
+  "EXCEPTION_DURING_INTERRUPT", "SYSCALL_TRAP", "INTERPROCESSOR_INTERRUPT"
+};
+
+/* These are the op-code mnemonics, used by the disassembler. */
+char * opcodeNames [] = {
+
+/* 0 .. 31 */
+"nop", "wait", "debug", "cleari", "seti", "clearp", "setp", "clears",
+"reti", "ret", "debug2", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+
+/* 32 .. 63 */
+"ldptbr", "ldptlr", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+
+/* 64 .. 95 */
+"call", "jmp", "be", "bne", "bl", "ble", "bg", "bge",
+"---", "---", "bvs", "bvc", "bns", "bnc", "bss", "bsc",
+"bis", "bic", "bps", "bpc", "push", "pop", "readu", "writeu",
+"tset", "ftoi", "itof", "fcmp", "fsqrt", "fneg", "fabs", "---",
+
+/* 96 .. 127 */
+"add", "sub", "mul", "div", "sll", "srl", "sra", "or",
+"and", "andn", "xor", "load", "loadb", "loadv", "loadbv", "store",
+"storeb", "storev", "storebv", "rem", "fadd", "fsub", "fmul", "fdiv",
+"fload", "fstore", "---", "---", "---", "---", "---", "---",
+
+/* 128 .. 159 */
+"add", "sub", "mul", "div", "sll", "srl", "sra", "or",
+"and", "andn", "xor", "load", "loadb", "loadv", "loadbv", "store",
+"storeb", "storev", "storebv", "readu", "writeu", "rem", "fload", "fstore",
+"---", "---", "---", "---", "---", "---", "---", "---",
+
+/* 160 .. 191 */
+"call", "jmp", "be", "bne", "bl", "ble", "bg", "bge",
+"---", "---", "bvs", "bvc", "bns", "bnc", "bss", "bsc",
+"bis", "bic", "bps", "bpc", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+
+/* 192 .. 223 */
+"sethi", "setlo", "ldaddr", "syscall", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+
+/* 224 .. 255 */
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+"---", "---", "---", "---", "---", "---", "---", "---",
+
+};
+
+
+
+
+/*****  Event Queue  *****
+**
+** Each device that needs something to happen at a future time (the timer,
+** the disk, serial input and serial output) owns an Event.  An Event is
+** scheduled by giving it a time; when "currentTime" reaches that time,
+** singleStep removes the Event from the queue and calls its handler.  The
+** handler must reschedule the Event (or schedule it for MAX_TIME, meaning never)
+** before it returns.  Each Event is in the queue at most once.
+**
+** The queue is a binary heap ordered by time.  Events due at the same time
+** are handled in the order in which they were registered.  The time of the
+** first event is kept in "timeOfNextEvent", so singleStep need only compare
+** "currentTime" against it on each cycle.
+*/
+typedef struct Event Event;
+
+struct Event {
+  long long time;         /* When the event is due; MAX_TIME = never */
+  int    priority;        /* Order of registration; breaks ties */
+  int    heapIndex;       /* Position in eventQueue, or -1 if not queued */
+  void   (* handler) ();  /* Routine to call when the event is due */
+  char * name;            /* E.g., "timer" */
+};
+
+#define MAX_NUMBER_OF_EVENTS 16
+Event * eventQueue [MAX_NUMBER_OF_EVENTS];   /* The heap */
+int numberOfQueuedEvents = 0;                /* Number of events in the heap */
+int numberOfRegisteredEvents = 0;            /* Used to assign priorities */
+
+Event timerEvent;                 /* Timer interrupt is due */
+Event diskEvent;                  /* Disk operation will complete */
+Event serialInEvent;              /* Time to check the keyboard again */
+Event serialOutEvent;             /* Serial output character has been sent */
+Event dmaEvent;                   /* DMA request done or interrupt delay up */
+Event oneShotEvent;               /* One-shot timer interrupt is due */
+
+
+
 /*****  Statement Codes  *****
 **
 ** These codes are used to identify the various KPL source code
@@ -462,6 +1542,14 @@ void commandRaw ();
 void commandCooked ();
 void printSerialHelp ();
 void commandFormat ();
+void commandSnapshot ();
+void commandRestore ();
+int writeSnapshot (char * fileName);
+int restoreSnapshot (char * fileName);
+void snapshotMachineState ();
+void snapshotInt (int * p);
+void snapshotTime (long long * p);
+void snapshotDouble (double * p);
 void commandTest ();
 void printNumberNL2 (int i);
 void printNumberNL (int i);
@@ -522,6 +1610,7 @@ void commandFMem ();
 void commandDis ();
 void commandDis2 ();
 void disassemble (int addr);
+void disassembleInstruction (int physAddr);
 void printRa (int instr);
 void printRb (int instr);
 void printRc (int instr);
@@ -534,11 +1623,13 @@ void printComment (int i);
 void printComment2 (int i);
 void printAboutToExecute ();
 void commandStepN ();
-void commandGo (int count);
+void commandGo (long long count);
 void commandStep ();
 void commandStepHigh ();
 void commandStepHigh2 ();
 void singleStep ();
+void executeInstruction (DecodedInstruction * d);
+int runBlock (int limit);
 int getRa (int instr);
 int getRb (int instr);
 int getRc (int instr);
@@ -560,8 +1651,103 @@ int getPhysicalWord (int addr);
 int getPhysicalWordAndLock (int addr);
 void putPhysicalWord (int addr, int value);
 void putPhysicalWordAndRelease (int addr, int value);
+void swapMemoryWords (int low, int high);
 void releaseMemoryLock (int physAddr);
 int inMemoryMappedArea (int addr);
+DecodedInstruction * fetchDecodedInstruction (int physAddr);
+void decodeInstruction (DecodedInstruction * d, int instr);
+int endsBasicBlock (int opcode);
+void invalidateDecodedWord (int physAddr);
+void invalidateDecodedRange (int low, int high);
+void resetDecodedInstructions ();
+void resetFrameFlags ();
+void updateDiskBusyFrames ();
+void resetProfile ();
+void profileInstruction (int physAddr);
+long long profileCount (int physAddr);
+int isProfileLabel (char * name);
+int findFunctions (ProfileEntry * entries);
+int compareProfileEntries (const void * a, const void * b);
+void printProfile ();
+void printProfileReport (ProfileEntry * entries, int numberOfEntries,
+                         long long total, int functionsToPrint,
+                         int functionsToList);
+int findFunctionLabel (int value);
+int readSampleWord (int virtAddr, int * value);
+int readSampleString (int ptr, char * buffer, int size);
+void takeSample ();
+void resetStats ();
+void commandStats ();
+void printStats (FILE * file);
+void writeStatsFile ();
+void openTraceFile ();
+void memoryAccess (int virtAddr, int physAddr, int reading);
+void recordAccess (int kind, int size, int virtAddr, int physAddr);
+void recordTrace (int kind, int size, int virtAddr, int physAddr);
+void flushTrace ();
+void resetCostModel ();
+void resetCache (Cache * cache, int sets, int ways);
+void flushCache (Cache * cache);
+void cacheAccess (Cache * cache, int physAddr);
+void chargeCycles (int opcode, int oldPc);
+long long perfCounterValue (int counter);
+void resetPerfCounters ();
+int getPerfCounterWord (int offset);
+void putPerfCounterWord (int offset, int value);
+void resetAccounting ();
+void markAccounting ();
+void chargeAddressSpace ();
+int compareAddressSpaces (const void * a, const void * b);
+void commandAcct ();
+void printAccounting ();
+void resetWorkingSets ();
+void startWorkingSetInterval ();
+WorkingSet * findWorkingSet ();
+void referencePage (int virtAddr, int writing);
+void endWorkingSetInterval ();
+void writeWorkingSetSummary ();
+void runSweep ();
+void startSweepRun (SweepRun * run);
+void finishSweepRun ();
+void printSweepReport ();
+char * copyFileName (char ** field, char * fileName);
+int libraryMachineOk (BlitzMachine * m);
+long long runInstructions (long long count);
+void stepCpu ();
+void multiprocessorStep ();
+int allCpusIdle ();
+void sleepUntilNextEvent ();
+void resetCpus ();
+void switchToCpu (int c);
+void signalCpu (int c, int interrupt);
+void invalidateOtherTLBs (int physAddr);
+int getCpuDeviceWord (int offset);
+void putCpuDeviceWord (int offset, int value);
+void commandCpus ();
+int getSerialFifoStatus ();
+int readReceiveFifo ();
+void fillReceiveFifo (int waitForKeystroke);
+void writeTransmitFifo ();
+void doTransmitFifoEvent ();
+void resetDmaController ();
+int dmaControllerBusy ();
+int getDmaControllerWord (int offset);
+void putDmaControllerWord (int offset, int value);
+void takeDmaRequests ();
+int dmaRingOk (int addr, int bytes);
+int dmaWordBusy (int addr);
+void readDmaRequest (int addr, DmaRequest * request);
+void startDmaRequest ();
+int dmaPositioningTime (int sector);
+void finishDmaRequest ();
+void postDmaCompletion (int tag, int status);
+void checkDmaInterrupt ();
+void doDmaEvent ();
+void resetCoverage ();
+void recordCoverage (int physAddr, DecodedInstruction * d);
+void writeCoverageFile ();
+void flushTLB ();
+void invalidateTLBEntry (int tableEntryAddr);
 int translate (int addr, int reading, int wantPrinting, int doUpdates);
 int getMemoryMappedWord (int physAddr);
 void putMemoryMappedWord (int physAddr, int value);
@@ -577,22 +1763,44 @@ void commandHex ();
 void commandDecimal ();
 void commandAscii ();
 void printHexDecimalAscii (int i);
-void jumpIfTrueRaRb (int cond, int instr);
-void jumpIfTrueData24 (int cond, int instr);
+void jumpIfTrueRaRb (int cond, DecodedInstruction * d);
+void jumpIfTrueData24 (int cond, DecodedInstruction * d);
 void controlC (int sig);
+void suspendExecution ();
 int randomBetween (int lo, int high);
 int genRandom ();
 void doTimerEvent ();
+void scheduleTimerTick ();
+void resetTimerDevice ();
+int getTimerDeviceWord (int offset);
+void putTimerDeviceWord (int offset, int value);
+void doOneShotEvent ();
 void doDiskEvent ();
 void doSerialInEvent (int waitForKeystroke);
 void doSerialOutEvent ();
-void updateTimeOfNextEvent ();
+void doSerialInEventFromQueue ();
+void initializeEventQueue ();
+void registerEvent (Event * event, char * name, void (* handler) ());
+void scheduleEvent (Event * event, long long time);
+void processEvents ();
+int eventBefore (Event * a, Event * b);
+void siftEventUp (int i);
+void siftEventDown (int i);
 void divide (int a, int b);
 void turnOnTerminal ();
 void turnOffTerminal ();
 char checkForInput (int waitForKeystroke);
 int characterAvailableOnStdin ();
 void initializeDisk ();
+void mapDiskFile (int length);
+void unmapDiskFile ();
+void syncDiskFile ();
+int flushDiskMapping ();
+int transferDiskSectors ();
+void * diskThreadMain (void * arg);
+void startDiskTransfer ();
+void waitForDiskIO ();
+void reportDiskTransferError (int result);
 void performDiskIO (int command);
 void checkDiskBufferError (int physAddr);
 void setSimulationConstants ();
@@ -601,6 +1809,8 @@ void printKPLStmtCode ();
 void printCurrentFileLineAndFunction ();
 
 
+#ifndef BLITZ_LIBRARY
+
 /* main()
 **
 ** Scan the command line arguments, then enter into the command loop.
@@ -615,15 +1825,38 @@ main (int argc, char ** argv) {
   POSITIVE_INFINITY = 1.0 / 0.0;
   NEGATIVE_INFINITY = -1.0 / 0.0;
   processCommandLine (argc, argv);
+  if (commandOptionSweep) {
+    runSweep ();        /* Returns only in the child processes */
+  }
   terminalInRawMode = 0;
   resetState ();
+  if (traceFileName != NULL) {
+    openTraceFile ();
+  }
+  if (restoreFileName != NULL) {
+    if (!restoreSnapshot (restoreFileName)) {
+      errorExit ();
+    }
+  }
   signal (SIGINT, controlC);
 
   /* If the "auto go" option (-g) was given, the just begin execution. */
   if (commandOptionG) {
-    commandGo (MAX);
-    if (executionHalted) {
+    commandGo (commandOptionLimit ? commandOptionLimit : MAX_TIME);
+    if (sweepRun != NULL) {
+      waitForDiskIO ();
+      finishSweepRun ();
+      exit (0);
+    } else if (executionHalted) {
+      waitForDiskIO ();
       printFinalStats ();
+      writeStatsFile ();
+      writeCoverageFile ();
+      printProfile ();
+      printAccounting ();
+      writeWorkingSetSummary ();
+      flushTrace ();
+      syncDiskFile ();
       exit (0);
     } else {
       fprintf (stderr, "\n\rEntering machine-level debugger...\n\r");
@@ -645,12 +1878,21 @@ main (int argc, char ** argv) {
   /* Each execution of this loop will read and execute one command. */
   while (1) {
     controlCPressed = 0;  /* Forget about any control-C's */
+    waitForDiskIO ();     /* Commands may look at memory or the DISK */
 
     printf ("> ");
     command = toLower (getToken ());
 
     if (!strcmp (command, "quit") || !strcmp (command, "q")) {
+      waitForDiskIO ();
       printFinalStats ();
+      writeStatsFile ();
+      writeCoverageFile ();
+      printProfile ();
+      printAccounting ();
+      writeWorkingSetSummary ();
+      flushTrace ();
+      syncDiskFile ();
       exit (0);
     } else if (!strcmp (command, "")) {
       // printf ("BLITZ Emulator: You are in the command-line interface.\n");
@@ -661,6 +1903,12 @@ main (int argc, char ** argv) {
       commandInfo ();
     } else if (!strcmp (command, "io")) {
       commandIO ();
+    } else if (!strcmp (command, "stats")) {
+      commandStats ();
+    } else if (!strcmp (command, "acct")) {
+      commandAcct ();
+    } else if (!strcmp (command, "cpus")) {
+      commandCpus ();
     } else if (!strcmp (command, "sim")) {
       commandSim ();
     } else if (!strcmp (command, "raw")) {
@@ -669,8 +1917,12 @@ main (int argc, char ** argv) {
       commandCooked ();
     } else if (!strcmp (command, "format")) {
       commandFormat ();
+    } else if (!strcmp (command, "snapshot")) {
+      commandSnapshot ();
+    } else if (!strcmp (command, "restore")) {
+      commandRestore ();
     } else if (!strcmp (command, "go") || !strcmp (command, "g")) {
-      commandGo (MAX);
+      commandGo (MAX_TIME);
     } else if (!strcmp (command, "step") || !strcmp (command, "s")) {
       commandStep ();
     } else if (!strcmp (command, "t")) {
@@ -838,6 +2090,8 @@ main (int argc, char ** argv) {
   }
 }
 
+#endif  /* BLITZ_LIBRARY */
+
 
 
 /* printFinalStats ()
@@ -845,84 +2099,506 @@ main (int argc, char ** argv) {
 ** This routine prints the final statistics.
 */
 void printFinalStats () {
+      int c;
       printf ("Number of Disk Reads    = %d\n", numberOfDiskReads);
       printf ("Number of Disk Writes   = %d\n", numberOfDiskWrites);
-      printf ("Instructions Executed   = %d\n", currentTime-timeSpentAsleep);
-      printf ("Time Spent Sleeping     = %d\n", timeSpentAsleep);
-      printf ("    Total Elapsed Time  = %d\n", currentTime);
+      printf ("Instructions Executed   = %lld\n", currentTime-timeSpentAsleep-stallCycles);
+      printf ("Time Spent Sleeping     = %lld\n", timeSpentAsleep);
+      if (costModelEnabled) {
+        printf ("Time Spent Stalled      = %lld\n", stallCycles);
+      }
+      if (numberOfCpus > 1) {
+        for (c = 0; c < numberOfCpus; c++) {
+          printf ("CPU %-2d Busy Cycles      = %lld\n", c, cpus [c].busyCycles);
+          printf ("CPU %-2d Idle Cycles      = %lld\n", c, cpus [c].idleCycles);
+        }
+      }
+      printf ("    Total Elapsed Time  = %lld\n", currentTime);
 }
 
 
 
-// checkHostCompatibility ()
-//
-// This routine checks that the host implementation of C++ meets certain
-// requirements.
-//
-// (1) This routine checks that integers are represented using exactly 4
-// bytes.
-//
-// (2) This routine checks that integers are stored in the expected
-// Big or Little Endian order.
-//
-// (3) This routine checks that integer overflow behavior is as expected
-// with two's complement arithmetic.
-//
-// (4) This routine checks that doubles are implemented using 8-bytes in
-// the IEEE standard, with the bytes in correct Big/Little Endian order.
-//
-// (5) This routine checks that the double->int conversion works as
-// expected.  If this is not the case, then truncateToInt() will need to
-// be changed.
-//
-void checkHostCompatibility () {
-  union fourBytes {
-    char chars [4];
-    unsigned int i;
-  } fourBytes;
-  double d;
-  char * p, * q;
-  int i, i1, i2, i3;
-
-  // Check that ints are in the expected Big/Little Endian order.
-  fourBytes.chars[0] = 0x12;
-  fourBytes.chars[1] = 0x34;
-  fourBytes.chars[2] = 0x56;
-  fourBytes.chars[3] = 0x78;
-  if (SWAP_BYTES(fourBytes.i) != 0x12345678) {
-    fatalError ("There is a big/little endian byte ordering problem.");
+/* resetProfile ()
+**
+** This routine discards any instruction counts gathered with the "-prof"
+** option and allocates an empty table, with one entry for each page frame
+** in physical memory.  It is called whenever memory is (re-)allocated.
+*/
+void resetProfile () {
+  int frame;
+  if (!commandOptionProf) {
+    return;
   }
-
-  // Check that we have at least 4 bytes of precision.
-  i = 0x00000001;
-  i <<= 20;
-  i <<= 10;
-  i >>= 20;
-  i >>= 10;
-  if (i != 0x00000001) {
-    fatalError ("This program only runs on computers with 4 byte integers - 1");
+  if (profilePages != NULL) {
+    for (frame = 0; frame < numberOfProfilePages; frame++) {
+      if (profilePages [frame] != NULL) {
+        free (profilePages [frame]);
+      }
+    }
+    free (profilePages);
+  }
+  numberOfProfilePages = (MEMORY_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+  profilePages = (long long **) calloc (numberOfProfilePages,
+                                        sizeof (long long *));
+  if (profilePages == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
   }
+}
 
-  // Check that we have no more than 4 bytes of precision.
-  i = 0x00000001;
-  i <<= 20;
-  i <<= 13;   // Some compilers treat <<33 as a nop!
-  i >>= 20;
-  i >>= 13;
-  if (i != 0x00000000) {
-    fatalError ("This program only runs on computers with 4 byte integers - 2");
+
+
+/* profileInstruction (physAddr)
+**
+** This routine is called with the "-prof" option whenever an instruction is
+** fetched from the given physical address, just before it is executed.  It
+** increments the count for that address.
+*/
+void profileInstruction (int physAddr) {
+  long long * page;
+  page = profilePages [physAddr / PAGE_SIZE];
+  if (page == NULL) {
+    page = (long long *) calloc (INSTRS_PER_PAGE, sizeof (long long));
+    if (page == NULL) {
+      fatalError ("Calloc failed - insufficient memory available");
+    }
+    profilePages [physAddr / PAGE_SIZE] = page;
   }
+  page [(physAddr % PAGE_SIZE) / 4]++;
+}
 
-  // Check that we have the expected overflow behavior for ints.
-  i = -2147483647;
-  i = i - 2;
-  if (i != 2147483647) {
-    fatalError ("This program only runs on computers with 4 byte integers - 3");
+
+
+/* profileCount (physAddr) --> long long
+**
+** This routine returns the number of times the instruction at the given
+** physical address has been executed.
+*/
+long long profileCount (int physAddr) {
+  long long * page;
+  if (!physicalAddressOk (physAddr) || !isAligned (physAddr)) {
+    return 0;
+  }
+  page = profilePages [physAddr / PAGE_SIZE];
+  if (page == NULL) {
+    return 0;
   }
+  return page [(physAddr % PAGE_SIZE) / 4];
+}
 
-  // Check that doubles are represented as we expect.
-  d = 123.456e37;
-  p = (char *) &d;
+
+
+/* isProfileLabel (name) --> bool
+**
+** This routine returns true if the given label should be treated as the
+** start of a function when profiling.  The labels generated by the KPL
+** compiler for jumps within a routine ("_Label_...") are not.
+*/
+int isProfileLabel (char * name) {
+  return strncmp (name, "_Label_", 7) != 0;
+}
+
+
+
+/* findFunctions (entries) --> int
+**
+** This routine fills in the name, low and high fields of the given array,
+** which must have room for numberOfLabels entries, with one entry for each
+** function label in the .text segment (see isProfileLabel), in order of
+** address.  Since valueIndex is sorted, each function runs up to the next
+** one; the last runs to the end of the .text segment.  If several labels
+** share an address, the first is used.  It returns the number of entries.
+*/
+int findFunctions (ProfileEntry * entries) {
+  int i, numberOfEntries, textEnd;
+  TableEntry * tableEntry;
+  textEnd = textAddr + textSize;
+  numberOfEntries = 0;
+  for (i = 0; i < numberOfLabels; i++) {
+    tableEntry = valueIndex [i];
+    if ((tableEntry->value < textAddr) || (tableEntry->value >= textEnd) ||
+        !isProfileLabel (tableEntry->string)) {
+      continue;
+    }
+    if ((numberOfEntries > 0) &&
+        (entries [numberOfEntries-1].low == tableEntry->value)) {
+      continue;
+    }
+    if (numberOfEntries > 0) {
+      entries [numberOfEntries-1].high = tableEntry->value;
+    }
+    entries [numberOfEntries].name = tableEntry->string;
+    entries [numberOfEntries].low = tableEntry->value;
+    entries [numberOfEntries].high = textEnd;
+    entries [numberOfEntries].count = 0;
+    numberOfEntries++;
+  }
+  return numberOfEntries;
+}
+
+
+
+/* compareProfileEntries (a, b) --> int
+**
+** This routine is passed to qsort.  It orders the profile entries by
+** decreasing count, and entries with equal counts by address.
+*/
+int compareProfileEntries (const void * a, const void * b) {
+  const ProfileEntry * p = (const ProfileEntry *) a;
+  const ProfileEntry * q = (const ProfileEntry *) b;
+  if (p->count != q->count) {
+    return (p->count > q->count) ? -1 : 1;
+  }
+  return (p->low < q->low) ? -1 : (p->low > q->low);
+}
+
+
+
+/* printProfile ()
+**
+** If the "-prof" option was given, this routine totals the instruction
+** counts by function and prints the busiest functions.  It then writes the
+** complete report, including an annotated listing of the hottest functions,
+** to the file "blitz.prof".  It is called at exit.
+*/
+void printProfile () {
+  ProfileEntry * entries;
+  int numberOfEntries, i, addr, textEnd, savedStdout;
+  long long total, charged;
+  FILE * profileFile;
+
+  if (!commandOptionProf || profilePages == NULL) {
+    return;
+  }
+
+  /* Add up all of the counts. */
+  total = 0;
+  for (i = 0; i < numberOfProfilePages; i++) {
+    if (profilePages [i] != NULL) {
+      for (addr = 0; addr < INSTRS_PER_PAGE; addr++) {
+        total += profilePages [i] [addr];
+      }
+    }
+  }
+
+  /* Make an entry for each function. */
+  entries = (ProfileEntry *) calloc (numberOfLabels + 1, sizeof (ProfileEntry));
+  if (entries == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+  numberOfEntries = findFunctions (entries);
+  textEnd = textAddr + textSize;
+
+  /* Total the counts for each function.  Whatever is left over goes to
+     a final "(no label)" entry. */
+  charged = 0;
+  for (i = 0; i < numberOfEntries; i++) {
+    for (addr = entries [i].low; addr < entries [i].high; addr += 4) {
+      entries [i].count += profileCount (addr);
+    }
+    charged += entries [i].count;
+  }
+  entries [numberOfEntries].name = "(no label)";
+  entries [numberOfEntries].low = textEnd;
+  entries [numberOfEntries].high = textEnd;
+  entries [numberOfEntries].count = total - charged;
+  numberOfEntries++;
+  qsort (entries, numberOfEntries, sizeof (ProfileEntry),
+         compareProfileEntries);
+
+  /* Print the summary. */
+  printProfileReport (entries, numberOfEntries, total,
+                      PROFILE_FUNCTIONS_TO_PRINT, 0);
+
+  /* Write the full report to the file, temporarily redirecting stdout
+     so that disassembleInstruction may be used for the listing. */
+  profileFile = fopen (PROFILE_FILE_NAME, "w");
+  if (profileFile == NULL) {
+    printf ("Unable to write the profile to file \"%s\"\n", PROFILE_FILE_NAME);
+    free (entries);
+    return;
+  }
+  fflush (stdout);
+  savedStdout = dup (fileno (stdout));
+  dup2 (fileno (profileFile), fileno (stdout));
+  printProfileReport (entries, numberOfEntries, total,
+                      numberOfEntries, PROFILE_FUNCTIONS_TO_LIST);
+  fflush (stdout);
+  dup2 (savedStdout, fileno (stdout));
+  close (savedStdout);
+  fclose (profileFile);
+  printf ("Profile written to file \"%s\"\n", PROFILE_FILE_NAME);
+  free (entries);
+}
+
+
+
+/* printProfileReport (entries, numberOfEntries, total,
+**                     functionsToPrint, functionsToList)
+**
+** This routine is passed the profile entries, sorted by decreasing count,
+** and the total number of instructions counted.  It prints a line for each
+** of the first "functionsToPrint" entries, stopping at the first that was
+** never executed.  Then it prints an annotated listing, showing the count
+** for each instruction, of the first "functionsToList" entries.
+*/
+void printProfileReport (ProfileEntry * entries, int numberOfEntries,
+                         long long total, int functionsToPrint,
+                         int functionsToList) {
+  int i, addr, index;
+  long long count;
+  TableEntry * tableEntry;
+
+  printf ("Profile: %lld instructions executed\n", total);
+  if (total == 0) {
+    return;
+  }
+  printf ("     Instructions       %%  Function\n");
+  for (i = 0; i < numberOfEntries && i < functionsToPrint; i++) {
+    if (entries [i].count == 0) {
+      break;
+    }
+    printf ("  %15lld  %5.1f%%  %s\n", entries [i].count,
+            100.0 * entries [i].count / total, entries [i].name);
+  }
+
+  for (i = 0; i < numberOfEntries && i < functionsToList; i++) {
+    if ((entries [i].count == 0) || (entries [i].low == entries [i].high)) {
+      continue;
+    }
+    printf ("\n=====  %s  (%lld instructions, %.1f%%)  =====\n",
+            entries [i].name, entries [i].count,
+            100.0 * entries [i].count / total);
+    for (addr = entries [i].low; addr < entries [i].high; addr += 4) {
+      index = findLabel (addr);
+      while ((index != -1) && (index < numberOfLabels)) {
+        tableEntry = valueIndex [index++];
+        if (tableEntry->value != addr) break;
+        printf ("                                  %s:\n", tableEntry->string);
+      }
+      count = profileCount (addr);
+      if (count) {
+        printf ("%15lld  ", count);
+      } else {
+        printf ("                 ");
+      }
+      disassembleInstruction (addr);
+    }
+  }
+}
+
+
+
+/* findFunctionLabel (value) --> int
+**
+** This routine returns the index (in valueIndex) of the nearest label at or
+** below the given value which would be treated as the start of a function
+** when profiling (see isProfileLabel), or -1 if there is none.  Only labels
+** in the .text segment are considered.
+*/
+int findFunctionLabel (int value) {
+  int low, high, mid;
+  if ((value < textAddr) || (value >= textAddr + textSize)) {
+    return -1;
+  }
+  /* Find the last label whose value is <= the given value. */
+  low = 0;
+  high = numberOfLabels - 1;
+  while (low <= high) {
+    mid = (low + high) / 2;
+    if (valueIndex [mid]->value <= value) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  for (; high >= 0; high--) {
+    if (valueIndex [high]->value < textAddr) {
+      return -1;
+    }
+    if (isProfileLabel (valueIndex [high]->string)) {
+      return high;
+    }
+  }
+  return -1;
+}
+
+
+
+/* readSampleWord (virtAddr, &value) --> bool
+**
+** This routine reads a word from the BLITZ memory for takeSample, using the
+** current mode and page table.  Nothing about the machine is changed.  If
+** the address is bad, or the word is in a frame needing special handling
+** (the memory-mapped area or a busy disk buffer), it returns FALSE.
+*/
+int readSampleWord (int virtAddr, int * value) {
+  int physAddr;
+  physAddr = translate (virtAddr, 1, 0, 0);  // reading=1, wantPrinting=0, doUpdates=0
+  if (translateCausedException) {
+    return 0;
+  }
+  if (frameFlags [physAddr / PAGE_SIZE]) {
+    if (inMemoryMappedArea (physAddr) ||
+        (currentDiskStatus == DISK_BUSY &&
+         physAddr >= diskBufferLow && physAddr < diskBufferHigh)) {
+      return 0;
+    }
+  }
+  * value = MEMORY_WORD (* (int *) (memory + physAddr));
+  return 1;
+}
+
+
+
+/* readSampleString (ptr, buffer, size) --> bool
+**
+** This routine copies a null-terminated string from the BLITZ memory into
+** the buffer, truncating it to fit.  Characters which would confuse the
+** folded format (blanks and semicolons) are changed to underscores.  If the
+** string cannot be read or contains non-printable characters, it returns
+** FALSE.
+*/
+int readSampleString (int ptr, char * buffer, int size) {
+  int word, i;
+  for (i = 0; ; i++, ptr++) {
+    if (!readSampleWord (ptr & 0xfffffffc, & word)) {
+      return 0;
+    }
+    /* Isolate the byte in the word and shift to lower-order 8 bits. */
+    word = (word >> (24 - ((ptr & 0x00000003) << 3))) & 0x000000ff;
+    if (word == 0) {
+      break;
+    }
+    if (word < ' ' || word >= 0x7f) {
+      return 0;
+    }
+    if (word == ' ' || word == ';') {
+      word = '_';
+    }
+    if (i < size - 1) {
+      buffer [i] = word;
+    }
+  }
+  buffer [(i < size - 1) ? i : size - 1] = '\0';
+  return (i > 0);
+}
+
+
+
+/* takeSample ()
+**
+** This routine is called by commandGo when a stack sample is due.  It walks
+** the KPL calling stack and appends one line to the sample file, weighted by
+** the number of sample times that have passed.
+*/
+void takeSample () {
+  long long weight;
+  int fp, oldFp, depth, i, index, addrOfRoutineDescriptor, ptrToFunName;
+  char names [MAX_SAMPLE_DEPTH] [MAX_SAMPLE_NAME];
+
+  weight = (currentTime - timeOfNextSample) / commandOptionSample + 1;
+  timeOfNextSample += weight * commandOptionSample;
+
+  // Walk the frames, from the stack top down...
+  fp = statusS ? systemRegisters [14] : userRegisters [14];
+  depth = 0;
+  while ((fp != 0) && (depth < MAX_SAMPLE_DEPTH)) {
+    if (!readSampleWord (fp-8, & addrOfRoutineDescriptor) ||
+        !readSampleWord (addrOfRoutineDescriptor+4, & ptrToFunName) ||
+        !readSampleString (ptrToFunName, names [depth], MAX_SAMPLE_NAME)) {
+      break;
+    }
+    depth++;
+    oldFp = fp;
+    if (!readSampleWord (fp, & fp) || (fp != 0 && fp <= oldFp)) {
+      break;
+    }
+  }
+
+  // Print the frames outermost first...
+  fprintf (sampleFile, statusS ? "[system]" : "[user]");
+  if (depth == 0) {
+    index = findFunctionLabel (pc);
+    fprintf (sampleFile, ";%s",
+             (index == -1) ? "[unknown]" : valueIndex [index]->string);
+  }
+  for (i = depth - 1; i >= 0; i--) {
+    fprintf (sampleFile, ";%s", names [i]);
+  }
+  fprintf (sampleFile, " %lld\n", weight);
+}
+
+
+
+// checkHostCompatibility ()
+//
+// This routine checks that the host implementation of C++ meets certain
+// requirements.
+//
+// (1) This routine checks that integers are represented using exactly 4
+// bytes.
+//
+// (2) This routine checks that integers are stored in the expected
+// Big or Little Endian order.
+//
+// (3) This routine checks that integer overflow behavior is as expected
+// with two's complement arithmetic.
+//
+// (4) This routine checks that doubles are implemented using 8-bytes in
+// the IEEE standard, with the bytes in correct Big/Little Endian order.
+//
+// (5) This routine checks that the double->int conversion works as
+// expected.  If this is not the case, then truncateToInt() will need to
+// be changed.
+//
+void checkHostCompatibility () {
+  union fourBytes {
+    char chars [4];
+    unsigned int i;
+  } fourBytes;
+  double d;
+  char * p, * q;
+  int i, i1, i2, i3;
+
+  // Check that ints are in the expected Big/Little Endian order.
+  fourBytes.chars[0] = 0x12;
+  fourBytes.chars[1] = 0x34;
+  fourBytes.chars[2] = 0x56;
+  fourBytes.chars[3] = 0x78;
+  if (SWAP_BYTES(fourBytes.i) != 0x12345678) {
+    fatalError ("There is a big/little endian byte ordering problem.");
+  }
+
+  // Check that we have at least 4 bytes of precision.
+  i = 0x00000001;
+  i <<= 20;
+  i <<= 10;
+  i >>= 20;
+  i >>= 10;
+  if (i != 0x00000001) {
+    fatalError ("This program only runs on computers with 4 byte integers - 1");
+  }
+
+  // Check that we have no more than 4 bytes of precision.
+  i = 0x00000001;
+  i <<= 20;
+  i <<= 13;   // Some compilers treat <<33 as a nop!
+  i >>= 20;
+  i >>= 13;
+  if (i != 0x00000000) {
+    fatalError ("This program only runs on computers with 4 byte integers - 2");
+  }
+
+  // Check that we have the expected overflow behavior for ints.
+  i = -2147483647;
+  i = i - 2;
+  if (i != 2147483647) {
+    fatalError ("This program only runs on computers with 4 byte integers - 3");
+  }
+
+  // Check that doubles are represented as we expect.
+  d = 123.456e37;
+  p = (char *) &d;
   q = p;
   // If doubles are stored in Big Endian byte order....
   if ((*p++ == '\x48') &&
@@ -1083,77 +2759,274 @@ void processCommandLine (int argc, char ** argv) {
         gotWaitOption = 1;
       }
 
-    /* Scan the -r option */
-    } else if (!strcmp (*argv, "-r")) {
+    /* Scan the -batch option */
+    } else if (!strcmp (*argv, "-batch")) {
+      if (commandOptionBatch) {
+        badOption ("Multiple occurences of the -batch option");
+      } else {
+        commandOptionBatch = 1;
+      }
+
+    /* Scan the -prof option */
+    } else if (!strcmp (*argv, "-prof")) {
+      if (commandOptionProf) {
+        badOption ("Multiple occurences of the -prof option");
+      } else {
+        commandOptionProf = 1;
+      }
+
+    /* Scan the -acct option */
+    } else if (!strcmp (*argv, "-acct")) {
+      if (commandOptionAcct) {
+        badOption ("Multiple occurences of the -acct option");
+      } else {
+        commandOptionAcct = 1;
+      }
+
+    /* Scan the -cpus option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-cpus")) {
       if (argc <= 1) {
-        badOption ("Expecting integer after -r option");
+        badOption ("Expecting integer after -cpus option");
       } else {
         argCount++;
-        randSeedFromOption = atoi (*(argv+1));  /* Extra chars after int ignored */
-        if (randSeedFromOption <= 0) {
-          badOption ("Invalid integer after -r option");
+        if (commandOptionCpus) {
+          badOption ("Multiple occurences of the -cpus option");
         }
-        if (commandOptionRand) {
-          badOption ("Multiple occurences of the -r option");
-        } else {
-          commandOptionRand = 1;
+        commandOptionCpus = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if ((commandOptionCpus <= 0) || (commandOptionCpus > MAX_CPUS)) {
+          badOption ("Invalid integer after -cpus option");
         }
       }
 
-    /* Scan the -d option, which should be followed by a file name */
-    } else if (!strcmp (*argv, "-d")) {
+    /* Scan the -sample option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-sample")) {
       if (argc <= 1) {
-        badOption ("Expecting filename after -d option");
+        badOption ("Expecting integer after -sample option");
       } else {
         argCount++;
-        if (diskFileName == NULL) {
-          diskFileName = *(argv+1);
-        } else {
-          badOption ("Invalid command line - multiple DISK files");
+        if (commandOptionSample) {
+          badOption ("Multiple occurences of the -sample option");
+        }
+        commandOptionSample = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if (commandOptionSample <= 0) {
+          badOption ("Invalid integer after -sample option");
         }
       }
 
-    /* Scan the -i option, which should be followed by a file name */
-    } else if (!strcmp (*argv, "-i")) {
+    /* Scan the -ws option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-ws")) {
       if (argc <= 1) {
-        badOption ("Expecting filename after -i option");
+        badOption ("Expecting integer after -ws option");
       } else {
         argCount++;
-        if (termInputFileName == NULL) {
-          termInputFileName = *(argv+1);
-        } else {
-          badOption ("Multiple occurences of the -i option");
+        if (commandOptionWorkingSet) {
+          badOption ("Multiple occurences of the -ws option");
+        }
+        commandOptionWorkingSet = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if (commandOptionWorkingSet <= 0) {
+          badOption ("Invalid integer after -ws option");
         }
       }
 
-    /* Scan the -o option, which should be followed by a file name */
-    } else if (!strcmp (*argv, "-o")) {
+    /* Scan the -sweep option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-sweep")) {
       if (argc <= 1) {
-        badOption ("Expecting filename after -o option");
+        badOption ("Expecting integer after -sweep option");
       } else {
         argCount++;
-        if (termOutputFileName == NULL) {
-          termOutputFileName = *(argv+1);
-        } else {
-          badOption ("Multiple occurences of the -o option");
+        if (commandOptionSweep) {
+          badOption ("Multiple occurences of the -sweep option");
+        }
+        commandOptionSweep = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if (commandOptionSweep <= 0) {
+          badOption ("Invalid integer after -sweep option");
         }
       }
 
-    /* Deal with any invalid options that begin with "-", such as "-qwerty" */
-    } else if ((*argv)[0] == '-') {
-      fprintf (
-        stderr,
-        "BLITZ Emulator Error: Invalid command line option (%s); Use -h for help display\n",
-        *argv);
-      exit (1);
-    /* This token will be interpreted as the a.out file name. */
-    } else {
-      if (executableFileName == NULL) {
-        executableFileName = *argv;
+    /* Scan the -j option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-j")) {
+      if (argc <= 1) {
+        badOption ("Expecting integer after -j option");
       } else {
-        badOption ("Invalid command line - multiple input files");
-      }
-
+        argCount++;
+        if (commandOptionJobs) {
+          badOption ("Multiple occurences of the -j option");
+        }
+        commandOptionJobs = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if (commandOptionJobs <= 0) {
+          badOption ("Invalid integer after -j option");
+        }
+      }
+
+    /* Scan the -limit option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-limit")) {
+      if (argc <= 1) {
+        badOption ("Expecting integer after -limit option");
+      } else {
+        argCount++;
+        if (commandOptionLimit) {
+          badOption ("Multiple occurences of the -limit option");
+        }
+        commandOptionLimit = atoll (*(argv+1));  /* Extra chars after int ignored */
+        if (commandOptionLimit <= 0) {
+          badOption ("Invalid integer after -limit option");
+        }
+      }
+
+    /* Scan the -async option */
+    } else if (!strcmp (*argv, "-async")) {
+      if (commandOptionAsync) {
+        badOption ("Multiple occurences of the -async option");
+      } else {
+        commandOptionAsync = 1;
+      }
+
+    /* Scan the -mmap option */
+    } else if (!strcmp (*argv, "-mmap")) {
+      if (commandOptionMmap) {
+        badOption ("Multiple occurences of the -mmap option");
+      } else {
+        commandOptionMmap = 1;
+      }
+
+    /* Scan the -msync option, which should be followed by an integer */
+    } else if (!strcmp (*argv, "-msync")) {
+      if (argc <= 1) {
+        badOption ("Expecting integer after -msync option");
+      } else {
+        argCount++;
+        if (commandOptionMsync) {
+          badOption ("Multiple occurences of the -msync option");
+        }
+        commandOptionMsync = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if (commandOptionMsync <= 0) {
+          badOption ("Invalid integer after -msync option");
+        }
+      }
+
+    /* Scan the -trace option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-trace")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -trace option");
+      } else {
+        argCount++;
+        if (traceFileName == NULL) {
+          traceFileName = *(argv+1);
+        } else {
+          badOption ("Multiple occurences of the -trace option");
+        }
+      }
+
+    /* Scan the -coverage option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-coverage")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -coverage option");
+      } else {
+        argCount++;
+        if (coverageFileName == NULL) {
+          coverageFileName = *(argv+1);
+        } else {
+          badOption ("Multiple occurences of the -coverage option");
+        }
+      }
+
+    /* Scan the -stats option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-stats")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -stats option");
+      } else {
+        argCount++;
+        if (statsFileName == NULL) {
+          statsFileName = *(argv+1);
+        } else {
+          badOption ("Multiple occurences of the -stats option");
+        }
+      }
+
+    /* Scan the -restore option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-restore")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -restore option");
+      } else {
+        argCount++;
+        if (restoreFileName == NULL) {
+          restoreFileName = *(argv+1);
+        } else {
+          badOption ("Multiple occurences of the -restore option");
+        }
+      }
+
+    /* Scan the -r option */
+    } else if (!strcmp (*argv, "-r")) {
+      if (argc <= 1) {
+        badOption ("Expecting integer after -r option");
+      } else {
+        argCount++;
+        randSeedFromOption = atoi (*(argv+1));  /* Extra chars after int ignored */
+        if (randSeedFromOption <= 0) {
+          badOption ("Invalid integer after -r option");
+        }
+        if (commandOptionRand) {
+          badOption ("Multiple occurences of the -r option");
+        } else {
+          commandOptionRand = 1;
+        }
+      }
+
+    /* Scan the -d option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-d")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -d option");
+      } else {
+        argCount++;
+        if (diskFileName == NULL) {
+          diskFileName = *(argv+1);
+        } else {
+          badOption ("Invalid command line - multiple DISK files");
+        }
+      }
+
+    /* Scan the -i option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-i")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -i option");
+      } else {
+        argCount++;
+        if (termInputFileName == NULL) {
+          termInputFileName = *(argv+1);
+        } else {
+          badOption ("Multiple occurences of the -i option");
+        }
+      }
+
+    /* Scan the -o option, which should be followed by a file name */
+    } else if (!strcmp (*argv, "-o")) {
+      if (argc <= 1) {
+        badOption ("Expecting filename after -o option");
+      } else {
+        argCount++;
+        if (termOutputFileName == NULL) {
+          termOutputFileName = *(argv+1);
+        } else {
+          badOption ("Multiple occurences of the -o option");
+        }
+      }
+
+    /* Deal with any invalid options that begin with "-", such as "-qwerty" */
+    } else if ((*argv)[0] == '-') {
+      fprintf (
+        stderr,
+        "BLITZ Emulator Error: Invalid command line option (%s); Use -h for help display\n",
+        *argv);
+      exit (1);
+    /* This token will be interpreted as the a.out file name. */
+    } else {
+      if (executableFileName == NULL) {
+        executableFileName = *argv;
+      } else {
+        badOption ("Invalid command line - multiple input files");
+      }
+
     }
   }
 
@@ -1162,6 +3035,46 @@ void processCommandLine (int argc, char ** argv) {
     badOption ("Options -raw and -i are incompatible");
   }
 
+  /* Check that -msync is only used with -mmap. */
+  if (commandOptionMsync && !commandOptionMmap) {
+    badOption ("The -msync option may only be used with -mmap");
+  }
+
+  /* Check the -sweep, -j, and -limit options. */
+  if (commandOptionJobs && !commandOptionSweep) {
+    badOption ("The -j option may only be used with -sweep");
+  }
+  if (commandOptionLimit && !commandOptionSweep && !commandOptionG) {
+    badOption ("The -limit option may only be used with -g or -sweep");
+  }
+  if (commandOptionSweep) {
+    if (commandOptionRaw || (termOutputFileName != NULL) ||
+        (traceFileName != NULL) || (statsFileName != NULL) ||
+        (coverageFileName != NULL) || commandOptionProf ||
+        commandOptionSample || commandOptionWorkingSet) {
+      badOption ("The -sweep option may not be used with -raw, -o, or options which write files");
+    }
+    if (commandOptionRand &&
+        (randSeedFromOption > MAX - commandOptionSweep)) {
+      badOption ("The -r seed is too large for the number of -sweep runs");
+    }
+    if (commandOptionJobs == 0) {
+      commandOptionJobs = (int) sysconf (_SC_NPROCESSORS_ONLN);
+      if (commandOptionJobs <= 0) {
+        commandOptionJobs = 1;
+      }
+    }
+  }
+
+  /* Check the -cpus option. */
+  if (commandOptionCpus > 1) {
+    if (commandOptionBatch || commandOptionAcct || commandOptionWorkingSet ||
+        (restoreFileName != NULL)) {
+      badOption ("With more than one CPU, the -batch, -acct, -ws, and -restore options may not be used");
+    }
+    numberOfCpus = commandOptionCpus;
+  }
+
   /* Figure out the name of the a.out file. */
   if (executableFileName == NULL) {
     executableFileName = "a.out";
@@ -1213,6 +3126,32 @@ void processCommandLine (int argc, char ** argv) {
       exit (1);
     }
   }
+
+  /* Open the file for the stack samples. */
+  if (commandOptionSample) {
+    sampleFile = fopen (SAMPLE_FILE_NAME, "w");
+    if (sampleFile == NULL) {
+      fprintf (stderr,
+               "BLITZ Emulator Error: Sample file \"%s\" could not be opened for writing\n",
+               SAMPLE_FILE_NAME);
+      exit (1);
+    }
+  }
+
+  /* Open the file for the working set analysis. */
+  if (commandOptionWorkingSet) {
+    workingSetFile = fopen (WORKING_SET_FILE_NAME, "w");
+    if (workingSetFile == NULL) {
+      fprintf (stderr,
+               "BLITZ Emulator Error: Working set file \"%s\" could not be opened for writing\n",
+               WORKING_SET_FILE_NAME);
+      exit (1);
+    }
+    fprintf (workingSetFile, "# BLITZ working set analysis: %d cycles per interval, %d-byte pages\n",
+             commandOptionWorkingSet, PAGE_SIZE);
+    fprintf (workingSetFile, "#\n");
+    fprintf (workingSetFile, "#  Interval start        PTBR  Referenced  Dirtied    New\n");
+  }
 }
 
 
@@ -1243,9 +3182,16 @@ void fatalError (char * msg) {
 
 /* errorExit ()
 **
-** This routine performs any final cleanup and calls exit(1).
+** This routine performs any final cleanup and calls exit(1).  During a
+** library call (see blitz.h), it returns to the call instead.
 */
 void errorExit () {
+  waitForDiskIO ();
+  syncDiskFile ();
+  flushTrace ();
+  if (libraryErrorJump != NULL) {
+    longjmp (* libraryErrorJump, 1);
+  }
   exit (1);
 }
 
@@ -1283,6 +3229,19 @@ void commandLineHelp () {
 "       The input executable file.  If missing, \"a.out\" will be used.\n"
 "    -h\n"
 "       Print this help info.  Ignore other options and exit.\n"
+"    -async\n"
+"       Transfer DISK data on a separate host thread, overlapping the\n"
+"       emulation.  The BLITZ program sees no difference.\n"
+"    -batch\n"
+"       Execute straight-line runs of instructions (basic blocks) without\n"
+"       the per-instruction checks for events and interrupts, whenever\n"
+"       these checks can have no effect.  Each instruction is still\n"
+"       interpreted; only the checks are saved.  The results and timing\n"
+"       are identical.\n"
+"    -coverage filename\n"
+"       Record which instructions of the .text segment are executed.  On\n"
+"       exit, write a per-function summary and a bitmap (one bit per word)\n"
+"       to the given file.\n"
 "    -d filename\n"
 "       Disk file name.  If missing, \"DISK\" will be used.\n"
 "    -g\n"
@@ -1290,10 +3249,59 @@ void commandLineHelp () {
 "       the command line interface.\n"
 "    -i filename\n"
 "       Terminal input file name.  If missing, \"stdin\" will be used.\n"
+"    -mmap\n"
+"       Map the DISK file into memory and transfer sectors by copying,\n"
+"       rather than with file reads and writes.  The file is brought up\n"
+"       to date when the emulator quits.\n"
+"    -msync integer\n"
+"       With -mmap, also bring the DISK file up to date after every\n"
+"       \"integer\" DISK writes.\n"
 "    -o filename\n"
 "       Terminal output file name.  If missing, \"stdout\" will be used.\n"
+"    -prof\n"
+"       Count the instructions executed at each address.  On exit, print\n"
+"       the busiest functions (found using the labels in the a.out file)\n"
+"       and write a full profile, with an annotated listing of the hottest\n"
+"       functions, to the file \"blitz.prof\".\n"
+"    -acct\n"
+"       Charge cycles, page faults and disk requests to address spaces,\n"
+"       according to the value of the PTBR.  On exit, print a table\n"
+"       (see the \"acct\" command).\n"
+"    -cpus integer\n"
+"       Emulate a multiprocessor with this many CPUs (at most 16), which\n"
+"       take turns executing one instruction each.  Only CPU 0 runs at\n"
+"       first; the others are started with the CPU device.\n"
 "    -r integer\n"
 "       Set the random seed to the given integer, which must be > 0.\n"
+"    -sweep integer\n"
+"       Run the program \"integer\" times, as with -g, each with a different\n"
+"       random seed (1, 2, ..., or starting at the -r seed).  Each run sees\n"
+"       its own copy of the DISK file; changes are discarded.  At the end,\n"
+"       print the outcome of each run and the distinct outputs seen.\n"
+"    -j integer\n"
+"       With -sweep, do this many runs at once.  The default is the number\n"
+"       of host processors.\n"
+"    -limit integer\n"
+"       With -g or -sweep, stop execution after this many cycles.\n"
+"    -sample integer\n"
+"       Every \"integer\" cycles, sample the KPL calling stack and append\n"
+"       it, in the folded format used by flame graph tools, to the file\n"
+"       \"blitz.folded\".\n"
+"    -ws integer\n"
+"       Every \"integer\" cycles, record the number of virtual pages of each\n"
+"       address space referenced and dirtied since the last time in the\n"
+"       file \"blitz.ws\".  On exit, add a summary, including reuse\n"
+"       distances, for each address space.\n"
+"    -stats filename\n"
+"       On exit, write the execution statistics (see the \"stats\"\n"
+"       command) to the given file, in JSON format.\n"
+"    -restore filename\n"
+"       After loading the a.out file, restore the machine state from the\n"
+"       given snapshot file (see the \"snapshot\" command).\n"
+"    -trace filename\n"
+"       Record every instruction fetch, load and store made by the BLITZ\n"
+"       program in the given file, in a compact binary format.  Use the\n"
+"       \"dumpTrace\" program to examine it.\n"
 "    -raw\n"
 "       User input for BLITZ terminal I/O will be in \"raw\" mode; the\n"
 "       default is \"cooked\", in which case the running BLITZ code\n"
@@ -1695,12 +3703,17 @@ void commandHelp () {
 "  add     - Add a new label, inserting it into the indexes\n"
 "  reset   - Reset the machine state and re-read the a.out file\n"
 "  io      - Display the state of the I/O devices\n"
+"  stats   - Display the execution statistics in JSON format\n"
+"  acct    - Display the cycles used by each address space (with -acct)\n"
+"  cpus    - Display the state of each CPU (with -cpus)\n"
 "  read    - Read a word from memory-mapped I/O region\n"
 "  write   - Write a word to memory-mapped I/O region\n"
 "  raw     - Switch serial input to raw mode\n"
 "  cooked  - Switch serial input to cooked mode\n"
 "  input   - Enter input characters for future serial I/O input\n"
 "  format  - Create and format a BLITZ disk file\n"
+"  snapshot - Save the entire machine state in a file\n"
+"  restore - Restore the machine state from a snapshot file\n"
 "  sim     - Display the current simulation constants\n"
 "  stack   - Display the KPL calling stack\n"
 "  st        \n"
@@ -1902,14 +3915,20 @@ void commandInfo () {
   printf ("  System Trap Number                = 0x%08X\n", systemTrapNumber);
   printf ("  Page Invalid Offending Address    = 0x%08X\n", pageInvalidOffendingAddress);
   printf ("  Page Readonly Offending Address   = 0x%08X\n", pageReadonlyOffendingAddress);
-  printf ("  Time of next timer event          = %d\n", timeOfNextTimerEvent);
-  printf ("  Time of next disk event           = %d\n", timeOfNextDiskEvent);
-  printf ("  Time of next serial in event      = %d\n", timeOfNextSerialInEvent);
-  printf ("  Time of next serial out event     = %d\n", timeOfNextSerialOutEvent);
-  printf ("    Current Time                    = %d\n", currentTime);
-  printf ("    Time of next event              = %d\n", timeOfNextEvent);
-  printf ("    Time Spent Sleeping             = %d\n", timeSpentAsleep);
-  printf ("      Instructions Executed         = %d\n", currentTime-timeSpentAsleep);
+  printf ("  Time of next timer event          = %lld\n", timerEvent.time);
+  if (oneShotEvent.time != MAX_TIME) {
+    printf ("  Time of next one-shot timer event = %lld\n", oneShotEvent.time);
+  }
+  printf ("  Time of next disk event           = %lld\n", diskEvent.time);
+  printf ("  Time of next serial in event      = %lld\n", serialInEvent.time);
+  printf ("  Time of next serial out event     = %lld\n", serialOutEvent.time);
+  printf ("    Current Time                    = %lld\n", currentTime);
+  printf ("    Time of next event              = %lld\n", timeOfNextEvent);
+  printf ("    Time Spent Sleeping             = %lld\n", timeSpentAsleep);
+  if (costModelEnabled) {
+    printf ("    Time Spent Stalled              = %lld\n", stallCycles);
+  }
+  printf ("      Instructions Executed         = %lld\n", currentTime-timeSpentAsleep-stallCycles);
   printf ("  Number of Disk Reads              = %d\n", numberOfDiskReads);
   printf ("  Number of Disk Writes             = %d\n", numberOfDiskWrites);
   printf ("==============================\n");
@@ -1953,6 +3972,8 @@ void printPendingInterrupts () {
     printf ("    EXCEPTION_DURING_INTERRUPT\n");
   if (interruptsSignaled & SYSCALL_TRAP)
     printf ("    SYSCALL_TRAP\n");
+  if (interruptsSignaled & INTERPROCESSOR_INTERRUPT)
+    printf ("    INTERPROCESSOR_INTERRUPT\n");
 }
 
 
@@ -1974,6 +3995,12 @@ void commandIO () {
   } else {
     printf ("  Input Status:        Character Not Available\n");
   }
+  if (SERIAL_FIFO_DEPTH > 0) {
+    printf ("  Receive FIFO:        %d of %d characters\n",
+            serialReceiveCount, SERIAL_FIFO_DEPTH);
+    printf ("  Transmit FIFO:       %d of %d characters\n",
+            serialTransmitCount, SERIAL_FIFO_DEPTH);
+  }
   printf ("  Current Input Char:  \'");
   fancyPrintChar (termInChar);
   if (termInCharWasUsed) {
@@ -2001,6 +4028,10 @@ void commandIO () {
     printf ("    DISK File is currently closed.\n");
   } else {
     printf ("    DISK File is currently opened.\n");
+    if (diskMapping != NULL) {
+      printf ("    DISK File is memory-mapped (%d writes since last msync).\n",
+              diskWritesSinceSync);
+    }
   }
   printf ("  Disk size:\n");
   printf ("    Total Tracks = %d\n", diskTrackCount);
@@ -2051,6 +4082,19 @@ void commandIO () {
   printf ("    DISK_SECTOR_COUNT_REGISTER   = 0x%08X\n", diskSectorCountRegister);
   printf ("  Number of Disk Reads  = %d\n", numberOfDiskReads);
   printf ("  Number of Disk Writes = %d\n", numberOfDiskWrites);
+  if (dmaRingSize > 0) {
+    printf ("  DMA Disk Controller:\n");
+    printf ("    Request ring     = 0x%08X (head = %d, tail = %d)\n",
+            dmaRequestRing, dmaRequestHead, dmaRequestTail);
+    printf ("    Completion ring  = 0x%08X (head = %d, tail = %d)\n",
+            dmaCompletionRing, dmaCompletionHead, dmaCompletionTail);
+    printf ("    Ring size        = %d\n", dmaRingSize);
+    printf ("    Requests waiting = %d\n", dmaNumberPending);
+    if (dmaActiveValid) {
+      printf ("    Serving the request with tag 0x%08X (sector %d), until time %lld\n",
+              dmaActive.tag, dmaActive.sector, dmaActiveTime);
+    }
+  }
 
   printf ("==============================\n");
   printf ("  CPU status:\n");
@@ -2091,12 +4135,17 @@ void commandIO () {
     printf ("      EXCEPTION_DURING_INTERRUPT\n");
   if (interruptsSignaled & SYSCALL_TRAP)
     printf ("      SYSCALL_TRAP\n");
-  printf ("  Time of next timer event........ %d\n", timeOfNextTimerEvent);
-  printf ("  Time of next disk event......... %d\n", timeOfNextDiskEvent);
-  printf ("  Time of next serial in event.... %d\n", timeOfNextSerialInEvent);
-  printf ("  Time of next serial out event... %d\n", timeOfNextSerialOutEvent);
-  printf ("    Current Time.................. %d\n", currentTime);
-  printf ("    Time of next event............ %d\n", timeOfNextEvent);
+  if (interruptsSignaled & INTERPROCESSOR_INTERRUPT)
+    printf ("      INTERPROCESSOR_INTERRUPT\n");
+  printf ("  Time of next timer event........ %lld\n", timerEvent.time);
+  if (oneShotEvent.time != MAX_TIME) {
+    printf ("  Time of next one-shot event..... %lld\n", oneShotEvent.time);
+  }
+  printf ("  Time of next disk event......... %lld\n", diskEvent.time);
+  printf ("  Time of next serial in event.... %lld\n", serialInEvent.time);
+  printf ("  Time of next serial out event... %lld\n", serialOutEvent.time);
+  printf ("    Current Time.................. %lld\n", currentTime);
+  printf ("    Time of next event............ %lld\n", timeOfNextEvent);
   printf ("==============================\n");
 }
 
@@ -2117,6 +4166,8 @@ void commandSim () {
 
   printf ("  TERM_OUT_DELAY               %11d\n", TERM_OUT_DELAY);
   printf ("  TERM_OUT_DELAY_VARIATION     %11d\n", TERM_OUT_DELAY_VARIATION);
+  printf ("  SERIAL_FIFO_DEPTH            %11d (0=no FIFOs)\n", SERIAL_FIFO_DEPTH);
+  printf ("  SERIAL_FIFO_THRESHOLD        %11d\n", SERIAL_FIFO_THRESHOLD);
 
   printf ("  TIME_SLICE                   %11d (0=no timer interrutps)\n", TIME_SLICE);
   printf ("  TIME_SLICE_VARIATION         %11d\n", TIME_SLICE_VARIATION);
@@ -2149,6 +4200,25 @@ void commandSim () {
   printf ("  DISK_MEMORY_ADDRESS_REGISTER  0x%08X\n", DISK_MEMORY_ADDRESS_REGISTER);
   printf ("  DISK_SECTOR_NUMBER_REGISTER   0x%08X\n", DISK_SECTOR_NUMBER_REGISTER);
   printf ("  DISK_SECTOR_COUNT_REGISTER    0x%08X\n", DISK_SECTOR_COUNT_REGISTER);
+  printf ("  PERF_COUNTER_ADDRESS          0x%08X\n", PERF_COUNTER_ADDRESS);
+  printf ("  CPU_DEVICE_ADDRESS            0x%08X\n", CPU_DEVICE_ADDRESS);
+  printf ("  DMA_CONTROLLER_ADDRESS        0x%08X\n", DMA_CONTROLLER_ADDRESS);
+  printf ("  TIMER_DEVICE_ADDRESS          0x%08X\n", TIMER_DEVICE_ADDRESS);
+
+  printf ("  MUL_CYCLES                   %11d\n", MUL_CYCLES);
+  printf ("  DIV_CYCLES                   %11d\n", DIV_CYCLES);
+  printf ("  FLOAT_CYCLES                 %11d\n", FLOAT_CYCLES);
+  printf ("  FLOAT_DIV_CYCLES             %11d\n", FLOAT_DIV_CYCLES);
+
+  printf ("  CACHE_LINE_SIZE              %11d (a power of 2)\n", CACHE_LINE_SIZE);
+  printf ("  ICACHE_SETS                  %11d (0=no instruction cache)\n", ICACHE_SETS);
+  printf ("  ICACHE_WAYS                  %11d\n", ICACHE_WAYS);
+  printf ("  DCACHE_SETS                  %11d (0=no data cache)\n", DCACHE_SETS);
+  printf ("  DCACHE_WAYS                  %11d\n", DCACHE_WAYS);
+  printf ("  CACHE_MISS_PENALTY           %11d\n", CACHE_MISS_PENALTY);
+
+  printf ("  BRANCH_PREDICTOR_SIZE        %11d (0=no branch prediction)\n", BRANCH_PREDICTOR_SIZE);
+  printf ("  BRANCH_MISPREDICT_PENALTY    %11d\n", BRANCH_MISPREDICT_PENALTY);
 
   printf ("===============================================================================\n");
 
@@ -2196,6 +4266,8 @@ void commandSim () {
 
     fprintf (file, "TERM_OUT_DELAY               %11d\n", TERM_OUT_DELAY);
     fprintf (file, "TERM_OUT_DELAY_VARIATION     %11d\n", TERM_OUT_DELAY_VARIATION);
+    fprintf (file, "SERIAL_FIFO_DEPTH            %11d\n", SERIAL_FIFO_DEPTH);
+    fprintf (file, "SERIAL_FIFO_THRESHOLD        %11d\n", SERIAL_FIFO_THRESHOLD);
 
     fprintf (file, "\n");
     fprintf (file, "TIME_SLICE                   %11d\n", TIME_SLICE);
@@ -2231,6 +4303,30 @@ void commandSim () {
     fprintf (file, "DISK_SECTOR_NUMBER_REGISTER   0x%08X\n", DISK_SECTOR_NUMBER_REGISTER);
     fprintf (file, "DISK_SECTOR_COUNT_REGISTER    0x%08X\n", DISK_SECTOR_COUNT_REGISTER);
 
+    fprintf (file, "\n");
+    fprintf (file, "PERF_COUNTER_ADDRESS          0x%08X\n", PERF_COUNTER_ADDRESS);
+    fprintf (file, "CPU_DEVICE_ADDRESS            0x%08X\n", CPU_DEVICE_ADDRESS);
+    fprintf (file, "DMA_CONTROLLER_ADDRESS        0x%08X\n", DMA_CONTROLLER_ADDRESS);
+    fprintf (file, "TIMER_DEVICE_ADDRESS          0x%08X\n", TIMER_DEVICE_ADDRESS);
+
+    fprintf (file, "\n");
+    fprintf (file, "MUL_CYCLES                   %11d\n", MUL_CYCLES);
+    fprintf (file, "DIV_CYCLES                   %11d\n", DIV_CYCLES);
+    fprintf (file, "FLOAT_CYCLES                 %11d\n", FLOAT_CYCLES);
+    fprintf (file, "FLOAT_DIV_CYCLES             %11d\n", FLOAT_DIV_CYCLES);
+
+    fprintf (file, "\n");
+    fprintf (file, "CACHE_LINE_SIZE              %11d\n", CACHE_LINE_SIZE);
+    fprintf (file, "ICACHE_SETS                  %11d\n", ICACHE_SETS);
+    fprintf (file, "ICACHE_WAYS                  %11d\n", ICACHE_WAYS);
+    fprintf (file, "DCACHE_SETS                  %11d\n", DCACHE_SETS);
+    fprintf (file, "DCACHE_WAYS                  %11d\n", DCACHE_WAYS);
+    fprintf (file, "CACHE_MISS_PENALTY           %11d\n", CACHE_MISS_PENALTY);
+
+    fprintf (file, "\n");
+    fprintf (file, "BRANCH_PREDICTOR_SIZE        %11d\n", BRANCH_PREDICTOR_SIZE);
+    fprintf (file, "BRANCH_MISPREDICT_PENALTY    %11d\n", BRANCH_MISPREDICT_PENALTY);
+
     fclose (file);
   }
 
@@ -2388,6 +4484,7 @@ void commandFormat () {
   printf ("The name of the disk file is \"%s\".\n", diskFileName);
 
   // If open, close it...
+  unmapDiskFile ();
   if (diskFile != NULL) {
     fclose (diskFile);
   }
@@ -2578,86 +4675,2047 @@ void printNumberNL2 (int i) {
 
 
 
-/* printNumberNL (i)
+/* commandSnapshot ()
 **
-** This routine prints a number in the form
-**       0x1234abcd   ( decimal: 395441741     ascii: ".4.."   _my_label )
-** followed by a newline.
+** This command saves the state of the machine in a snapshot file.
 */
-void printNumberNL (int i) {
-  char str [100];
-  char c;
-  TableEntry * tableEntry;
-  int index;
-  if (i == 0) {
-    printf ("0x00000000     ( decimal: 0 )\n");
+void commandSnapshot () {
+  if (numberOfCpus > 1) {
+    printf ("Snapshots may not be used with more than one CPU\n");
     return;
   }
-  printf ("0x");
-  putlong (i);
-  sprintf (str, "%d", i);
-  printf ("     ( decimal: ");
-  printStringInWidth (str, 11);
-  if ((i >= ' ') && (i <= '~')) {
-    printf (" ascii: \'");
-    putchar (i & 0x000000ff);
-    printf ("\'");
-  }
-/****
-  printf (" ascii: \"");
-  c = (i >> 24) & 0x000000ff;
-  if ((c>=' ') && (c <= '~')) {
-    putchar (c);
-  } else {
-    putchar ('.');
-  }
-  c = (i >> 16) & 0x000000ff;
-  if ((c>=' ') && (c <= '~')) {
-    putchar (c);
-  } else {
-    putchar ('.');
-  }
-  c = (i >> 8) & 0x000000ff;
-  if ((c>=' ') && (c <= '~')) {
-    putchar (c);
-  } else {
-    putchar ('.');
+  if (dmaControllerBusy ()) {
+    printf ("Snapshots may not be taken while the DMA disk controller is busy\n");
+    return;
   }
-  c = i & 0x000000ff;
-  if ((c>=' ') && (c <= '~')) {
-    putchar (c);
-  } else {
-    putchar ('.');
+  printf ("Enter the name of the snapshot file to write: ");
+  writeSnapshot (getToken ());
+}
+
+
+
+/* commandRestore ()
+**
+** This command restores the state of the machine from a snapshot file.
+*/
+void commandRestore () {
+  if (numberOfCpus > 1) {
+    printf ("Snapshots may not be used with more than one CPU\n");
+    return;
   }
-  printf ("\"");
-****/
-  index = findLabel (i);
-  if (index != -1) {
-    tableEntry = valueIndex [index];
-    printf ("     %s", tableEntry->string);
+  printf ("Enter the name of the snapshot file to read: ");
+  if (restoreSnapshot (getToken ())) {
+    printAboutToExecute ();
   }
-  printf (" )\n");
 }
 
 
 
-/* commandDumpMemory ()
+/* commandStats ()
 **
-** This routine asks for a starting address and a length.  It then dumps
-** that many bytes of physical memory.
+** This command prints the execution statistics in JSON format.
 */
-void commandDumpMemory () {
-  int addr, len;
-  printf ("Enter the starting (physical) memory address in hex: ");
-  addr = readHexInt ();
-  if (addr < 0 ) {
-    printf ("Address must not be negative.\n");
+void commandStats () {
+  printStats (stdout);
+}
+
+
+
+/* resetStats ()
+**
+** This routine zeroes all of the execution statistics.
+*/
+void resetStats () {
+  memset (instructionMix, 0, sizeof (instructionMix));
+  memset (interruptsTaken, 0, sizeof (interruptsTaken));
+  tlbHits = 0;
+  pageTableWalks = 0;
+  pageInvalidExceptions = 0;
+  pageReadonlyExceptions = 0;
+  serialCharsIn = 0;
+  serialCharsOut = 0;
+  diskSectorsRead = 0;
+  diskSectorsWritten = 0;
+  diskLatencyTotal = 0;
+  instructionCache.hits = 0;
+  instructionCache.misses = 0;
+  dataCache.hits = 0;
+  dataCache.misses = 0;
+  branchesExecuted = 0;
+  branchesMispredicted = 0;
+  instructionsWhileTimed = 0;
+  hostSecondsWhileTimed = 0.0;
+}
+
+
+
+/* printStats (file)
+**
+** This routine prints the execution statistics to the given file, as a
+** single JSON object.  Opcodes that have never been executed are omitted
+** from the instruction mix.
+*/
+void printStats (FILE * file) {
+  int opcode, i, first, diskOperations;
+
+  fprintf (file, "{\n");
+  fprintf (file, "  \"instructionsExecuted\": %lld,\n",
+           currentTime - timeSpentAsleep - stallCycles);
+  fprintf (file, "  \"timeSpentSleeping\": %lld,\n", timeSpentAsleep);
+  fprintf (file, "  \"totalElapsedTime\": %lld,\n", currentTime);
+  fprintf (file, "  \"hostSeconds\": %.6f,\n", hostSecondsWhileTimed);
+  fprintf (file, "  \"hostMIPS\": %.3f,\n",
+           (hostSecondsWhileTimed > 0.0)
+             ? instructionsWhileTimed / hostSecondsWhileTimed / 1000000.0
+             : 0.0);
+
+  // Print the instruction mix...
+  fprintf (file, "  \"instructionMix\": [");
+  first = 1;
+  for (opcode = 0; opcode < 256; opcode++) {
+    if (instructionMix [0] [opcode] || instructionMix [1] [opcode]) {
+      fprintf (file, "%s\n    {\"opcode\": %d, \"name\": \"%s\", "
+                     "\"system\": %lld, \"user\": %lld}",
+               first ? "" : ",", opcode, opcodeNames [opcode],
+               instructionMix [1] [opcode], instructionMix [0] [opcode]);
+      first = 0;
+    }
+  }
+  fprintf (file, "\n  ],\n");
+
+  // Print the interrupts...
+  fprintf (file, "  \"interrupts\": {");
+  for (i = 0; i < NUMBER_OF_INTERRUPT_VECTORS; i++) {
+    fprintf (file, "%s\n    \"%s\": %lld", (i == 0) ? "" : ",",
+             interruptNames [i], interruptsTaken [i]);
+  }
+  fprintf (file, "\n  },\n");
+
+  // Print the paging counts...
+  fprintf (file, "  \"paging\": {\n");
+  fprintf (file, "    \"tlbHits\": %lld,\n", tlbHits);
+  fprintf (file, "    \"pageTableWalks\": %lld,\n", pageTableWalks);
+  fprintf (file, "    \"pageInvalidExceptions\": %lld,\n",
+           pageInvalidExceptions);
+  fprintf (file, "    \"pageReadonlyExceptions\": %lld\n",
+           pageReadonlyExceptions);
+  fprintf (file, "  },\n");
+
+  // Print the serial device counts...
+  fprintf (file, "  \"serial\": {\n");
+  fprintf (file, "    \"charactersIn\": %lld,\n", serialCharsIn);
+  fprintf (file, "    \"charactersOut\": %lld\n", serialCharsOut);
+  fprintf (file, "  },\n");
+
+  // Print the disk counts...
+  diskOperations = numberOfDiskReads + numberOfDiskWrites;
+  fprintf (file, "  \"disk\": {\n");
+  fprintf (file, "    \"reads\": %d,\n", numberOfDiskReads);
+  fprintf (file, "    \"writes\": %d,\n", numberOfDiskWrites);
+  fprintf (file, "    \"sectorsRead\": %lld,\n", diskSectorsRead);
+  fprintf (file, "    \"sectorsWritten\": %lld,\n", diskSectorsWritten);
+  fprintf (file, "    \"averageLatency\": %.1f\n",
+           diskOperations ? (double) diskLatencyTotal / diskOperations : 0.0);
+  fprintf (file, "  },\n");
+
+  // Print the cost model counts...
+  fprintf (file, "  \"costModel\": {\n");
+  fprintf (file, "    \"stallCycles\": %lld,\n", stallCycles);
+  fprintf (file, "    \"instructionCacheHits\": %lld,\n", instructionCache.hits);
+  fprintf (file, "    \"instructionCacheMisses\": %lld,\n", instructionCache.misses);
+  fprintf (file, "    \"dataCacheHits\": %lld,\n", dataCache.hits);
+  fprintf (file, "    \"dataCacheMisses\": %lld,\n", dataCache.misses);
+  fprintf (file, "    \"branchesPredicted\": %lld,\n", branchesExecuted);
+  fprintf (file, "    \"branchesMispredicted\": %lld\n", branchesMispredicted);
+  fprintf (file, "  }\n");
+  fprintf (file, "}\n");
+}
+
+
+
+/* writeStatsFile ()
+**
+** If the "-stats" option was given, this routine writes the execution
+** statistics to the named file.  It is called at exit.
+*/
+void writeStatsFile () {
+  FILE * file;
+  if (statsFileName == NULL) {
     return;
   }
-  if (addr >= MEMORY_SIZE) {
-    printf ("This address is beyond the upper limit of physical memory.\n");
-    printf ("The address of the upper-most byte is ");
-    printNumberNL (MEMORY_SIZE - 1);
+  file = fopen (statsFileName, "w");
+  if (file == NULL) {
+    printf ("Unable to write the statistics to file \"%s\"\n", statsFileName);
+    return;
+  }
+  printStats (file);
+  fclose (file);
+}
+
+
+
+/* openTraceFile ()
+**
+** This routine opens the file named in the "-trace" option, writes the
+** header, and allocates the trace buffer.  It is called once, after the
+** memory has been allocated.
+*/
+void openTraceFile () {
+  int header [4], i;
+  traceFile = fopen (traceFileName, "wb");
+  if (traceFile == NULL) {
+    fprintf (stderr,
+             "BLITZ Emulator Error: Trace file \"%s\" could not be opened for writing\n",
+             traceFileName);
+    exit (1);
+  }
+  traceBuffer = (int *) calloc (TRACE_BUFFER_SIZE, TRACE_RECORD_SIZE);
+  if (traceBuffer == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+  header [0] = TRACE_MAGIC;
+  header [1] = TRACE_RECORD_SIZE;
+  header [2] = PAGE_SIZE;
+  header [3] = MEMORY_SIZE;
+  for (i = 0; i < 4; i++) {
+    header [i] = SWAP_BYTES (header [i]);      // Write out in Big Endian order
+  }
+  fwrite (header, 4, 4, traceFile);
+  traceBufferCount = 0;
+  watchingAccesses = 1;
+}
+
+
+
+/* memoryAccess (virtAddr, physAddr, reading)
+**
+** This routine is called by translate, when "watchingAccesses" is set, for
+** every successful translation which would be followed by a real access.
+** It works out what kind of access it is and records it.  (If a byte
+** access was not completed, traceByteAddr may be left over; it is used only
+** if it lies in the word being accessed.)
+*/
+void memoryAccess (int virtAddr, int physAddr, int reading) {
+  int size;
+  if (fetchingInstruction) {
+    recordAccess (TRACE_FETCH, 4, virtAddr, physAddr);
+    return;
+  }
+  size = 4;
+  if ((traceByteAddr & 0xfffffffc) == virtAddr) {
+    size = 1;
+    virtAddr |= traceByteAddr & 0x00000003;
+    physAddr |= traceByteAddr & 0x00000003;
+  }
+  traceByteAddr = -1;
+  recordAccess (reading ? TRACE_LOAD : TRACE_STORE, size, virtAddr, physAddr);
+}
+
+
+
+/* recordAccess (kind, size, virtAddr, physAddr)
+**
+** This routine passes one fetch, load or store to the trace file, the
+** working set analysis and the cost model's caches, as appropriate.
+*/
+void recordAccess (int kind, int size, int virtAddr, int physAddr) {
+  if (traceFile != NULL) {
+    recordTrace (kind, size, virtAddr, physAddr);
+  }
+  if (commandOptionWorkingSet && statusP) {
+    referencePage (virtAddr, kind == TRACE_STORE);
+  }
+  if (inMemoryMappedArea (physAddr)) {
+    return;
+  }
+  if (kind == TRACE_FETCH) {
+    if (instructionCache.sets > 0) {
+      cacheAccess (& instructionCache, physAddr);
+    }
+  } else if (dataCache.sets > 0) {
+    cacheAccess (& dataCache, physAddr);
+  }
+}
+
+
+
+/* recordTrace (kind, size, virtAddr, physAddr)
+**
+** This routine adds one record to the trace buffer, writing the buffer out
+** if it is full.
+*/
+void recordTrace (int kind, int size, int virtAddr, int physAddr) {
+  int * p;
+  p = traceBuffer + traceBufferCount * 4;
+  p [0] = SWAP_BYTES ((int) (currentTime >> 32));
+  p [1] = SWAP_BYTES ((int) currentTime);
+  p [2] = SWAP_BYTES ((kind << 30) | (statusS << 29) | (statusP << 28) |
+                      (size << 24) | (virtAddr & 0x00ffffff));
+  p [3] = SWAP_BYTES (physAddr);
+  traceBufferCount++;
+  if (traceBufferCount >= TRACE_BUFFER_SIZE) {
+    flushTrace ();
+  }
+}
+
+
+
+/* flushTrace ()
+**
+** This routine writes out any records in the trace buffer.  If there is an
+** error, tracing is stopped.  It is called when the buffer fills and at
+** exit.
+*/
+void flushTrace () {
+  if (traceFile == NULL) {
+    return;
+  }
+  if (traceBufferCount > 0) {
+    if (fwrite (traceBuffer, TRACE_RECORD_SIZE, traceBufferCount, traceFile)
+          != traceBufferCount) {
+      printf ("Error writing the trace file \"%s\"; tracing stopped\n",
+              traceFileName);
+      fclose (traceFile);
+      traceFile = NULL;
+      return;
+    }
+    traceBufferCount = 0;
+  }
+  fflush (traceFile);
+}
+
+
+
+/* resetCostModel ()
+**
+** This routine builds the tables used by the cost model from the simulation
+** constants and empties the caches and the branch predictor.  It is called
+** whenever the machine is reset.
+*/
+void resetCostModel () {
+  int opcode;
+  char * name;
+
+  /* Set the cost of each instruction, by name. */
+  for (opcode = 0; opcode < 256; opcode++) {
+    name = opcodeNames [opcode];
+    opcodeCycles [opcode] = 1;
+    if (!strcmp (name, "mul")) {
+      opcodeCycles [opcode] = MUL_CYCLES;
+    } else if (!strcmp (name, "div") || !strcmp (name, "rem")) {
+      opcodeCycles [opcode] = DIV_CYCLES;
+    } else if (!strcmp (name, "fadd") || !strcmp (name, "fsub") ||
+               !strcmp (name, "fmul") || !strcmp (name, "fcmp") ||
+               !strcmp (name, "itof") || !strcmp (name, "ftoi") ||
+               !strcmp (name, "fneg") || !strcmp (name, "fabs")) {
+      opcodeCycles [opcode] = FLOAT_CYCLES;
+    } else if (!strcmp (name, "fdiv") || !strcmp (name, "fsqrt")) {
+      opcodeCycles [opcode] = FLOAT_DIV_CYCLES;
+    }
+    /* The conditional branches are all the opcodes beginning with "b". */
+    isConditionalBranch [opcode] = (name [0] == 'b');
+  }
+
+  resetCache (& instructionCache, ICACHE_SETS, ICACHE_WAYS);
+  resetCache (& dataCache, DCACHE_SETS, DCACHE_WAYS);
+
+  if (branchCounters != NULL) {
+    free (branchCounters);
+    branchCounters = NULL;
+  }
+  if (BRANCH_PREDICTOR_SIZE > 0) {
+    branchCounters = (unsigned char *) malloc (BRANCH_PREDICTOR_SIZE);
+    if (branchCounters == NULL) {
+      fatalError ("Malloc failed - insufficient memory available");
+    }
+    memset (branchCounters, 1, BRANCH_PREDICTOR_SIZE);   // Weakly not taken
+  }
+
+  costModelEnabled = (MUL_CYCLES > 1) || (DIV_CYCLES > 1) ||
+                     (FLOAT_CYCLES > 1) || (FLOAT_DIV_CYCLES > 1) ||
+                     (instructionCache.sets > 0) || (dataCache.sets > 0) ||
+                     (branchCounters != NULL);
+  if (numberOfCpus > 1) {
+    costModelEnabled = 0;    /* A stall would hold up every CPU */
+  }
+  watchingAccesses = (traceFile != NULL) || commandOptionWorkingSet ||
+                     (instructionCache.sets > 0) || (dataCache.sets > 0);
+  pendingStallCycles = 0;
+}
+
+
+
+/* resetCache (cache, sets, ways)
+**
+** This routine (re-)allocates the given cache with the given geometry and
+** empties it.  With sets=0, the cache is not modeled.
+*/
+void resetCache (Cache * cache, int sets, int ways) {
+  if (cache->lines != NULL) {
+    free (cache->lines);
+    cache->lines = NULL;
+  }
+  cache->sets = sets;
+  cache->ways = ways;
+  if (sets > 0) {
+    cache->lines = (CacheLine *) calloc (sets * ways, sizeof (CacheLine));
+    if (cache->lines == NULL) {
+      fatalError ("Calloc failed - insufficient memory available");
+    }
+  }
+  flushCache (cache);
+}
+
+
+
+/* flushCache (cache)
+**
+** This routine invalidates every line in the given cache.  It is called
+** when the cache is reset and when a snapshot is restored.
+*/
+void flushCache (Cache * cache) {
+  int i;
+  for (i = 0; i < cache->sets * cache->ways; i++) {
+    cache->lines [i].tag = -1;
+    cache->lines [i].lastUsed = 0;
+  }
+  cache->useCount = 0;
+}
+
+
+
+/* cacheAccess (cache, physAddr)
+**
+** This routine looks up the line holding the given physical address in the
+** cache.  On a miss, the least recently used line in the set is replaced and
+** CACHE_MISS_PENALTY cycles are added to the cost of the current instruction.
+*/
+void cacheAccess (Cache * cache, int physAddr) {
+  int tag, way, victim;
+  CacheLine * set;
+
+  tag = physAddr / CACHE_LINE_SIZE;
+  set = cache->lines + (tag % cache->sets) * cache->ways;
+  cache->useCount++;
+  victim = 0;
+  for (way = 0; way < cache->ways; way++) {
+    if (set [way].tag == tag) {
+      set [way].lastUsed = cache->useCount;
+      cache->hits++;
+      return;
+    }
+    if (set [way].lastUsed < set [victim].lastUsed) {
+      victim = way;
+    }
+  }
+  set [victim].tag = tag;
+  set [victim].lastUsed = cache->useCount;
+  cache->misses++;
+  pendingStallCycles += CACHE_MISS_PENALTY;
+}
+
+
+
+/* chargeCycles (opcode, oldPc)
+**
+** This routine is called with the cost model in use, after each instruction
+** is executed.  It is passed the opcode and the address of the instruction.
+** It adds any cycles beyond the usual 1 to "currentTime": the extra cost
+** of the instruction itself, any cache misses, and the penalty for a
+** mispredicted conditional branch.  (A branch is taken if the pc did not
+** simply advance to the next instruction.)
+*/
+void chargeCycles (int opcode, int oldPc) {
+  int cycles, taken, index;
+
+  cycles = opcodeCycles [opcode] - 1 + pendingStallCycles;
+  pendingStallCycles = 0;
+  if (isConditionalBranch [opcode] && (branchCounters != NULL)) {
+    branchesExecuted++;
+    taken = (pc != oldPc + 4);
+    index = ((unsigned int) oldPc / 4) % BRANCH_PREDICTOR_SIZE;
+    if (taken != (branchCounters [index] >= 2)) {
+      branchesMispredicted++;
+      cycles += BRANCH_MISPREDICT_PENALTY;
+    }
+    if (taken && branchCounters [index] < 3) {
+      branchCounters [index]++;
+    } else if (!taken && branchCounters [index] > 0) {
+      branchCounters [index]--;
+    }
+  }
+  currentTime += cycles;
+  stallCycles += cycles;
+  if (!statusS) {
+    userCycles += cycles;
+  }
+}
+
+
+
+/* perfCounterValue (counter) --> long long
+**
+** This routine returns the current (free-running) value of the given
+** performance counter.
+*/
+long long perfCounterValue (int counter) {
+  switch (counter) {
+    case PERF_CYCLES:
+      return currentTime;
+    case PERF_INSTRUCTIONS:
+      return currentTime - timeSpentAsleep - stallCycles;
+    case PERF_USER_CYCLES:
+      return userCycles;
+    case PERF_SYSTEM_CYCLES:
+      return currentTime - timeSpentAsleep - userCycles;
+    case PERF_PAGE_INVALID:
+      return pageInvalidExceptions;
+    case PERF_PAGE_READONLY:
+      return pageReadonlyExceptions;
+  }
+  return 0;
+}
+
+
+
+/* resetPerfCounters ()
+**
+** This routine sets all performance counters to zero and unfreezes them.
+** It is called when the machine is reset.
+*/
+void resetPerfCounters () {
+  int i;
+  perfCountersFrozen = 0;
+  for (i = 0; i < NUMBER_OF_PERF_COUNTERS; i++) {
+    perfCounterBase [i] = perfCounterValue (i);
+    perfCounterFrozen [i] = 0;
+  }
+  perfLatchedCounter = -1;
+  perfLatchedLowWord = 0;
+}
+
+
+
+/* getPerfCounterWord (offset) --> int
+**
+** This routine is called when the BLITZ program reads a word of the
+** performance counter device, at the given offset from PERF_COUNTER_ADDRESS.
+** Reading the high word of a counter latches its low word, which is then
+** returned by the next read of the low word.
+*/
+int getPerfCounterWord (int offset) {
+  int counter;
+  long long value;
+
+  if (offset == 0) {
+    return perfCountersFrozen ? PERF_FREEZE : 0;
+  }
+  counter = (offset - 4) / 8;
+  if (counter == perfLatchedCounter && (offset - 4) % 8 == 4) {
+    perfLatchedCounter = -1;
+    return perfLatchedLowWord;
+  }
+  if (perfCountersFrozen) {
+    value = perfCounterFrozen [counter] - perfCounterBase [counter];
+  } else {
+    value = perfCounterValue (counter) - perfCounterBase [counter];
+  }
+  if ((offset - 4) % 8 == 0) {
+    perfLatchedCounter = counter;
+    perfLatchedLowWord = (int) value;
+    return (int) (value >> 32);
+  }
+  return (int) value;
+}
+
+
+
+/* putPerfCounterWord (offset, value)
+**
+** This routine is called when the BLITZ program writes a word of the
+** performance counter device.  Only the control word may be written.  With
+** PERF_RESET, all counters are set to zero.  PERF_FREEZE stops the counters,
+** and writing the control word without it starts them again.  (Cycles that
+** pass while the counters are frozen are never counted.)
+*/
+void putPerfCounterWord (int offset, int value) {
+  int i;
+  long long now;
+
+  if (offset != 0) {
+    fprintf (stderr, "\n\rERROR: Attempt to write to a performance counter in the memory-mapped area\n\r");
+    suspendExecution ();
+    return;
+  }
+  for (i = 0; i < NUMBER_OF_PERF_COUNTERS; i++) {
+    now = perfCounterValue (i);
+    if (perfCountersFrozen && !(value & PERF_FREEZE)) {
+      perfCounterBase [i] += now - perfCounterFrozen [i];
+    } else if (!perfCountersFrozen && (value & PERF_FREEZE)) {
+      perfCounterFrozen [i] = now;
+    }
+    if (value & PERF_RESET) {
+      perfCounterBase [i] = (value & PERF_FREEZE) ? perfCounterFrozen [i] : now;
+    }
+  }
+  perfCountersFrozen = (value & PERF_FREEZE) ? 1 : 0;
+  perfLatchedCounter = -1;
+}
+
+
+
+/* resetCpus ()
+**
+** This routine is called by resetState.  It makes CPU 0 the current CPU and
+** puts all other CPUs in the stopped state, with all registers zero.
+*/
+void resetCpus () {
+  int c;
+  memset (cpus, 0, sizeof (cpus));
+  for (c = 1; c < numberOfCpus; c++) {
+    cpus [c].state = CPU_STOPPED;
+  }
+  cpus [0].state = CPU_RUNNING;
+  currentCpu = 0;
+  tlb = cpus [0].tlb;
+}
+
+
+
+/* switchToCpu (c)
+**
+** This routine saves the state of the current CPU and makes CPU "c" the
+** current CPU, loading its registers into the global variables.
+*/
+void switchToCpu (int c) {
+  Cpu * cpu;
+  cpu = & cpus [currentCpu];
+  memcpy (cpu->userRegisters, userRegisters, sizeof (userRegisters));
+  memcpy (cpu->systemRegisters, systemRegisters, sizeof (systemRegisters));
+  memcpy (cpu->floatRegisters, floatRegisters, sizeof (floatRegisters));
+  cpu->pc = pc;
+  cpu->ptbr = ptbr;
+  cpu->ptlr = ptlr;
+  cpu->statusN = statusN;
+  cpu->statusV = statusV;
+  cpu->statusZ = statusZ;
+  cpu->statusP = statusP;
+  cpu->statusS = statusS;
+  cpu->statusI = statusI;
+  cpu->interruptsSignaled = interruptsSignaled;
+  cpu->systemTrapNumber = systemTrapNumber;
+  cpu->pageInvalidOffendingAddress = pageInvalidOffendingAddress;
+  cpu->pageReadonlyOffendingAddress = pageReadonlyOffendingAddress;
+
+  cpu = & cpus [c];
+  memcpy (userRegisters, cpu->userRegisters, sizeof (userRegisters));
+  memcpy (systemRegisters, cpu->systemRegisters, sizeof (systemRegisters));
+  memcpy (floatRegisters, cpu->floatRegisters, sizeof (floatRegisters));
+  pc = cpu->pc;
+  ptbr = cpu->ptbr;
+  ptlr = cpu->ptlr;
+  statusN = cpu->statusN;
+  statusV = cpu->statusV;
+  statusZ = cpu->statusZ;
+  statusP = cpu->statusP;
+  statusS = cpu->statusS;
+  statusI = cpu->statusI;
+  interruptsSignaled = cpu->interruptsSignaled;
+  systemTrapNumber = cpu->systemTrapNumber;
+  pageInvalidOffendingAddress = cpu->pageInvalidOffendingAddress;
+  pageReadonlyOffendingAddress = cpu->pageReadonlyOffendingAddress;
+  tlb = cpu->tlb;
+  currentCpu = c;
+}
+
+
+
+/* signalCpu (c, interrupt)
+**
+** This routine signals the given interrupt on CPU "c", which need not be
+** the current CPU.
+*/
+void signalCpu (int c, int interrupt) {
+  if (c == currentCpu) {
+    interruptsSignaled |= interrupt;
+  } else {
+    cpus [c].interruptsSignaled |= interrupt;
+  }
+}
+
+
+
+/* invalidateOtherTLBs (physAddr)
+**
+** This routine is called when a word of memory is stored and there is more
+** than one CPU.  If the word is in the page table of some CPU other than the
+** current one, the corresponding entry in that CPU's TLB is invalidated.
+*/
+void invalidateOtherTLBs (int physAddr) {
+  int c;
+  Cpu * cpu;
+  TLBEntry * tlbEntry;
+  for (c = 0; c < numberOfCpus; c++) {
+    cpu = & cpus [c];
+    if ((c != currentCpu) &&
+        (physAddr >= cpu->ptbr) && (physAddr < cpu->ptbr + cpu->ptlr)) {
+      tlbEntry = & cpu->tlb [((physAddr - cpu->ptbr) >> 2) & (TLB_SIZE - 1)];
+      if (tlbEntry->tableEntryAddr == physAddr) {
+        tlbEntry->valid = 0;
+      }
+    }
+  }
+}
+
+
+
+/* getCpuDeviceWord (offset) --> int
+**
+** This routine returns the word of the CPU device at the given offset from
+** CPU_DEVICE_ADDRESS.
+*/
+int getCpuDeviceWord (int offset) {
+  if (offset == CPU_NUMBER_REGISTER) {
+    return currentCpu;
+  } else if (offset == CPU_COUNT_REGISTER) {
+    return numberOfCpus;
+  } else {
+    return 0;
+  }
+}
+
+
+
+/* putCpuDeviceWord (offset, value)
+**
+** This routine is called when the BLITZ program stores into the CPU device,
+** at the given offset from CPU_DEVICE_ADDRESS.
+*/
+void putCpuDeviceWord (int offset, int value) {
+  Cpu * cpu;
+  if ((offset == CPU_NUMBER_REGISTER) || (offset == CPU_COUNT_REGISTER)) {
+    fprintf (stderr, "\n\rERROR: Attempt to write to a read-only CPU device register\n\r");
+    suspendExecution ();
+  } else if ((value < 0) || (value >= numberOfCpus)) {
+    fprintf (stderr, "\n\rERROR: Invalid CPU number %d written to the CPU device\n\r", value);
+    suspendExecution ();
+
+  /* Send an inter-processor interrupt... */
+  } else if (offset == CPU_IPI_REGISTER) {
+    signalCpu (value, INTERPROCESSOR_INTERRUPT);
+
+  /* Start a stopped CPU at the power-on reset vector... */
+  } else {
+    cpu = & cpus [value];
+    if (cpu->state != CPU_STOPPED) {
+      fprintf (stderr, "\n\rERROR: Attempt to start CPU %d, which has already been started\n\r", value);
+      suspendExecution ();
+      return;
+    }
+    cpu->state = CPU_RUNNING;
+    cpu->statusS = 1;
+    cpu->interruptsSignaled = POWER_ON_RESET;
+  }
+}
+
+
+
+/* commandCpus ()
+**
+** This command prints the state of each CPU.
+*/
+void commandCpus () {
+  int c;
+  Cpu * cpu;
+  static char * stateNames [] = {"running", "waiting", "stopped"};
+  printf ("  CPU  State          pc      Busy Cycles      Idle Cycles\n");
+  for (c = 0; c < numberOfCpus; c++) {
+    cpu = & cpus [c];
+    printf ("  %3d  %-7s  0x%06X  %15lld  %15lld%s\n", c, stateNames [cpu->state],
+            (c == currentCpu) ? pc : cpu->pc, cpu->busyCycles, cpu->idleCycles,
+            (c == currentCpu) ? "  (current)" : "");
+  }
+}
+
+
+
+/* resetAccounting ()
+**
+** This routine empties the address space table used by the "-acct" option.
+** It is called whenever the machine is reset.
+*/
+void resetAccounting () {
+  numberOfAddressSpaces = 0;
+  markAccounting ();
+}
+
+
+
+/* markAccounting ()
+**
+** This routine records the current values of the running counters, so that
+** the next call to chargeAddressSpace charges only what follows.  It is also
+** called after a snapshot is restored.
+*/
+void markAccounting () {
+  acctUserCycles = userCycles;
+  acctSystemCycles = currentTime - timeSpentAsleep - userCycles;
+  acctPageFaults = pageInvalidExceptions + pageReadonlyExceptions;
+  acctDiskRequests = numberOfDiskReads + numberOfDiskWrites;
+}
+
+
+
+/* chargeAddressSpace ()
+**
+** This routine charges everything since the last call to the address space
+** of the current ptbr.  It is called just before the ptbr is changed and
+** before the table is printed.
+*/
+void chargeAddressSpace () {
+  AddressSpace * space;
+  int i;
+  long long systemCycles, pageFaults, diskRequests;
+
+  /* Find the entry for this ptbr, adding one if necessary.  If the table
+     is full, the last entry is used for all the rest. */
+  for (i = 0; i < numberOfAddressSpaces; i++) {
+    if (addressSpaces [i].ptbr == ptbr) {
+      break;
+    }
+  }
+  if (i == MAX_ADDRESS_SPACES) {
+    i = MAX_ADDRESS_SPACES - 1;
+  } else if (i == numberOfAddressSpaces) {
+    if (i == MAX_ADDRESS_SPACES - 1) {
+      addressSpaces [i].ptbr = -1;       // Means "all others"
+    } else {
+      addressSpaces [i].ptbr = ptbr;
+    }
+    addressSpaces [i].userCycles = 0;
+    addressSpaces [i].systemCycles = 0;
+    addressSpaces [i].pageFaults = 0;
+    addressSpaces [i].diskRequests = 0;
+    numberOfAddressSpaces++;
+  }
+  space = & addressSpaces [i];
+
+  systemCycles = currentTime - timeSpentAsleep - userCycles;
+  pageFaults = pageInvalidExceptions + pageReadonlyExceptions;
+  diskRequests = numberOfDiskReads + numberOfDiskWrites;
+  space->userCycles += userCycles - acctUserCycles;
+  space->systemCycles += systemCycles - acctSystemCycles;
+  space->pageFaults += pageFaults - acctPageFaults;
+  space->diskRequests += diskRequests - acctDiskRequests;
+  markAccounting ();
+}
+
+
+
+/* compareAddressSpaces (a, b) --> int
+**
+** This routine is passed to qsort.  It orders the address spaces by
+** decreasing total cycles, and those with equal cycles by ptbr.
+*/
+int compareAddressSpaces (const void * a, const void * b) {
+  const AddressSpace * p = (const AddressSpace *) a;
+  const AddressSpace * q = (const AddressSpace *) b;
+  long long pTotal = p->userCycles + p->systemCycles;
+  long long qTotal = q->userCycles + q->systemCycles;
+  if (pTotal != qTotal) {
+    return (pTotal > qTotal) ? -1 : 1;
+  }
+  return (p->ptbr < q->ptbr) ? -1 : (p->ptbr > q->ptbr);
+}
+
+
+
+/* commandAcct ()
+**
+** This command prints the address space table kept with the "-acct" option.
+*/
+void commandAcct () {
+  if (!commandOptionAcct) {
+    printf ("Address space accounting is only done with the \"-acct\" option.\n");
+    return;
+  }
+  printAccounting ();
+}
+
+
+
+/* printAccounting ()
+**
+** This routine prints the cycles, page faults and disk requests charged to
+** each address space, busiest first.  It is called by the "acct" command and,
+** with the "-acct" option, at exit.
+*/
+void printAccounting () {
+  AddressSpace sorted [MAX_ADDRESS_SPACES];
+  long long total;
+  int i;
+
+  if (!commandOptionAcct) {
+    return;
+  }
+  chargeAddressSpace ();
+  memcpy (sorted, addressSpaces, numberOfAddressSpaces * sizeof (AddressSpace));
+  qsort (sorted, numberOfAddressSpaces, sizeof (AddressSpace),
+         compareAddressSpaces);
+  total = 0;
+  for (i = 0; i < numberOfAddressSpaces; i++) {
+    total += sorted [i].userCycles + sorted [i].systemCycles;
+  }
+
+  printf ("Address space accounting (by PTBR): %lld cycles, not counting sleep\n",
+          total);
+  printf ("        PTBR      User Cycles    System Cycles       %%  Page Faults  Disk Requests\n");
+  for (i = 0; i < numberOfAddressSpaces; i++) {
+    if (sorted [i].ptbr == -1) {
+      printf ("     (other)");
+    } else {
+      printf ("  0x%08X", sorted [i].ptbr);
+    }
+    printf ("  %15lld  %15lld  %5.1f%%  %11lld  %13lld\n",
+            sorted [i].userCycles, sorted [i].systemCycles,
+            total ? 100.0 * (sorted [i].userCycles + sorted [i].systemCycles) / total : 0.0,
+            sorted [i].pageFaults, sorted [i].diskRequests);
+  }
+}
+
+
+
+/* resetWorkingSets ()
+**
+** This routine discards all working set information kept with the "-ws"
+** option and starts the first interval.  It is called whenever the machine
+** is reset.
+*/
+void resetWorkingSets () {
+  int i;
+  if (!commandOptionWorkingSet) {
+    return;
+  }
+  for (i = 0; i < numberOfWorkingSets; i++) {
+    free (workingSets [i].pages);
+    free (workingSets [i].lastInterval);
+  }
+  numberOfWorkingSets = 0;
+  currentWorkingSet = NULL;
+  startWorkingSetInterval ();
+}
+
+
+
+/* startWorkingSetInterval ()
+**
+** This routine sets the end of the current interval, from "currentTime".
+*/
+void startWorkingSetInterval () {
+  workingSetInterval = currentTime / commandOptionWorkingSet + 1;
+  endOfWorkingSetInterval = workingSetInterval * commandOptionWorkingSet;
+}
+
+
+
+/* findWorkingSet () --> WorkingSet *
+**
+** This routine returns the entry for the current ptbr, adding one if
+** necessary.  If the table is full, the last entry is used for all the rest.
+*/
+WorkingSet * findWorkingSet () {
+  WorkingSet * ws;
+  int i;
+  for (i = 0; i < numberOfWorkingSets; i++) {
+    if (workingSets [i].ptbr == ptbr) {
+      return & workingSets [i];
+    }
+  }
+  if (numberOfWorkingSets == MAX_ADDRESS_SPACES) {
+    return & workingSets [MAX_ADDRESS_SPACES - 1];
+  }
+  ws = & workingSets [numberOfWorkingSets++];
+  memset (ws, 0, sizeof (WorkingSet));
+  ws->ptbr = (numberOfWorkingSets == MAX_ADDRESS_SPACES) ? -1 : ptbr;
+  ws->pages = (unsigned char *) calloc (VIRTUAL_PAGES, 1);
+  ws->lastInterval = (long long *) calloc (VIRTUAL_PAGES, sizeof (long long));
+  if (ws->pages == NULL || ws->lastInterval == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+  return ws;
+}
+
+
+
+/* referencePage (virtAddr, writing)
+**
+** This routine is called for every fetch, load and store made with paging
+** turned on.  It sets the page's Referenced bit, and its Dirty bit when
+** writing, in the working set of the current ptbr, just as translate sets
+** them in the page table.  The first reference to a page in each interval
+** adds to the reuse distance histogram.
+*/
+void referencePage (int virtAddr, int writing) {
+  WorkingSet * ws;
+  int page, distance, bucket;
+
+  if (currentTime >= endOfWorkingSetInterval) {
+    endWorkingSetInterval ();
+  }
+  if (currentWorkingSet == NULL || currentWorkingSet->ptbr != ptbr) {
+    currentWorkingSet = findWorkingSet ();
+  }
+  ws = currentWorkingSet;
+  page = (virtAddr & 0x00ffffff) / PAGE_SIZE;
+  if (!(ws->pages [page] & WS_REFERENCED)) {
+    ws->pages [page] |= WS_REFERENCED;
+    ws->referenced++;
+    if (ws->lastInterval [page] == 0) {
+      ws->newPages++;
+    } else {
+      distance = workingSetInterval - ws->lastInterval [page];
+      for (bucket = 0; (distance > 1) && (bucket < REUSE_BUCKETS-1); bucket++) {
+        distance >>= 1;
+      }
+      ws->reuseHistogram [bucket]++;
+    }
+    ws->lastInterval [page] = workingSetInterval;
+  }
+  if (writing && !(ws->pages [page] & WS_DIRTY)) {
+    ws->pages [page] |= WS_DIRTY;
+    ws->dirtied++;
+  }
+}
+
+
+
+/* endWorkingSetInterval ()
+**
+** This routine is called when the current interval is over.  For each
+** address space used in the interval, it writes a line to the working set
+** file, adds to the totals, and clears the Referenced and Dirty bits.
+** Intervals in which nothing was referenced (for example, while the CPU
+** was sleeping) are skipped.
+*/
+void endWorkingSetInterval () {
+  WorkingSet * ws;
+  int i;
+  for (i = 0; i < numberOfWorkingSets; i++) {
+    ws = & workingSets [i];
+    if (ws->referenced == 0) {
+      continue;
+    }
+    fprintf (workingSetFile, "%15lld  ",
+             (workingSetInterval - 1) * commandOptionWorkingSet);
+    if (ws->ptbr == -1) {
+      fprintf (workingSetFile, "   (other)");
+    } else {
+      fprintf (workingSetFile, "0x%08X", ws->ptbr);
+    }
+    fprintf (workingSetFile, "  %10d  %7d  %5d\n",
+             ws->referenced, ws->dirtied, ws->newPages);
+    ws->intervals++;
+    ws->totalReferenced += ws->referenced;
+    ws->totalDirtied += ws->dirtied;
+    if (ws->referenced > ws->maxReferenced) {
+      ws->maxReferenced = ws->referenced;
+    }
+    ws->referenced = 0;
+    ws->dirtied = 0;
+    ws->newPages = 0;
+    memset (ws->pages, 0, VIRTUAL_PAGES);
+  }
+  startWorkingSetInterval ();
+}
+
+
+
+/* writeWorkingSetSummary ()
+**
+** With the "-ws" option, this routine ends the last interval and then adds a
+** summary for each address space to the working set file.  It is called at
+** exit.
+*/
+void writeWorkingSetSummary () {
+  WorkingSet * ws;
+  int i, bucket, low;
+  if (!commandOptionWorkingSet || workingSetFile == NULL) {
+    return;
+  }
+  endWorkingSetInterval ();
+  for (i = 0; i < numberOfWorkingSets; i++) {
+    ws = & workingSets [i];
+    fprintf (workingSetFile, "#\n");
+    if (ws->ptbr == -1) {
+      fprintf (workingSetFile, "# Summary for all other address spaces\n");
+    } else {
+      fprintf (workingSetFile, "# Summary for PTBR = 0x%08X\n", ws->ptbr);
+    }
+    fprintf (workingSetFile, "#   Intervals used:           %lld\n", ws->intervals);
+    fprintf (workingSetFile, "#   Average working set:      %.1f pages\n",
+             ws->intervals ? (double) ws->totalReferenced / ws->intervals : 0.0);
+    fprintf (workingSetFile, "#   Largest working set:      %d pages\n",
+             ws->maxReferenced);
+    fprintf (workingSetFile, "#   Pages dirtied:            %lld (%.1f per interval)\n",
+             ws->totalDirtied,
+             ws->intervals ? (double) ws->totalDirtied / ws->intervals : 0.0);
+    fprintf (workingSetFile, "#   Reuse distance (intervals)     Count\n");
+    for (bucket = 0; bucket < REUSE_BUCKETS; bucket++) {
+      if (ws->reuseHistogram [bucket] == 0) {
+        continue;
+      }
+      low = 1 << bucket;
+      if (bucket == REUSE_BUCKETS-1) {
+        fprintf (workingSetFile, "#     %7d or more      ", low);
+      } else if (low == 1) {
+        fprintf (workingSetFile, "#     %7d              ", low);
+      } else {
+        fprintf (workingSetFile, "#     %7d .. %-7d   ", low, 2 * low - 1);
+      }
+      fprintf (workingSetFile, "%12lld\n", ws->reuseHistogram [bucket]);
+    }
+  }
+  fclose (workingSetFile);
+  workingSetFile = NULL;
+  printf ("Working set analysis written to file \"%s\"\n", WORKING_SET_FILE_NAME);
+}
+
+
+
+/* runSweep ()
+**
+** This routine is called from main when the "-sweep" option was given,
+** before anything else is done.  It runs each execution in a child process,
+** starting a new one whenever fewer than "-j" are running.  In each child,
+** it sets up the run and then returns, so that main goes on to emulate the
+** program just as with "-g".  In the parent, it waits for all of the runs,
+** prints the report, and exits; it never returns.
+*/
+void runSweep () {
+#if defined(_WIN32) || defined(_WIN64)
+  badOption ("The -sweep option is not supported on this system");
+#else
+  int next, running, finished, i, status;
+  pid_t pid;
+
+  sweepRuns = (SweepRun *) mmap (NULL, commandOptionSweep * sizeof (SweepRun),
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (sweepRuns == MAP_FAILED) {
+    perror ("Error allocating the sweep results");
+    exit (1);
+  }
+  memset (sweepRuns, 0, commandOptionSweep * sizeof (SweepRun));
+  for (i = 0; i < commandOptionSweep; i++) {
+    sweepRuns [i].seed = (commandOptionRand ? randSeedFromOption : 1) + i;
+  }
+  printf ("Running %d executions of \"%s\", %d at a time...\n",
+          commandOptionSweep, executableFileName, commandOptionJobs);
+
+  next = 0;
+  running = 0;
+  finished = 0;
+  while (finished < commandOptionSweep) {
+
+    // Start as many runs as are allowed...
+    while ((running < commandOptionJobs) && (next < commandOptionSweep)) {
+      fflush (stdout);
+      fflush (stderr);
+      pid = fork ();
+      if (pid < 0) {
+        perror ("Error during fork");
+        if (running == 0) {
+          exit (1);
+        }
+        break;
+      }
+      if (pid == 0) {
+        startSweepRun (& sweepRuns [next]);
+        return;
+      }
+      sweepRuns [next].pid = pid;
+      running++;
+      next++;
+    }
+
+    // Wait for one to finish...
+    pid = wait (& status);
+    if (pid < 0) {
+      perror ("Error during wait");
+      exit (1);
+    }
+    for (i = 0; i < next; i++) {
+      if (sweepRuns [i].pid == pid) {
+        if (sweepRuns [i].result == SWEEP_NOT_FINISHED) {
+          if (WIFSIGNALED (status)) {
+            sweepRuns [i].result = SWEEP_KILLED;
+            sweepRuns [i].exitStatus = WTERMSIG (status);
+          } else {
+            sweepRuns [i].result = SWEEP_FAILED;
+            sweepRuns [i].exitStatus = WEXITSTATUS (status);
+          }
+        }
+        running--;
+        finished++;
+        break;
+      }
+    }
+  }
+
+  printSweepReport ();
+  exit (0);
+#endif
+}
+
+
+
+/* startSweepRun (run)
+**
+** This routine is called in each child process created by runSweep.  It
+** arranges for the run to use the given seed and a private copy-on-write
+** view of the DISK file.  The a.out and input files are opened again, since
+** a file position shared with the other runs would be disturbed by them.
+** Both stdout and stderr are sent to a temporary file.
+*/
+void startSweepRun (SweepRun * run) {
+  sweepRun = run;
+  commandOptionRand = 1;
+  randSeedFromOption = run->seed;
+  commandOptionG = 1;
+  diskCopyOnWrite = 1;
+  signal (SIGINT, SIG_DFL);
+
+  fclose (executableFile);
+  executableFile = fopen (executableFileName, "rb");
+  if (termInputFile != stdin) {
+    fclose (termInputFile);
+  }
+  termInputFile = fopen ((termInputFileName != NULL) ? termInputFileName
+                                                     : "/dev/null", "rb");
+  sweepOutputFile = tmpfile ();
+  if ((executableFile == NULL) || (termInputFile == NULL) ||
+      (sweepOutputFile == NULL) ||
+      (dup2 (fileno (sweepOutputFile), fileno (stdout)) < 0) ||
+      (dup2 (fileno (sweepOutputFile), fileno (stderr)) < 0)) {
+    exit (1);
+  }
+}
+
+
+
+/* finishSweepRun ()
+**
+** This routine is called in a child process when the run is over.  It
+** records the outcome for the report, and hashes the output.  The final
+** "Done!" message from commandGo, which shows where execution stopped, is
+** left out of the hash.
+*/
+void finishSweepRun () {
+  char * output, * p;
+  long length, i;
+
+  fflush (stdout);
+  fflush (stderr);
+  fseek (sweepOutputFile, 0l, SEEK_END);
+  length = ftell (sweepOutputFile);
+  output = (char *) malloc (length + 1);
+  if (output == NULL) {
+    exit (1);
+  }
+  fseek (sweepOutputFile, 0l, SEEK_SET);
+  length = fread (output, 1, length, sweepOutputFile);
+  output [length] = '\0';
+  for (p = output + length; p > output; p--) {
+    if (!strncmp (p, "Done!  ", 7)) {
+      length = p - output;
+      break;
+    }
+  }
+  sweepRun->outputHash = SWEEP_HASH_BASIS;
+  for (i = 0; i < length; i++) {
+    sweepRun->outputHash = (sweepRun->outputHash ^ (unsigned char) output [i])
+                           * SWEEP_HASH_PRIME;
+  }
+  sweepRun->outputBytes = length;
+  free (output);
+
+  if (executionHalted) {
+    sweepRun->result = SWEEP_HALTED;
+  } else if (commandOptionLimit && (currentTime >= commandOptionLimit)) {
+    sweepRun->result = SWEEP_LIMIT;
+  } else {
+    sweepRun->result = SWEEP_STOPPED;
+  }
+  sweepRun->pc = pc;
+  sweepRun->instructions = currentTime - timeSpentAsleep - stallCycles;
+  sweepRun->elapsedTime = currentTime;
+  sweepRun->diskReads = numberOfDiskReads;
+  sweepRun->diskWrites = numberOfDiskWrites;
+}
+
+
+
+/* printSweepReport ()
+**
+** This routine prints one line for each run of a sweep, followed by the
+** distinct serial outputs seen and the number of runs producing each.
+*/
+void printSweepReport () {
+  int i, j, count, distinct;
+  int results [SWEEP_KILLED + 1];
+  SweepRun * run;
+  static char * resultNames [] = {"unfinished", "halted", "stopped",
+                                  "limit", "failed", "killed"};
+
+  memset (results, 0, sizeof (results));
+  printf ("\n");
+  printf ("   Run        Seed  Result       Instructions  Elapsed Time  Disk R/W"
+          "     Output  Hash\n");
+  for (i = 0; i < commandOptionSweep; i++) {
+    run = & sweepRuns [i];
+    results [run->result]++;
+    if ((run->result == SWEEP_FAILED) || (run->result == SWEEP_KILLED)) {
+      printf ("%6d  %10d  %-8s (%s %d)\n", i + 1, run->seed,
+              resultNames [run->result],
+              (run->result == SWEEP_KILLED) ? "signal" : "exit status",
+              run->exitStatus);
+      continue;
+    }
+    printf ("%6d  %10d  %-8s %16lld  %12lld  %4d/%-4d %8lld  %016llx",
+            i + 1, run->seed, resultNames [run->result], run->instructions,
+            run->elapsedTime, run->diskReads, run->diskWrites,
+            run->outputBytes, run->outputHash);
+    if (run->result == SWEEP_STOPPED) {
+      printf ("  pc=0x%06X", run->pc);
+    }
+    printf ("\n");
+  }
+
+  // Print each distinct output once, with the runs that produced it...
+  printf ("\n");
+  distinct = 0;
+  for (i = 0; i < commandOptionSweep; i++) {
+    if ((sweepRuns [i].result == SWEEP_FAILED) ||
+        (sweepRuns [i].result == SWEEP_KILLED)) {
+      continue;
+    }
+    for (j = 0; j < i; j++) {
+      if ((sweepRuns [j].result != SWEEP_FAILED) &&
+          (sweepRuns [j].result != SWEEP_KILLED) &&
+          (sweepRuns [j].outputHash == sweepRuns [i].outputHash)) {
+        break;
+      }
+    }
+    if (j < i) {
+      continue;
+    }
+    count = 0;
+    for (j = i; j < commandOptionSweep; j++) {
+      if ((sweepRuns [j].result != SWEEP_FAILED) &&
+          (sweepRuns [j].result != SWEEP_KILLED) &&
+          (sweepRuns [j].outputHash == sweepRuns [i].outputHash)) {
+        count++;
+      }
+    }
+    printf ("Output %016llx: %d run%s, first with seed %d\n",
+            sweepRuns [i].outputHash, count, (count == 1) ? "" : "s",
+            sweepRuns [i].seed);
+    distinct++;
+  }
+
+  printf ("%d distinct output%s; %d halted, %d stopped, %d limit, %d failed, %d killed\n",
+          distinct, (distinct == 1) ? "" : "s", results [SWEEP_HALTED],
+          results [SWEEP_STOPPED], results [SWEEP_LIMIT],
+          results [SWEEP_FAILED], results [SWEEP_KILLED]);
+  printf ("Use \"-r seed\" to repeat any run.\n");
+}
+
+
+
+/* getSerialFifoStatus () --> int
+**
+** This routine returns the SERIAL_STATUS_WORD in FIFO mode.
+*/
+int getSerialFifoStatus () {
+  int x;
+  x = (serialReceiveCount << 8) |
+      ((SERIAL_FIFO_DEPTH - serialTransmitCount) << 16);
+  if (serialReceiveCount > 0) {
+    x = x | 0x00000001;
+  }
+  if (serialTransmitCount < SERIAL_FIFO_DEPTH) {
+    x = x | 0x00000002;
+  }
+  return x;
+}
+
+
+
+/* readReceiveFifo () --> int
+**
+** This routine is called when the BLITZ program reads the SERIAL_DATA_WORD
+** in FIFO mode.  It removes and returns the first character in the receive
+** FIFO, or returns zero if it is empty.
+*/
+int readReceiveFifo () {
+  int ch;
+  if (serialReceiveCount == 0) {
+    return 0;
+  }
+  ch = serialReceiveFifo [serialReceiveOut];
+  serialReceiveOut = (serialReceiveOut + 1) % SERIAL_FIFO_MAX;
+  serialReceiveCount--;
+  serialCharsIn++;
+  termInChar = ch;
+  termInCharAvail = (serialReceiveCount > 0);
+  return ch;
+}
+
+
+
+/* fillReceiveFifo (waitForKeystroke)
+**
+** This routine does the work of doSerialInEvent in FIFO mode.  It moves
+** characters from the input into the receive FIFO until no more are
+** available or the FIFO is full, waiting for the first one only if
+** "waitForKeystroke" is true.  It signals an interrupt if the FIFO has
+** reached the threshold, or if it holds characters and no more input has
+** arrived.
+*/
+void fillReceiveFifo (int waitForKeystroke) {
+  int ch, added;
+  added = 0;
+  while (serialReceiveCount < SERIAL_FIFO_DEPTH) {
+    ch = checkForInput (waitForKeystroke && (added == 0));
+    if (ch == 0) {
+      break;
+    }
+    serialReceiveFifo [(serialReceiveOut + serialReceiveCount) % SERIAL_FIFO_MAX] = ch;
+    serialReceiveCount++;
+    added++;
+  }
+  termInCharAvail = (serialReceiveCount > 0);
+  if ((serialReceiveCount >= SERIAL_FIFO_THRESHOLD) ||
+      ((serialReceiveCount > 0) &&
+       ((added == 0) || (serialInEvent.time == MAX_TIME)))) {
+    signalCpu (0, SERIAL_INTERRUPT);
+  }
+}
+
+
+
+/* writeTransmitFifo ()
+**
+** This routine is called when the BLITZ program stores a character into the
+** SERIAL_DATA_WORD in FIFO mode, after the character has been written to the
+** output file.  It adds the character to the transmit FIFO and, if the FIFO
+** was empty, starts sending it.
+*/
+void writeTransmitFifo () {
+  long long time;
+  serialTransmitCount++;
+  termOutputReady = (serialTransmitCount < SERIAL_FIFO_DEPTH);
+  if (serialTransmitCount == 1) {
+    time = currentTime +
+           randomBetween (TERM_OUT_DELAY,
+                          TERM_OUT_DELAY + TERM_OUT_DELAY_VARIATION);
+    if (time <= currentTime) {
+      time = currentTime + 1;
+    }
+    scheduleEvent (& serialOutEvent, time);
+  }
+}
+
+
+
+/* doTransmitFifoEvent ()
+**
+** This routine does the work of doSerialOutEvent in FIFO mode.  The first
+** character in the transmit FIFO has been sent.  If there are more, start
+** sending the next one; otherwise signal an interrupt.
+*/
+void doTransmitFifoEvent () {
+  long long time;
+  if (serialTransmitCount > 0) {
+    serialTransmitCount--;
+  }
+  termOutputReady = 1;
+  if (serialTransmitCount > 0) {
+    time = currentTime +
+           randomBetween (TERM_OUT_DELAY,
+                          TERM_OUT_DELAY + TERM_OUT_DELAY_VARIATION);
+    if (time <= currentTime) {
+      time = currentTime + 1;
+    }
+    scheduleEvent (& serialOutEvent, time);
+  } else {
+    scheduleEvent (& serialOutEvent, MAX_TIME);
+    signalCpu (0, SERIAL_INTERRUPT);
+  }
+}
+
+
+
+/* resetCoverage ()
+**
+** If the "-coverage" option was given, this routine allocates an empty
+** coverage bitmap for the .text segment.  It is called after the a.out file
+** has been loaded.
+*/
+void resetCoverage () {
+  if (coverageFileName == NULL) {
+    return;
+  }
+  if (coverageBitmap != NULL) {
+    free (coverageBitmap);
+  }
+  coverageBitmap = (unsigned char *) calloc (textSize / 32 + 1, 1);
+  if (coverageBitmap == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+}
+
+
+
+/* recordCoverage (physAddr, d)
+**
+** This routine is called with the "-coverage" option when the decoded
+** instruction "d", fetched from the given physical address, is about to be
+** executed for the first time.  It sets the word's bit in the bitmap, if
+** the address is in the .text segment, and marks "d" as covered.
+*/
+void recordCoverage (int physAddr, DecodedInstruction * d) {
+  int word;
+  if ((physAddr >= textAddr) && (physAddr < textAddr + textSize)) {
+    word = (physAddr - textAddr) / 4;
+    coverageBitmap [word / 8] |= 0x80 >> (word % 8);
+  }
+  d->covered = 1;
+}
+
+
+
+/* writeCoverageFile ()
+**
+** If the "-coverage" option was given, this routine writes the coverage
+** summary and bitmap to the named file.  It is called at exit.
+*/
+void writeCoverageFile () {
+  FILE * file;
+  ProfileEntry * entries;
+  int numberOfEntries, i, addr, word, words, bytes, covered, totalCovered;
+
+  if (coverageBitmap == NULL) {
+    return;
+  }
+  file = fopen (coverageFileName, "w");
+  if (file == NULL) {
+    printf ("Unable to write the coverage to file \"%s\"\n", coverageFileName);
+    return;
+  }
+
+  // Count the covered words in each function...
+  entries = (ProfileEntry *) calloc (numberOfLabels + 1, sizeof (ProfileEntry));
+  if (entries == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+  numberOfEntries = findFunctions (entries);
+  for (i = 0; i < numberOfEntries; i++) {
+    for (addr = entries [i].low; addr < entries [i].high; addr += 4) {
+      word = (addr - textAddr) / 4;
+      if (coverageBitmap [word / 8] & (0x80 >> (word % 8))) {
+        entries [i].count++;
+      }
+    }
+  }
+
+  // Count the covered words in the whole .text segment...
+  words = textSize / 4;
+  totalCovered = 0;
+  for (word = 0; word < words; word++) {
+    if (coverageBitmap [word / 8] & (0x80 >> (word % 8))) {
+      totalCovered++;
+    }
+  }
+
+  // Print the summary...
+  fprintf (file, "# BLITZ coverage of \"%s\"\n", executableFileName);
+  fprintf (file, "# .text segment: 0x%06X .. 0x%06X\n",
+           textAddr, textAddr + textSize - 1);
+  fprintf (file, "# Words executed: %d of %d (%.1f%%)\n", totalCovered, words,
+           words ? 100.0 * totalCovered / words : 0.0);
+  fprintf (file, "#\n");
+  fprintf (file, "# Address   Executed     Words       %%  Function\n");
+  for (i = 0; i < numberOfEntries; i++) {
+    words = (entries [i].high - entries [i].low) / 4;
+    covered = entries [i].count;
+    fprintf (file, "  0x%06X  %8d  %8d  %5.1f%%  %s\n", entries [i].low,
+             covered, words, words ? 100.0 * covered / words : 0.0,
+             entries [i].name);
+  }
+
+  // Print the bitmap, 32 bytes (256 words) per line...
+  fprintf (file, "#\n");
+  fprintf (file, "# Bitmap: one bit per word, most significant bit first\n");
+  bytes = (textSize / 4 + 7) / 8;
+  for (i = 0; i < bytes; i++) {
+    if (i % 32 == 0) {
+      fprintf (file, "%s0x%06X ", (i == 0) ? "" : "\n", textAddr + i * 32);
+    }
+    fprintf (file, "%02X", coverageBitmap [i]);
+  }
+  fprintf (file, "\n");
+
+  fclose (file);
+  free (entries);
+}
+
+
+
+/* writeSnapshot (fileName)  --> bool
+**
+** This routine saves the state of the machine in the named file.  It returns
+** TRUE if all went well; otherwise it prints a message and returns FALSE.
+*/
+int writeSnapshot (char * fileName) {
+  int frame, i, numberOfPages, magic, version, memorySize, pageSize;
+  long len;
+  int * frames;
+  char * p;
+
+  snapshotFile = fopen (fileName, "wb");
+  if (snapshotFile == NULL) {
+    printf ("The snapshot file \"%s\" could not be opened for writing.\n", fileName);
+    return 0;
+  }
+
+  /* Make a list of the frames that are not entirely zero. */
+  frames = (int *) calloc (numberOfFrames, sizeof (int));
+  if (frames == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+  numberOfPages = 0;
+  for (frame = 0; frame < numberOfFrames; frame++) {
+    p = memory + frame * PAGE_SIZE;
+    for (i = 0; i < PAGE_SIZE; i++) {
+      if (p [i] != 0) {
+        frames [numberOfPages++] = frame;
+        break;
+      }
+    }
+  }
+
+  /* Write the header, the machine state, and the list of frames. */
+  snapshotReading = 0;
+  snapshotFailed = 0;
+  magic = SNAPSHOT_MAGIC;
+  version = SNAPSHOT_VERSION;
+  memorySize = MEMORY_SIZE;
+  pageSize = PAGE_SIZE;
+  snapshotInt (& magic);
+  snapshotInt (& version);
+  snapshotInt (& memorySize);
+  snapshotInt (& pageSize);
+  snapshotMachineState ();
+  snapshotInt (& numberOfPages);
+  for (i = 0; i < numberOfPages; i++) {
+    snapshotInt (& frames [i]);
+  }
+
+  /* Pad out to a page boundary, then write the frames themselves. */
+  len = ftell (snapshotFile);
+  while (len % PAGE_SIZE != 0) {
+    fputc (0, snapshotFile);
+    len++;
+  }
+  for (i = 0; i < numberOfPages; i++) {
+    frame = frames [i];
+    swapMemoryWords (frame * PAGE_SIZE, (frame + 1) * PAGE_SIZE);
+    if (fwrite (memory + frame * PAGE_SIZE, PAGE_SIZE, 1, snapshotFile) != 1) {
+      snapshotFailed = 1;
+    }
+    swapMemoryWords (frame * PAGE_SIZE, (frame + 1) * PAGE_SIZE);
+  }
+  free (frames);
+
+  if (fclose (snapshotFile) || snapshotFailed) {
+    printf ("Problems writing the snapshot file \"%s\".\n", fileName);
+    return 0;
+  }
+  printf ("The machine state has been saved in \"%s\" (%d non-zero pages).\n",
+          fileName, numberOfPages);
+  return 1;
+}
+
+
+
+/* restoreSnapshot (fileName)  --> bool
+**
+** This routine restores the state of the machine from the named file, which
+** must have been written by writeSnapshot with the same MEMORY_SIZE and
+** PAGE_SIZE.  It returns TRUE if all went well.  Otherwise it prints a
+** message and returns FALSE; if the file was found to be damaged after the
+** machine state had been altered, the machine is reset first.
+*/
+int restoreSnapshot (char * fileName) {
+  int frame, i, numberOfPages, magic, version, memorySize, pageSize;
+  int * frames;
+
+  snapshotFile = fopen (fileName, "rb");
+  if (snapshotFile == NULL) {
+    printf ("The snapshot file \"%s\" could not be opened for reading.\n", fileName);
+    return 0;
+  }
+
+  /* Check the header. */
+  snapshotReading = 1;
+  snapshotFailed = 0;
+  snapshotInt (& magic);
+  snapshotInt (& version);
+  snapshotInt (& memorySize);
+  snapshotInt (& pageSize);
+  if (snapshotFailed || magic != SNAPSHOT_MAGIC) {
+    printf ("The file \"%s\" is not a BLITZ snapshot file.\n", fileName);
+    fclose (snapshotFile);
+    return 0;
+  }
+  if (version != SNAPSHOT_VERSION) {
+    printf ("The snapshot file \"%s\" is in an unsupported format (version word\n"
+            "0x%08X; this emulator restores only version %d).  It was written by\n"
+            "another version of the emulator; please take the snapshot again.\n",
+            fileName, version, SNAPSHOT_VERSION);
+    fclose (snapshotFile);
+    return 0;
+  }
+  if (memorySize != MEMORY_SIZE || pageSize != PAGE_SIZE) {
+    printf ("The snapshot was taken with MEMORY_SIZE = 0x%08X and PAGE_SIZE = 0x%08X;\n"
+            "these do not match the current simulation constants.\n",
+            memorySize, pageSize);
+    fclose (snapshotFile);
+    return 0;
+  }
+
+  /* Restore the machine state and read the list of frames. */
+  snapshotMachineState ();
+  snapshotInt (& numberOfPages);
+  frames = NULL;
+  if (!snapshotFailed && numberOfPages >= 0 && numberOfPages <= numberOfFrames) {
+    frames = (int *) calloc (numberOfPages + 1, sizeof (int));
+    if (frames == NULL) {
+      fatalError ("Calloc failed - insufficient memory available");
+    }
+    for (i = 0; i < numberOfPages; i++) {
+      snapshotInt (& frames [i]);
+      if (frames [i] < 0 || frames [i] >= numberOfFrames) {
+        snapshotFailed = 1;
+      }
+    }
+  } else {
+    snapshotFailed = 1;
+  }
+
+  /* Clear memory and read in the non-zero frames, which begin at the
+     first page boundary. */
+  if (!snapshotFailed) {
+    memset (memory, 0, MEMORY_SIZE);
+    if (fseek (snapshotFile, ((ftell (snapshotFile) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE, SEEK_SET)) {
+      snapshotFailed = 1;
+    }
+    for (i = 0; i < numberOfPages && !snapshotFailed; i++) {
+      frame = frames [i];
+      if (fread (memory + frame * PAGE_SIZE, PAGE_SIZE, 1, snapshotFile) != 1) {
+        snapshotFailed = 1;
+      }
+      swapMemoryWords (frame * PAGE_SIZE, (frame + 1) * PAGE_SIZE);
+    }
+  }
+  if (frames != NULL) {
+    free (frames);
+  }
+  fclose (snapshotFile);
+
+  if (snapshotFailed) {
+    printf ("The snapshot file \"%s\" is damaged; the machine will be reset.\n", fileName);
+    resetState ();
+    return 0;
+  }
+
+  /* Discard everything that was derived from the old memory contents. */
+  currentMemoryLock = -1;
+  resetDecodedInstructions ();
+  resetFrameFlags ();
+  flushTLB ();
+  flushCache (& instructionCache);
+  flushCache (& dataCache);
+  markAccounting ();
+  if (commandOptionWorkingSet) {
+    startWorkingSetInterval ();
+  }
+  typeAheadBufferCount = 0;
+  typeAheadBufferIn = 0;
+  typeAheadBufferOut = 0;
+  executionHalted = 0;
+  printf ("The machine state has been restored from \"%s\" (%d non-zero pages).\n",
+          fileName, numberOfPages);
+  return 1;
+}
+
+
+
+/* snapshotMachineState ()
+**
+** This routine saves or restores (according to "snapshotReading") all of the
+** machine state other than memory: the registers, the status bits, pending
+** interrupts, the clock and the event queue, the random seed, and the state
+** of the disk and serial devices.  Any value added here must be added in
+** the same place for both saving and restoring, so there is just this one
+** routine.
+*/
+void snapshotMachineState () {
+  int i, ch;
+  long long times [5];
+
+  for (i=0; i<=15; i++) {
+    snapshotInt (& userRegisters [i]);
+  }
+  for (i=0; i<=15; i++) {
+    snapshotInt (& systemRegisters [i]);
+  }
+  for (i=0; i<=15; i++) {
+    snapshotDouble (& floatRegisters [i]);
+  }
+  snapshotInt (& pc);
+  snapshotInt (& ptbr);
+  snapshotInt (& ptlr);
+  snapshotInt (& statusN);
+  snapshotInt (& statusV);
+  snapshotInt (& statusZ);
+  snapshotInt (& statusP);
+  snapshotInt (& statusS);
+  snapshotInt (& statusI);
+  snapshotInt (& interruptsSignaled);
+  snapshotInt (& systemTrapNumber);
+  snapshotInt (& pageInvalidOffendingAddress);
+  snapshotInt (& pageReadonlyOffendingAddress);
+  snapshotInt (& randomSeed);
+
+  /* The clock and the events.  When restoring, the event queue is rebuilt. */
+  snapshotTime (& currentTime);
+  snapshotTime (& timeSpentAsleep);
+  snapshotTime (& stallCycles);
+  times [0] = timerEvent.time;
+  times [1] = diskEvent.time;
+  times [2] = serialInEvent.time;
+  times [3] = serialOutEvent.time;
+  times [4] = oneShotEvent.time;
+  for (i=0; i<5; i++) {
+    snapshotTime (& times [i]);
+  }
+  if (snapshotReading && !snapshotFailed) {
+    initializeEventQueue ();
+    scheduleEvent (& timerEvent, times [0]);
+    scheduleEvent (& diskEvent, times [1]);
+    scheduleEvent (& serialInEvent, times [2]);
+    scheduleEvent (& serialOutEvent, times [3]);
+    scheduleEvent (& oneShotEvent, times [4]);
+  }
+
+  /* The timer device. */
+  snapshotInt (& timerTickDisabled);
+  snapshotInt (& timerLowWordLatched);
+  snapshotInt (& timerLatchedLowWord);
+  snapshotInt (& oneShotCpu);
+
+  /* The DISK device. */
+  snapshotInt (& currentDiskSector);
+  snapshotInt (& currentDiskStatus);
+  snapshotInt (& futureDiskStatus);
+  snapshotInt (& diskBufferLow);
+  snapshotInt (& diskBufferHigh);
+  snapshotInt (& diskMemoryAddressRegister);
+  snapshotInt (& diskSectorNumberRegister);
+  snapshotInt (& diskSectorCountRegister);
+  snapshotInt (& numberOfDiskReads);
+  snapshotInt (& numberOfDiskWrites);
+
+  /* The DMA disk controller, which is idle. */
+  if (snapshotReading) {
+    resetDmaController ();
+  }
+  snapshotInt (& dmaRequestRing);
+  snapshotInt (& dmaCompletionRing);
+  snapshotInt (& dmaRingSize);
+  snapshotInt (& dmaRequestTail);
+  snapshotInt (& dmaCompletionHead);
+  snapshotInt (& dmaRequestHead);
+  snapshotInt (& dmaCompletionTail);
+  snapshotInt (& dmaInterruptCount);
+  snapshotInt (& dmaInterruptDelay);
+
+  /* The serial device. */
+  snapshotInt (& terminalWantRawProcessing);
+  snapshotInt (& termInChar);
+  snapshotInt (& termInCharAvail);
+  snapshotInt (& termInCharWasUsed);
+  snapshotInt (& termOutputReady);
+  snapshotInt (& serialTransmitCount);
+  snapshotInt (& serialReceiveCount);
+  if ((serialReceiveCount < 0) || (serialReceiveCount > SERIAL_FIFO_MAX)) {
+    snapshotFailed = 1;
+    serialReceiveCount = 0;
+  }
+  for (i=0; i<serialReceiveCount; i++) {
+    ch = serialReceiveFifo [(serialReceiveOut + i) % SERIAL_FIFO_MAX];
+    snapshotInt (& ch);
+    serialReceiveFifo [(serialReceiveOut + i) % SERIAL_FIFO_MAX] = ch;
+  }
+
+  /* The performance counter device. */
+  snapshotTime (& userCycles);
+  snapshotTime (& pageInvalidExceptions);
+  snapshotTime (& pageReadonlyExceptions);
+  for (i=0; i<NUMBER_OF_PERF_COUNTERS; i++) {
+    snapshotTime (& perfCounterBase [i]);
+    snapshotTime (& perfCounterFrozen [i]);
+  }
+  snapshotInt (& perfCountersFrozen);
+  snapshotInt (& perfLatchedCounter);
+  snapshotInt (& perfLatchedLowWord);
+}
+
+
+
+/* snapshotInt (p)
+** snapshotTime (p)
+** snapshotDouble (p)
+**
+** These routines save or restore a single value in the snapshot file,
+** according to "snapshotReading".  Times are saved as two words (high
+** word first) and doubles as two words in BLITZ order, as by "fstore".
+** If the read or write fails, "snapshotFailed" is set.
+*/
+void snapshotInt (int * p) {
+  int i;
+  if (snapshotReading) {
+    if (fread (& i, 4, 1, snapshotFile) != 1) {
+      snapshotFailed = 1;
+      return;
+    }
+    * p = SWAP_BYTES (i);
+  } else {
+    i = SWAP_BYTES (* p);
+    if (fwrite (& i, 4, 1, snapshotFile) != 1) {
+      snapshotFailed = 1;
+    }
+  }
+}
+
+void snapshotTime (long long * p) {
+  int hi, lo;
+  hi = (int) (* p >> 32);
+  lo = (int) * p;
+  snapshotInt (& hi);
+  snapshotInt (& lo);
+  * p = (((long long) hi) << 32) | (unsigned int) lo;
+}
+
+void snapshotDouble (double * p) {
+  int * q = (int *) p;
+#ifdef BLITZ_HOST_IS_LITTLE_ENDIAN
+  snapshotInt (q+1);
+  snapshotInt (q);
+#else
+  snapshotInt (q);
+  snapshotInt (q+1);
+#endif
+}
+
+
+
+/* printNumberNL (i)
+**
+** This routine prints a number in the form
+**       0x1234abcd   ( decimal: 395441741     ascii: ".4.."   _my_label )
+** followed by a newline.
+*/
+void printNumberNL (int i) {
+  char str [100];
+  char c;
+  TableEntry * tableEntry;
+  int index;
+  if (i == 0) {
+    printf ("0x00000000     ( decimal: 0 )\n");
+    return;
+  }
+  printf ("0x");
+  putlong (i);
+  sprintf (str, "%d", i);
+  printf ("     ( decimal: ");
+  printStringInWidth (str, 11);
+  if ((i >= ' ') && (i <= '~')) {
+    printf (" ascii: \'");
+    putchar (i & 0x000000ff);
+    printf ("\'");
+  }
+/****
+  printf (" ascii: \"");
+  c = (i >> 24) & 0x000000ff;
+  if ((c>=' ') && (c <= '~')) {
+    putchar (c);
+  } else {
+    putchar ('.');
+  }
+  c = (i >> 16) & 0x000000ff;
+  if ((c>=' ') && (c <= '~')) {
+    putchar (c);
+  } else {
+    putchar ('.');
+  }
+  c = (i >> 8) & 0x000000ff;
+  if ((c>=' ') && (c <= '~')) {
+    putchar (c);
+  } else {
+    putchar ('.');
+  }
+  c = i & 0x000000ff;
+  if ((c>=' ') && (c <= '~')) {
+    putchar (c);
+  } else {
+    putchar ('.');
+  }
+  printf ("\"");
+****/
+  index = findLabel (i);
+  if (index != -1) {
+    tableEntry = valueIndex [index];
+    printf ("     %s", tableEntry->string);
+  }
+  printf (" )\n");
+}
+
+
+
+/* commandDumpMemory ()
+**
+** This routine asks for a starting address and a length.  It then dumps
+** that many bytes of physical memory.
+*/
+void commandDumpMemory () {
+  int addr, len;
+#ifdef BLITZ_HOST_ORDER_MEMORY
+  int i;
+  char * bytes;
+#endif
+  printf ("Enter the starting (physical) memory address in hex: ");
+  addr = readHexInt ();
+  if (addr < 0 ) {
+    printf ("Address must not be negative.\n");
+    return;
+  }
+  if (addr >= MEMORY_SIZE) {
+    printf ("This address is beyond the upper limit of physical memory.\n");
+    printf ("The address of the upper-most byte is ");
+    printNumberNL (MEMORY_SIZE - 1);
     return;
   }
   printf ("Enter the number of bytes in hex (or 0 to abort): ");
@@ -2669,7 +6727,20 @@ void commandDumpMemory () {
     printNumberNL (MEMORY_SIZE - addr);
     return;
   }
+#ifdef BLITZ_HOST_ORDER_MEMORY
+  /* Copy the bytes into BLITZ order before printing them. */
+  bytes = (char *) calloc (1, len);
+  if (bytes == 0) {
+    fatalError ("Calloc failed - insufficient memory available");
+  }
+  for (i=0; i<len; i++) {
+    bytes [i] = memory [MEMORY_BYTE_ADDR (addr + i)];
+  }
+  printMemory (bytes, len, addr);
+  free (bytes);
+#else
   printMemory (& memory [addr], len, addr);
+#endif
 }
 
 
@@ -3100,7 +7171,11 @@ void commandSetPTBR () {
     printf ("ERROR: The PTBR must always be word aligned.  No change.\n");
     return;
   }
+  if (commandOptionAcct) {
+    chargeAddressSpace ();
+  }
   ptbr = i;
+  flushTLB ();
   printf ("  PTBR = ");
   printNumberNL (ptbr);
 }
@@ -3120,6 +7195,7 @@ void commandSetPTLR () {
     return;
   }
   ptlr = i;
+  flushTLB ();
   printf ("  PTLR = ");
   printNumberNL (ptlr);
 }
@@ -3899,6 +7975,7 @@ void resetState () {
 
   numberOfDiskReads = 0;
   numberOfDiskWrites = 0;
+  resetStats ();
 
   /* Clear currentAddr, which is used in commandDis. */
   currentAddr = 0;
@@ -3928,10 +8005,11 @@ void resetState () {
 
   currentTime = 0;
   timeSpentAsleep = 0;
-  timeOfNextTimerEvent = MAX;
-  timeOfNextDiskEvent = MAX;
-  timeOfNextSerialInEvent = 0;
-  timeOfNextSerialOutEvent = MAX;
+  stallCycles = 0;
+  userCycles = 0;
+  initializeEventQueue ();
+  resetTimerDevice ();
+  scheduleEvent (& serialInEvent, 0);
   doTimerEvent ();
   executionHalted = 0;
   controlCPressed = 0;
@@ -3959,8 +8037,9 @@ void resetState () {
   termInCharAvail = 0;              /* No input available at this time */
   termInCharWasUsed = 1;            /* Last character was absorbed ok */
   termOutputReady = 1;              /* Output device is not busy */
-
-  updateTimeOfNextEvent ();
+  serialReceiveCount = 0;           /* Both FIFOs are empty */
+  serialReceiveOut = 0;
+  serialTransmitCount = 0;
 
   /* If we have already allocated memory, free it. */
   if (memory != NULL) {
@@ -3974,6 +8053,16 @@ void resetState () {
     fatalError ("Calloc failed - insufficient memory available");
   }
   currentMemoryLock = -1;
+  resetDecodedInstructions ();
+  resetFrameFlags ();
+  resetProfile ();
+  resetCpus ();
+  resetDmaController ();
+  flushTLB ();
+  resetCostModel ();
+  resetPerfCounters ();
+  resetAccounting ();
+  resetWorkingSets ();
 
   /* Initialize all integer and floating-point registers to zero. */
   for (i=0; i<=15; i++) {
@@ -4029,6 +8118,7 @@ void resetState () {
     if (errno) perror ("Error reading from a.out file");
     fatalError ("Problems reading text segment from a.out file");
   }
+  swapMemoryWords (textAddr, textAddr + textSize);
 
   /* Read in **** separator. */
   magic = readInteger (executableFile);
@@ -4044,6 +8134,7 @@ void resetState () {
     if (errno) perror ("Error reading from a.out file");
     fatalError ("Problems reading data segment from a.out file");
   }
+  swapMemoryWords (dataAddr, dataAddr + dataSize);
 
   /* Read in **** separator. */
   magic = readInteger (executableFile);
@@ -4085,6 +8176,9 @@ void resetState () {
   /* Finally, set the PC to the first address in the .text segment. */
   pc = textAddr;
 
+  /* Start a new coverage bitmap, if one is wanted. */
+  resetCoverage ();
+
 }
 
 
@@ -4218,8 +8312,8 @@ void commandFMem () {
     implAddr = ((intptr_t) memory) + physAddr;
     to = (intptr_t) & d;
 #ifdef BLITZ_HOST_IS_LITTLE_ENDIAN
-    * (int *) (to + 0) = SWAP_BYTES (* (int *) (implAddr+4));
-    * (int *) (to + 4) = SWAP_BYTES (* (int *) (implAddr+0));
+    * (int *) (to + 0) = MEMORY_WORD (* (int *) (implAddr+4));
+    * (int *) (to + 4) = MEMORY_WORD (* (int *) (implAddr+0));
 #else
     * (int *) (to + 0) = * (int *) (implAddr+0);
     * (int *) (to + 4) = * (int *) (implAddr+4);
@@ -4237,8 +8331,8 @@ void commandFMem () {
     /* Print out the address and the value. */
     printf ("   %06X: %08X %08X   value = %.15g\n",
       physAddr,
-      SWAP_BYTES (* (int *) implAddr),
-      SWAP_BYTES (* (int *) (implAddr + 4)),
+      MEMORY_WORD (* (int *) implAddr),
+      MEMORY_WORD (* (int *) (implAddr + 4)),
       d);
 
     physAddr = physAddr + 8;
@@ -4292,68 +8386,41 @@ void commandDis2 () {
 
 /* disassemble (physAddr)
 **
-** This routine disassembles and prints a single BLITZ instruction.
-** This routine is passed the addr.  If this address is not a
-** a legal physical address in the BLITZ memory, it prints a message
-** and returns.
+** This routine disassembles and prints a single BLITZ instruction,
+** preceded by any labels at its address.  This routine is passed the addr.
+** If this address is not a legal physical address in the BLITZ memory, it
+** prints a message and returns.
 */
 void disassemble (int physAddr) {
-  int opcode, opcode2, cat, n, index, instr, instr2, i1, i2;
-  intptr_t implAddr;
+  int index;
   TableEntry * tableEntry;
-  char c;
-
-  char * opcodes [] = {
-
-/* 0 .. 31 */
-"nop", "wait", "debug", "cleari", "seti", "clearp", "setp", "clears",
-"reti", "ret", "debug2", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-
-/* 32 .. 63 */
-"ldptbr", "ldptlr", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-
-/* 64 .. 95 */
-"call", "jmp", "be", "bne", "bl", "ble", "bg", "bge",
-"---", "---", "bvs", "bvc", "bns", "bnc", "bss", "bsc",
-"bis", "bic", "bps", "bpc", "push", "pop", "readu", "writeu",
-"tset", "ftoi", "itof", "fcmp", "fsqrt", "fneg", "fabs", "---",
-
-/* 96 .. 127 */
-"add", "sub", "mul", "div", "sll", "srl", "sra", "or",
-"and", "andn", "xor", "load", "loadb", "loadv", "loadbv", "store",
-"storeb", "storev", "storebv", "rem", "fadd", "fsub", "fmul", "fdiv",
-"fload", "fstore", "---", "---", "---", "---", "---", "---",
-
-/* 128 .. 159 */
-"add", "sub", "mul", "div", "sll", "srl", "sra", "or",
-"and", "andn", "xor", "load", "loadb", "loadv", "loadbv", "store",
-"storeb", "storev", "storebv", "readu", "writeu", "rem", "fload", "fstore",
-"---", "---", "---", "---", "---", "---", "---", "---",
 
-/* 160 .. 191 */
-"call", "jmp", "be", "bne", "bl", "ble", "bg", "bge",
-"---", "---", "bvs", "bvc", "bns", "bnc", "bss", "bsc",
-"bis", "bic", "bps", "bpc", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
+  /* Print out the label(s) if any. */
+  if (physicalAddressOk (physAddr) && isAligned (physAddr)) {
+    index = findLabel (physAddr);
+    while (1) {
+      if (index == -1) break;
+      if (index >= numberOfLabels) break;
+      tableEntry = valueIndex [index++];
+      if (tableEntry->value != physAddr) break;
+      printf ("                   %s:\n", tableEntry->string);
+    }
+  }
+  disassembleInstruction (physAddr);
+}
 
-/* 192 .. 223 */
-"sethi", "setlo", "ldaddr", "syscall", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
 
-/* 224 .. 255 */
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
-"---", "---", "---", "---", "---", "---", "---", "---",
 
-};
+/* disassembleInstruction (physAddr)
+**
+** This routine disassembles and prints a single BLITZ instruction on one
+** line, without any labels.  If the address is not a legal physical address
+** in the BLITZ memory, it prints a message and returns.
+*/
+void disassembleInstruction (int physAddr) {
+  int opcode, opcode2, cat, n, index, instr, instr2, i1, i2;
+  intptr_t implAddr;
+  char c;
 
   int  category [] = {
 /* 0 .. 31
@@ -4454,21 +8521,12 @@ xxx, xxx, xxx, xxx, xxx, xxx, xxx, xxx,
 
   /* Fetch the instruction. */
   implAddr = ((intptr_t) memory) + physAddr;
-  instr = SWAP_BYTES (* (int *) implAddr);
+  instr = MEMORY_WORD (* (int *) implAddr);
 
-  /* Print out the label(s) if any. */
-  index = findLabel (physAddr);
-  while (1) {
-    if (index == -1) break;
-    if (index >= numberOfLabels) break;
-    tableEntry = valueIndex [index++];
-    if (tableEntry->value != physAddr) break;
-    printf ("                   %s:\n", tableEntry->string);
-  }
   printf ("%06X: %08X       ", physAddr, instr);
 
   opcode = (instr >> 24) & 0x000000ff;
-  printStringInWidth (opcodes[opcode], 8);
+  printStringInWidth (opcodeNames[opcode], 8);
 
   cat = category[opcode];
   switch (cat) {
@@ -4573,7 +8631,7 @@ xxx, xxx, xxx, xxx, xxx, xxx, xxx, xxx,
       /* Fetch the next instruction. */
       if (physicalAddressOk (physAddr+4)) {
         implAddr = ((intptr_t) memory) + physAddr + 4;
-        instr2 = SWAP_BYTES (* (int *) implAddr);
+        instr2 = MEMORY_WORD (* (int *) implAddr);
         opcode2 = (instr2 >> 24) & 0x000000ff;
       } else {
         opcode2 = 0;
@@ -4837,7 +8895,11 @@ void printAboutToExecute () {
     printf ("*****  WARNING: A PAGE_INVALID_EXCEPTION, ADDRESS_EXCEPTION, or ALIGNMENT_EXCEPTION will occur during the next instruction fetch  *****\n");
     return;
   }
-  printf ("The next instruction to execute will be:\n");
+  if (numberOfCpus > 1) {
+    printf ("The next instruction to execute (on CPU %d) will be:\n", currentCpu);
+  } else {
+    printf ("The next instruction to execute will be:\n");
+  }
   disassemble (physAddr);
 }
 
@@ -4859,15 +8921,53 @@ void commandStepN () {
 /* commandGo (count)
 **
 ** Execute count BLITZ instructions, by calling singleStep() that
-** many times.  Count may be MAX, which will achieve infinite execution.
-*/
-void commandGo (int count) {
-  int i;
+** many times.  Count may be MAX_TIME, which will achieve infinite execution.
+** With the "-batch" option, runBlock() is used to execute the instructions
+** a basic block at a time.  The instructions are executed by
+** runInstructions.
+*/
+void commandGo (long long count) {
+  long long instructionsBefore;
+  struct timeval startTime, endTime;
   printf ("Beginning execution...\n");
   wantPrintingInSingleStep = 0;
   executionHalted = 0;
   turnOnTerminal ();
-  for (i=0; i<count; i++) {
+  if (commandOptionSample &&
+      ((timeOfNextSample <= currentTime) ||
+       (timeOfNextSample > currentTime + commandOptionSample))) {
+    timeOfNextSample = currentTime + commandOptionSample;
+  }
+  instructionsBefore = currentTime - timeSpentAsleep - stallCycles;
+  gettimeofday (& startTime, NULL);
+  runInstructions (count);
+  gettimeofday (& endTime, NULL);
+  hostSecondsWhileTimed += (endTime.tv_sec - startTime.tv_sec) +
+                           (endTime.tv_usec - startTime.tv_usec) / 1000000.0;
+  instructionsWhileTimed += currentTime - timeSpentAsleep - stallCycles -
+                            instructionsBefore;
+  turnOffTerminal ();
+  printf ("Done!  ");
+  printAboutToExecute ();
+}
+
+
+
+/* runInstructions (count) --> long long
+**
+** This routine does the work of commandGo, without any printing.  It
+** executes up to "count" instructions and returns the number it did not
+** execute, which is zero unless execution halted or was suspended.
+**
+** The instructions are executed in slices, each of which runs up to the
+** next event, or the next stack sample with "-sample" (or to the end of the
+** count).  "executionHalted" and
+** "controlCPressed" are only checked between slices; whatever sets them
+** also ends the current slice.  See suspendExecution.
+*/
+long long runInstructions (long long count) {
+  int slice, executed, i;
+  while (count > 0) {
     if (executionHalted) {
       break;
     }
@@ -4875,11 +8975,43 @@ void commandGo (int count) {
       controlCPressed = 0;
       break;
     }
-    singleStep ();
+    slice = MAX;
+    if (timeOfNextEvent - currentTime < slice) {
+      slice = timeOfNextEvent - currentTime;
+    }
+    if (commandOptionSample && (timeOfNextSample - currentTime < slice)) {
+      slice = timeOfNextSample - currentTime;
+    }
+    if (count < slice) {
+      slice = count;
+    }
+    if (slice < 1) {
+      slice = 1;
+    }
+    /* Count the instructions executed, since suspendExecution may end
+       the slice early by zeroing instructionsLeftInSlice. */
+    instructionsLeftInSlice = slice;
+    executed = 0;
+    if (commandOptionBatch) {
+      while (instructionsLeftInSlice > 0) {
+        i = runBlock (instructionsLeftInSlice);
+        instructionsLeftInSlice -= i;
+        executed += i;
+      }
+    } else {
+      while (instructionsLeftInSlice > 0) {
+        singleStep ();
+        instructionsLeftInSlice--;
+        executed++;
+      }
+    }
+    count -= executed;
+    if (commandOptionSample && (currentTime >= timeOfNextSample)) {
+      takeSample ();
+    }
   }
-  turnOffTerminal ();
-  printf ("Done!  ");
-  printAboutToExecute ();
+  fflush (termOutputFile);
+  return count;
 }
 
 
@@ -4997,53 +9129,55 @@ void commandStep () {
 
 /* singleStep ()
 **
-** This routine will execute the next BLITZ instruction and return.
+** This routine will execute the next BLITZ instruction and return.  With
+** more than one CPU, it does one cycle's work for the current CPU; see
+** multiprocessorStep.
 */
 void singleStep () {
-  int instr, opcode, x, y, z, thisInterrupt, sp, oldStatusReg, i, overflow;
-  double d1, d2, d3;
-  int physAddr, physAddr2, word, saveP, regNumber, regA, regC;
-  int * p;
 
   // printf ("_");
 
-  /* Increment the current time by 1 cycle.  This will overflow after
-     perhaps 5 to 45 minutes of CPU-bound execution time, depending on the
-     host speed. */
-  if (++currentTime >= MAX) {
-    fatalError ("Implementation Restriction: Current time overflow");
+  if (numberOfCpus > 1) {
+    multiprocessorStep ();
+    return;
   }
 
-  /* Check to see if we need to process an event. */
-  i = 0;
-  while (currentTime >= timeOfNextEvent) {
-    if (currentTime >= timeOfNextTimerEvent) {
-      // printf ("t");
-      doTimerEvent ();
-    }
-    if (currentTime >= timeOfNextDiskEvent) {
-      doDiskEvent ();
-    }
-    if (currentTime >= timeOfNextSerialInEvent) {
-      // printf ("i");
-      doSerialInEvent (0);
-    }
-    if (currentTime >= timeOfNextSerialOutEvent) {
-      // printf ("o");
-      doSerialOutEvent ();
-    }
-    updateTimeOfNextEvent ();
-    if (++i > 100) {
-      fatalError ("PROGRAM LOGIC ERROR: Too many events");
-    }
+  /* Increment the current time by 1 cycle.  Since currentTime is a long
+     long, it will not overflow in any realistic run. */
+  currentTime++;
+
+  /* Check to see if we need to process an event.  This one comparison is
+     kept on every step on purpose: the previous instruction may have
+     scheduled an event for this very cycle (e.g., a DISK error or a
+     one-shot timer store), and singleStep is also called on its own by
+     the "step" commands, outside of any slice computed by
+     runInstructions.  (For the same reason, runBlock makes the same test
+     after each instruction of a block.) */
+  if (currentTime >= timeOfNextEvent) {
+    processEvents ();
   }
 
+  stepCpu ();
+}
+
+
+
+/* stepCpu ()
+**
+** This routine does one cycle's work for the current CPU: it either takes
+** the next interrupt or executes the next instruction.  The time has already
+** been advanced by the caller.
+*/
+void stepCpu () {
+  int thisInterrupt, sp, oldStatusReg, i, opcode, oldPc;
+  DecodedInstruction * d;
 
   /* Check for and process any and all interrupts that have been signaled.
      Each iteration of this loop looks at the next interrupt.  The call
      to getNextInterrupt will ignore maskable interrupts if interrupts
-     are currently disabled (i.e., if statusI=0).  */
-  if (thisInterrupt = getNextInterrupt ()) {
+     are currently disabled (i.e., if statusI=0).  Almost always nothing
+     has been signaled, so we avoid the call in that case.  */
+  if (interruptsSignaled && (thisInterrupt = getNextInterrupt ())) {
 
     // printf (".");
 
@@ -5076,6 +9210,8 @@ void singleStep () {
         printf ("*****  EXCEPTION_DURING_INTERRUPT interrupt  *****\n");
       if (interruptsSignaled & SYSCALL_TRAP)
         printf ("*****  SYSCALL_TRAP interrupt  *****\n");
+      if (interruptsSignaled & INTERPROCESSOR_INTERRUPT)
+        printf ("*****  INTERPROCESSOR_INTERRUPT interrupt  *****\n");
       printf ("Processing an interrupt and jumping into interrupt vector.\n");
     }
 
@@ -5097,76 +9233,395 @@ void singleStep () {
       pageReadonlyOffendingAddress = 0;
       systemTrapNumber = 0;
 
-    /* For all other interrupts, push exception info onto the stack. */
-    } else {
+    /* For all other interrupts, push exception info onto the stack. */
+    } else {
+
+      /* Check for any problems that might arise with the stack. */
+      sp = systemRegisters [15];
+      if (!physicalAddressOk (sp-4) || !physicalAddressOk (sp-12)
+               || inMemoryMappedArea (sp-4) || inMemoryMappedArea (sp-12)
+               || !isAligned (sp)) {
+
+        /* Turn this into an EXCEPTION_DURING_INTERRUPT and cancel all
+           other pending interrupts. */
+        if (wantPrintingInSingleStep) {
+          printf ("*****  An EXCEPTION_DURING_INTERRUPT interrupt has occurred  *****\n");
+        }
+        thisInterrupt = EXCEPTION_DURING_INTERRUPT;
+        interruptsSignaled = 0;
+  
+      } else {
+  
+        /* Push the Exception info word onto the stack. */
+        if (thisInterrupt == SYSCALL_TRAP) {
+          putPhysicalWord (sp-4, systemTrapNumber);
+          systemTrapNumber = 0;
+        } else if (thisInterrupt == PAGE_INVALID_EXCEPTION) {
+          putPhysicalWord (sp-4, pageInvalidOffendingAddress);
+          pageInvalidOffendingAddress = 0;
+        } else if (thisInterrupt == PAGE_READONLY_EXCEPTION) {
+          putPhysicalWord (sp-4, pageReadonlyOffendingAddress);
+          pageReadonlyOffendingAddress = 0;
+        } else {
+          putPhysicalWord (sp-4, 0);
+        }
+        /* Push the status register and the PC onto the stack. */
+        putPhysicalWord (sp-8, oldStatusReg);
+        putPhysicalWord (sp-12, pc);
+        systemRegisters [15] = sp-12;
+      }
+    }
+
+    /* Next, set the pc to the address in the low-memory interrupt vector. */
+    pc = getVectorNumber (thisInterrupt);
+    interruptsTaken [pc / 4]++;
+
+    /* This is enough work for one machine cycle. */
+    return;
+
+  }
+
+  /* Fetch the next instruction. */
+  /*   Call translate with reading=TRUE, wantPrinting=FALSE, doUpdates=TRUE */
+  fetchingInstruction = 1;
+  i = translate (pc, 1, 0, 1);
+  fetchingInstruction = 0;
+  if (translateCausedException) {
+    if (wantPrintingInSingleStep) {
+      printf ("An exception has occurred during instruction fetch!\n");
+    }
+    return;
+  }
+  d = fetchDecodedInstruction (i);
+  if (commandOptionProf) {
+    profileInstruction (i);
+  }
+  if (coverageBitmap != NULL && !d->covered) {
+    recordCoverage (i, d);
+  }
+
+  /* Print the instruction. */
+  // printf ("Executing this instruction:\n");
+  // printAboutToExecute ();
+
+  opcode = d->opcode;
+  oldPc = pc;
+  executeInstruction (d);
+  if (costModelEnabled) {
+    chargeCycles (opcode, oldPc);
+  }
+}
+
+
+
+/* multiprocessorStep ()
+**
+** This routine is called by singleStep when there is more than one CPU.  It
+** does one cycle's work for the current CPU and then moves on to the next.
+** At the start of each round (i.e., for CPU 0), the time is advanced and any
+** events are processed.  If every CPU is waiting or stopped, with no
+** interrupt to wake it, the machine first sleeps until the next event, or
+** halts, just as for a "wait" instruction with one CPU.  As with one CPU,
+** the waiting CPUs then resume execution, whether or not the event causes
+** an interrupt.
+**
+** If this CPU suspends execution (e.g., with a "debug" instruction), it
+** remains the current CPU, so that the user will see its state.
+*/
+void multiprocessorStep () {
+  int c;
+  Cpu * cpu;
+
+  if (currentCpu == 0) {
+    if (allCpusIdle ()) {
+      sleepUntilNextEvent ();
+      if (executionHalted) {
+        return;
+      }
+      for (c = 0; c < numberOfCpus; c++) {
+        if (cpus [c].state == CPU_WAITING) {
+          cpus [c].state = CPU_RUNNING;
+        }
+      }
+    }
+    currentTime++;
+    if (currentTime >= timeOfNextEvent) {
+      processEvents ();
+    }
+  }
+
+  cpu = & cpus [currentCpu];
+  if ((cpu->state == CPU_WAITING) && getNextInterrupt ()) {
+    cpu->state = CPU_RUNNING;
+  }
+  if (cpu->state == CPU_RUNNING) {
+    cpu->busyCycles++;
+    stepCpu ();
+  } else {
+    cpu->idleCycles++;
+  }
+
+  if (!controlCPressed && !executionHalted) {
+    switchToCpu ((currentCpu + 1) % numberOfCpus);
+  }
+}
+
+
+
+/* allCpusIdle () --> bool
+**
+** This routine is called at the start of a round, when CPU 0 is current.  It
+** returns TRUE if no CPU has anything to do: each is either stopped or
+** waiting with no interrupt signaled.  (A waiting CPU has interrupts
+** enabled, so any signaled interrupt will wake it.)
+*/
+int allCpusIdle () {
+  int c;
+  if ((cpus [0].state != CPU_WAITING) || getNextInterrupt ()) {
+    return 0;
+  }
+  for (c = 1; c < numberOfCpus; c++) {
+    if ((cpus [c].state == CPU_RUNNING) ||
+        ((cpus [c].state == CPU_WAITING) && cpus [c].interruptsSignaled)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+
+/* sleepUntilNextEvent ()
+**
+** This routine is called when the CPU has nothing to do until an interrupt
+** occurs: after a "wait" instruction or, with more than one CPU, when every
+** CPU is idle.  It checks for serial input, and then moves the current time
+** up to the next event.  If no more interrupts will ever occur, it halts
+** execution.
+*/
+void sleepUntilNextEvent () {
+  long long nextTime, wakeTime;
+
+  /* Bring the output up to date, in case it was buffered. */
+  fflush (termOutputFile);
+
+  /* Remember when the first queued event was due before we checked
+     for input; we will sleep until that time. */
+  wakeTime = timeOfNextEvent;
+
+  /* Compute the time of the next event; we will ignore timer events... */
+  nextTime = diskEvent.time;
+
+  if (serialOutEvent.time < nextTime) {
+    nextTime = serialOutEvent.time;
+  }
+
+  if (dmaEvent.time < nextTime) {
+    nextTime = dmaEvent.time;
+  }
+
+  if (oneShotEvent.time < nextTime) {
+    nextTime = oneShotEvent.time;
+  }
+
+  /* If there is something in the type-ahead buffer... */
+  if (typeAheadBufferCount > 0) {
+    doSerialInEvent (1);
+    if (serialInEvent.time < nextTime) {
+      nextTime = serialInEvent.time;
+    }
+
+  /* Else, if serial input comes from a file... */
+  } else if (termInputFile != stdin) {
+    /* Then get more input from the file, if any... */
+    if (! feof (termInputFile)) {
+      doSerialInEvent (1);
+      if (serialInEvent.time < nextTime) {
+        nextTime = serialInEvent.time;
+      }
+    }
+
+  /* Else input comes from stdin... */
+  } else {
+    /* See if there is a character available on the input... */
+    doSerialInEvent (0);
+    if (termInCharAvail && serialInEvent.time < nextTime) {
+      nextTime = serialInEvent.time;
+    }
+  }
+
+  /* If we still haven't found anything to do
+     and there are no pending interrupts
+     and input is coming from the terminal
+     and the user has asked us to wait instead of terminate...  */
+  if ((nextTime == MAX_TIME) &&
+      (getNextInterrupt () == 0) &&
+      (termInputFile == stdin) &&
+      (commandOptionWait)) {
+
+    /* We are about to wait on user input.  Print a message so the
+       user will know we are waiting (unless we're in raw mode)...  */
+    if (! terminalWantRawProcessing) {
+      fprintf (stderr, "\n\r*****  Execution suspended on 'wait' instruction; waiting for additional user input  *****\n\r");
+    }
+
+    /* Wait for some input from stdin... */
+    doSerialInEvent (1);
+    if (serialInEvent.time < nextTime) {
+      nextTime = serialInEvent.time;
+    }
+  }
+
+  /* If we now have an interrupt that will be processed on the next cycle... */
+  if (getNextInterrupt ()) {
+    /* Do nothing thing; continue execution */
+
+  /* Else if we have a disk or serial event in the future... */
+  } else if (nextTime != MAX_TIME) {
+
+    /* Move currentTime up to the time of the next event. */
+    timeSpentAsleep += (wakeTime-1) - currentTime;
+    currentTime = wakeTime-1;
 
-      /* Check for any problems that might arise with the stack. */
-      sp = systemRegisters [15];
-      if (!physicalAddressOk (sp-4) || !physicalAddressOk (sp-12)
-               || inMemoryMappedArea (sp-4) || inMemoryMappedArea (sp-12)
-               || !isAligned (sp)) {
+  /* Else halt execution. */
+  } else {
+ 
+    fprintf (stderr, "\n\r*****  A 'wait' instruction was executed and no more interrupts are scheduled... halting emulation!  *****\n\r\n\r");
+    executionHalted = 1;
+    instructionsLeftInSlice = 0;
+  }
+}
 
-        /* Turn this into an EXCEPTION_DURING_INTERRUPT and cancel all
-           other pending interrupts. */
-        if (wantPrintingInSingleStep) {
-          printf ("*****  An EXCEPTION_DURING_INTERRUPT interrupt has occurred  *****\n");
-        }
-        thisInterrupt = EXCEPTION_DURING_INTERRUPT;
-        interruptsSignaled = 0;
-  
-      } else {
-  
-        /* Push the Exception info word onto the stack. */
-        if (thisInterrupt == SYSCALL_TRAP) {
-          putPhysicalWord (sp-4, systemTrapNumber);
-          systemTrapNumber = 0;
-        } else if (thisInterrupt == PAGE_INVALID_EXCEPTION) {
-          putPhysicalWord (sp-4, pageInvalidOffendingAddress);
-          pageInvalidOffendingAddress = 0;
-        } else if (thisInterrupt == PAGE_READONLY_EXCEPTION) {
-          putPhysicalWord (sp-4, pageReadonlyOffendingAddress);
-          pageReadonlyOffendingAddress = 0;
-        } else {
-          putPhysicalWord (sp-4, 0);
-        }
-        /* Push the status register and the PC onto the stack. */
-        putPhysicalWord (sp-8, oldStatusReg);
-        putPhysicalWord (sp-12, pc);
-        systemRegisters [15] = sp-12;
-      }
-    }
 
-    /* Next, set the pc to the address in the low-memory interrupt vector. */
-    pc = getVectorNumber (thisInterrupt);
 
-    /* This is enough work for one machine cycle. */
-    return;
+/* runBlock (limit) --> int
+**
+** This routine executes the basic block starting at the pc, but no more than
+** "limit" instructions, and returns the number of instructions executed.
+** If events are due or an interrupt is ready to be taken, it simply calls
+** singleStep.  The results are exactly the same as calling singleStep the
+** same number of times.
+**
+** After each instruction in the block, this routine checks that the next
+** instruction may be executed without any of singleStep's processing: no
+** event is due, no new interrupt has been signaled, the S, P and I bits are
+** unchanged, no TLB entry has been invalidated (which might affect the
+** page holding the code), and the disk is not busy (in which case the
+** instruction fetch must be checked against the disk buffer).  If the next
+** instruction would leave the page, or has not yet been decoded, the block
+** ends and that instruction is left for the next call.
+*/
+int runBlock (int limit) {
+  int count, physAddr, signaled, oldS, oldP, oldI, generation, endsBlock;
+  int opcode, oldPc;
+  DecodedInstruction * page, * d;
 
+  if ((currentTime + 1 >= timeOfNextEvent) || getNextInterrupt ()) {
+    singleStep ();
+    return 1;
   }
 
-  /* Fetch the next instruction. */
-  /*   Call translate with reading=TRUE, wantPrinting=FALSE, doUpdates=TRUE */
-  i = translate (pc, 1, 0, 1);
+  /* Fetch the first instruction, exactly as singleStep would. */
+  currentTime++;
+  fetchingInstruction = 1;
+  physAddr = translate (pc, 1, 0, 1);
+  fetchingInstruction = 0;
   if (translateCausedException) {
-    if (wantPrintingInSingleStep) {
-      printf ("An exception has occurred during instruction fetch!\n");
+    return 1;
+  }
+  d = fetchDecodedInstruction (physAddr);
+
+  signaled = interruptsSignaled;
+  oldS = statusS;
+  oldP = statusP;
+  oldI = statusI;
+  generation = tlbGeneration;
+  count = 1;
+
+  while (1) {
+
+    /* A disk read into this page may free "d", so look at it first. */
+    endsBlock = d->endsBlock;
+    opcode = d->opcode;
+    oldPc = pc;
+    if (commandOptionProf) {
+      profileInstruction (physAddr);
+    }
+    if (coverageBitmap != NULL && !d->covered) {
+      recordCoverage (physAddr, d);
+    }
+    executeInstruction (d);
+    if (costModelEnabled) {
+      chargeCycles (opcode, oldPc);
+    }
+    if (endsBlock || count >= limit) {
+      break;
+    }
+
+    /* Check that nothing has happened which would require singleStep. */
+    if ((interruptsSignaled != signaled) ||
+        (statusS != oldS) || (statusP != oldP) || (statusI != oldI) ||
+        (tlbGeneration != generation) ||
+        (currentDiskStatus == DISK_BUSY) ||
+        controlCPressed || executionHalted ||
+        (currentTime + 1 >= timeOfNextEvent)) {
+      break;
+    }
+
+    /* Make sure the next instruction follows in the same page and has
+       already been decoded. */
+    physAddr += 4;
+    if ((physAddr % PAGE_SIZE == 0) || !physicalAddressOk (physAddr)) {
+      break;
+    }
+    if ((pc & (PAGE_SIZE - 1)) != (physAddr & (PAGE_SIZE - 1))) {
+      break;
+    }
+    page = decodedPages [physAddr / PAGE_SIZE];
+    if (page == NULL) {
+      break;
+    }
+    d = & page [(physAddr % PAGE_SIZE) / 4];
+    if (!d->valid) {
+      break;
+    }
+
+    currentTime++;
+    count++;
+    if (watchingAccesses) {
+      recordAccess (TRACE_FETCH, 4, pc, physAddr);
     }
-    return;
   }
-  instr = getPhysicalWord (i);
+  return count;
+}
 
-  /* Print the instruction. */
-  // printf ("Executing this instruction:\n");
-  // printAboutToExecute ();
+
+
+/* executeInstruction (d)
+**
+** This routine is passed a decoded instruction, which has just been
+** fetched from the address in the pc.  It carries out the instruction.
+*/
+void executeInstruction (DecodedInstruction * d) {
+  int x, y, z, i, overflow;
+  double d1, d2, d3;
+  int physAddr, physAddr2, word, saveP, regNumber, regA, regC;
+  int * p;
+  int * regs;
+
+  regs = statusS ? systemRegisters : userRegisters;
+  instructionMix [statusS] [d->opcode]++;
+  if (!statusS) {
+    userCycles++;
+  }
 
   /* Switch on the op-code. */
-  opcode = (instr >> 24) & 0x000000ff;
-  switch (opcode) {
+  switch (d->opcode) {
 
     /***  add      Ra,Rb,Rc  ***/
     case 96:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       if ((x<0) && (y<0)) {
         overflow = (z>=0);
@@ -5176,14 +9631,14 @@ void singleStep () {
         overflow = 0;
       }
       setSR (z, overflow);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  add      Ra,data16,Rc  ***/
     case 128:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       if ((x<0) && (y<0)) {
         overflow = (z>=0);
@@ -5193,14 +9648,14 @@ void singleStep () {
         overflow = 0;
       }
       setSR (z, overflow);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  sub      Ra,Rb,Rc  ***/
     case 97:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x - y;
       if ((x>=0) && (y<0)) {
         overflow = (z<=0);
@@ -5210,14 +9665,14 @@ void singleStep () {
         overflow = 0;
       }
       setSR (z, overflow);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  sub      Ra,data16,Rc  ***/
     case 129:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x - y;
       if ((x>=0) && (y<0)) {
         overflow = (z<=0);
@@ -5227,14 +9682,14 @@ void singleStep () {
         overflow = 0;
       }
       setSR (z, overflow);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  mul      Ra,Rb,Rc  ***/
     case 98:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       d1 = ((double) x) * ((double) y);
       z = x * y;
       if (d1 != (double) z) {
@@ -5242,14 +9697,14 @@ void singleStep () {
       } else {
         setSR (z, 0);
       }
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  mul      Ra,data16,Rc  ***/
     case 130:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       d1 = ((double) x) * ((double) y);
       z = x * y;
       if (d1 != (double) z) {
@@ -5257,270 +9712,273 @@ void singleStep () {
       } else {
         setSR (z, 0);
       }
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  div      Ra,Rb,Rc  ***/
     case 99:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       if (y == 0) {
         interruptsSignaled |= ARITHMETIC_EXCEPTION;
         break;
       }
       if ((x == MIN) && (y == -1)) {
         setSR (MIN, 1);
-        putRc (instr, MIN);
+        if (d->rc) regs [d->rc] = MIN;
         pc += 4;
         break;
       }
       divide (x, y);
       setSR (q, 0);
-      putRc (instr, q);
+      if (d->rc) regs [d->rc] = q;
       pc += 4;
       break;
 
     /***  div      Ra,data16,Rc  ***/
     case 131:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       if (y == 0) {
         interruptsSignaled |= ARITHMETIC_EXCEPTION;
         break;
       }
       if ((x == MIN) && (y == -1)) {
         setSR (MIN, 1);
-        putRc (instr, MIN);
+        if (d->rc) regs [d->rc] = MIN;
         pc += 4;
         break;
       }
       divide (x, y);
       setSR (q, 0);
-      putRc (instr, q);
+      if (d->rc) regs [d->rc] = q;
       pc += 4;
       break;
 
     /***  sll      Ra,Rb,Rc  ***/
     case 100:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       y &= 0x0000001f;   /* Shift value must be 0..31 */
       z = x << y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  sll      Ra,data16,Rc  ***/
     case 132:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       y &= 0x0000001f;   /* Shift value must be 0..31 */
       z = x << y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  srl      Ra,Rb,Rc  ***/
     case 101:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       y &= 0x0000001f;   /* Shift value must be 0..31 */
       z = (signed int) (((unsigned int) x) >> y);
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  srl      Ra,data16,Rc  ***/
     case 133:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       y &= 0x0000001f;   /* Shift value must be 0..31 */
       z = (signed int) (((unsigned int) x) >> y);
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  sra      Ra,Rb,Rc  ***/
     case 102:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       y &= 0x0000001f;   /* Shift value must be 0..31 */
       z = x >> y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  sra      Ra,data16,Rc  ***/
     case 134:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       y &= 0x0000001f;   /* Shift value must be 0..31 */
       z = x >> y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  or       Ra,Rb,Rc  ***/
     case 103:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x | y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  or       Ra,data16,Rc  ***/
     case 135:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x | y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  and      Ra,Rb,Rc  ***/
     case 104:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x & y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  and      Ra,data16,Rc  ***/
     case 136:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x & y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  andn     Ra,Rb,Rc  ***/
     case 105:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x & ~y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  andn     Ra,data16,Rc  ***/
     case 137:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x & ~y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  xor      Ra,Rb,Rc  ***/
     case 106:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x ^ y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  xor      Ra,data16,Rc  ***/
     case 138:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x ^ y;
       setSR (z, 0);
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  rem      Ra,Rb,Rc  ***/
     case 115:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       if (y == 0) {
         interruptsSignaled |= ARITHMETIC_EXCEPTION;
         break;
       }
       if ((x == MIN) && (y == -1)) {
         setSR (0, 1);
-        putRc (instr, 0);
+        if (d->rc) regs [d->rc] = 0;
         pc += 4;
         break;
       }
       divide (x, y);
       setSR (r, 0);
-      putRc (instr, r);
+      if (d->rc) regs [d->rc] = r;
       pc += 4;
       break;
 
     /***  rem      Ra,data16,Rc  ***/
     case 149:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       if (y == 0) {
         interruptsSignaled |= ARITHMETIC_EXCEPTION;
         break;
       }
       if ((x == MIN) && (y == -1)) {
         setSR (0, 1);
-        putRc (instr, 0);
+        if (d->rc) regs [d->rc] = 0;
         pc += 4;
         break;
       }
       divide (x, y);
       setSR (r, 0);
-      putRc (instr, r);
+      if (d->rc) regs [d->rc] = r;
       pc += 4;
       break;
 
     /***  load     [Ra+Rb],Rc  ***/
     case 107:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 1, 0, 1);
       if (translateCausedException) {
         break;
       }
-      putRc (instr, getPhysicalWord (physAddr));
+      word = getPhysicalWord (physAddr);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
     /***  load     [Ra+data16],Rc  ***/
     case 139:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 1, 0, 1);
       if (translateCausedException) {
         break;
       }
-      putRc (instr, getPhysicalWord (physAddr));
+      word = getPhysicalWord (physAddr);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
     /***  loadb    [Ra+Rb],Rc  ***/
     case 108:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 1, 0, 1);
       if (translateCausedException) {
         break;
@@ -5529,16 +9987,17 @@ void singleStep () {
       /* Isolate the byte in the word and shift to lower-order 8 bits. */
       word = word >> (24 - ((z & 0x00000003) << 3));
       word &= 0x000000ff;
-      putRc (instr, word);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
     /***  loadb    [Ra+data16],Rc  ***/
     case 140:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 1, 0, 1);
       if (translateCausedException) {
         break;
@@ -5547,7 +10006,7 @@ void singleStep () {
       /* Isolate the byte in the word and shift to lower-order 8 bits. */
       word = word >> (24 - ((z & 0x00000003) << 3));
       word &= 0x000000ff;
-      putRc (instr, word);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
@@ -5557,8 +10016,8 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
@@ -5568,7 +10027,8 @@ void singleStep () {
       if (translateCausedException) {
         break;
       }
-      putRc (instr, getPhysicalWord (physAddr));
+      word = getPhysicalWord (physAddr);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
@@ -5578,8 +10038,8 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
@@ -5589,7 +10049,8 @@ void singleStep () {
       if (translateCausedException) {
         break;
       }
-      putRc (instr, getPhysicalWord (physAddr));
+      word = getPhysicalWord (physAddr);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
@@ -5599,12 +10060,13 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
       statusP = 1;
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 1, 0, 1);
       statusP = saveP;
       if (translateCausedException) {
@@ -5614,7 +10076,7 @@ void singleStep () {
       /* Isolate the byte in the word and shift to lower-order 8 bits. */
       word = word >> (24 - ((z & 0x00000003) << 3));
       word &= 0x000000ff;
-      putRc (instr, word);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
@@ -5624,12 +10086,13 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
       statusP = 1;
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 1, 0, 1);
       statusP = saveP;
       if (translateCausedException) {
@@ -5639,44 +10102,45 @@ void singleStep () {
       /* Isolate the byte in the word and shift to lower-order 8 bits. */
       word = word >> (24 - ((z & 0x00000003) << 3));
       word &= 0x000000ff;
-      putRc (instr, word);
+      if (d->rc) regs [d->rc] = word;
       pc += 4;
       break;
 
     /***  store    Rc,[Ra+Rb]  ***/
     case 111:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 0, 0, 1);
       if (translateCausedException) {
         break;
       }
-      putPhysicalWord (physAddr, getRc (instr));
+      putPhysicalWord (physAddr, regs [d->rc]);
       pc += 4;
       break;
 
     /***  store    Rc,[Ra+data16]  ***/
     case 143:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 0, 0, 1);
       if (translateCausedException) {
         break;
       }
-      putPhysicalWord (physAddr, getRc (instr));
+      putPhysicalWord (physAddr, regs [d->rc]);
       pc += 4;
       break;
 
     /***  storeb   Rc,[Ra+Rb]  ***/
     case 112:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 0, 0, 1);
       if (translateCausedException) {
         break;
@@ -5684,7 +10148,7 @@ void singleStep () {
       word = getPhysicalWordAndLock (physAddr);
       /* Get the low-order byte from register C; then shift it to proper
          place in the word; then "or" it into the word. */
-      i = getRc (instr);
+      i = regs [d->rc];
       if (z%4 == 0) {
         word = (word & 0x00ffffff) | ((i & 0x000000ff) << 24);
       } else if (z%4 == 1) {
@@ -5700,10 +10164,11 @@ void singleStep () {
 
     /***  storeb   Rc,[Ra+data16]  ***/
     case 144:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 0, 0, 1);
       if (translateCausedException) {
         break;
@@ -5711,7 +10176,7 @@ void singleStep () {
       word = getPhysicalWordAndLock (physAddr);
       /* Get the low-order byte from register C; then shift it to proper
          place in the word; then "or" it into the word. */
-      i = getRc (instr);
+      i = regs [d->rc];
       if (z%4 == 0) {
         word = (word & 0x00ffffff) | ((i & 0x000000ff) << 24);
       } else if (z%4 == 1) {
@@ -5731,8 +10196,8 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
@@ -5742,7 +10207,7 @@ void singleStep () {
       if (translateCausedException) {
         break;
       }
-      putPhysicalWord (physAddr, getRc (instr));
+      putPhysicalWord (physAddr, regs [d->rc]);
       pc += 4;
       pc += 4;
       break;
@@ -5753,8 +10218,8 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
@@ -5764,7 +10229,7 @@ void singleStep () {
       if (translateCausedException) {
         break;
       }
-      putPhysicalWord (physAddr, getRc (instr));
+      putPhysicalWord (physAddr, regs [d->rc]);
       pc += 4;
       break;
 
@@ -5774,12 +10239,13 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
       statusP = 1;
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 0, 0, 1);
       statusP = saveP;
       if (translateCausedException) {
@@ -5788,7 +10254,7 @@ void singleStep () {
       word = getPhysicalWordAndLock (physAddr);
       /* Get the low-order byte from register C; then shift it to proper
          place in the word; then "or" it into the word. */
-      i = getRc (instr);
+      i = regs [d->rc];
       if (z%4 == 0) {
         word = (word & 0x00ffffff) | ((i & 0x000000ff) << 24);
       } else if (z%4 == 1) {
@@ -5808,12 +10274,13 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       saveP = statusP;
       statusP = 1;
+      traceByteAddr = z;
       physAddr = translate (z&0xfffffffc, 0, 0, 1);
       statusP = saveP;
       if (translateCausedException) {
@@ -5822,7 +10289,7 @@ void singleStep () {
       word = getPhysicalWordAndLock (physAddr);
       /* Get the low-order byte from register C; then shift it to proper
          place in the word; then "or" it into the word. */
-      i = getRc (instr);
+      i = regs [d->rc];
       if (z%4 == 0) {
         word = (word & 0x00ffffff) | ((i & 0x000000ff) << 24);
       } else if (z%4 == 1) {
@@ -5838,8 +10305,8 @@ void singleStep () {
 
     /***  call     Ra+Rc  ***/
     case 64:
-      x = getRa (instr);
-      y = getRc (instr);
+      x = regs [d->ra];
+      y = regs [d->rc];
       z = x + y;
       if (z % 4 != 0) {
         interruptsSignaled |= ALIGNMENT_EXCEPTION;
@@ -5854,7 +10321,7 @@ void singleStep () {
 
     /***  call     data24  ***/
     case 160:
-      z = getData24 (instr);
+      z = d->data24;
       if (z % 4 != 0) {
         interruptsSignaled |= ALIGNMENT_EXCEPTION;
         break; 
@@ -5868,8 +10335,8 @@ void singleStep () {
 
     /***  jmp      Ra+Rc  ***/
     case 65:
-      x = getRa (instr);
-      y = getRc (instr);
+      x = regs [d->ra];
+      y = regs [d->rc];
       z = x + y;
       if (z % 4 != 0) {
         interruptsSignaled |= ALIGNMENT_EXCEPTION;
@@ -5880,7 +10347,7 @@ void singleStep () {
 
     /***  jmp      data24  ***/
     case 161:
-      z = getData24 (instr);
+      z = d->data24;
       if (z % 4 != 0) {
         interruptsSignaled |= ALIGNMENT_EXCEPTION;
         break;
@@ -5890,62 +10357,62 @@ void singleStep () {
 
     /***  be       Ra+Rc  ***/
     case 66:
-      jumpIfTrueRaRb (statusZ, instr);
+      jumpIfTrueRaRb (statusZ, d);
       break;
 
     /***  be       data24  ***/
     case 162:
-      jumpIfTrueData24 (statusZ, instr);
+      jumpIfTrueData24 (statusZ, d);
       break;
 
     /***  bne      Ra+Rc  ***/
     case 67:
-      jumpIfTrueRaRb (!statusZ, instr);
+      jumpIfTrueRaRb (!statusZ, d);
       break;
 
     /***  bne      data24  ***/
     case 163:
-      jumpIfTrueData24 (!statusZ, instr);
+      jumpIfTrueData24 (!statusZ, d);
       break;
 
     /***  bl       Ra+Rc  ***/
     case 68:
-      jumpIfTrueRaRb ((statusN ^ statusV), instr);
+      jumpIfTrueRaRb ((statusN ^ statusV), d);
       break;
 
     /***  bl       data24  ***/
     case 164:
-      jumpIfTrueData24 ((statusN ^ statusV), instr);
+      jumpIfTrueData24 ((statusN ^ statusV), d);
       break;
 
     /***  ble      Ra+Rc  ***/
     case 69:
-      jumpIfTrueRaRb ((statusZ | (statusN ^ statusV)), instr);
+      jumpIfTrueRaRb ((statusZ | (statusN ^ statusV)), d);
       break;
 
     /***  ble      data24  ***/
     case 165:
-      jumpIfTrueData24 ((statusZ | (statusN ^ statusV)), instr);
+      jumpIfTrueData24 ((statusZ | (statusN ^ statusV)), d);
       break;
 
     /***  bg       Ra+Rc  ***/
     case 70:
-      jumpIfTrueRaRb (!(statusZ | (statusN ^ statusV)), instr);
+      jumpIfTrueRaRb (!(statusZ | (statusN ^ statusV)), d);
       break;
 
     /***  bg       data24  ***/
     case 166:
-      jumpIfTrueData24 (!(statusZ | (statusN ^ statusV)), instr);
+      jumpIfTrueData24 (!(statusZ | (statusN ^ statusV)), d);
       break;
 
     /***  bge      Ra+Rc  ***/
     case 71:
-      jumpIfTrueRaRb (!(statusN ^ statusV), instr);
+      jumpIfTrueRaRb (!(statusN ^ statusV), d);
       break;
 
     /***  bge      data24  ***/
     case 167:
-      jumpIfTrueData24 (!(statusN ^ statusV), instr);
+      jumpIfTrueData24 (!(statusN ^ statusV), d);
       break;
 
 /***
@@ -5957,108 +10424,108 @@ void singleStep () {
 
     /***  bvs      Ra+Rc  ***/
     case 74:
-      jumpIfTrueRaRb (statusV, instr);
+      jumpIfTrueRaRb (statusV, d);
       break;
 
     /***  bvs      data24  ***/
     case 170:
-      jumpIfTrueData24 (statusV, instr);
+      jumpIfTrueData24 (statusV, d);
       break;
 
     /***  bvc      Ra+Rc  ***/
     case 75:
-      jumpIfTrueRaRb (!statusV, instr);
+      jumpIfTrueRaRb (!statusV, d);
       break;
 
     /***  bvc      data24  ***/
     case 171:
-      jumpIfTrueData24 (!statusV, instr);
+      jumpIfTrueData24 (!statusV, d);
       break;
 
     /***  bns      Ra+Rc  ***/
     case 76:
-      jumpIfTrueRaRb (statusN, instr);
+      jumpIfTrueRaRb (statusN, d);
       break;
 
     /***  bns      data24  ***/
     case 172:
-      jumpIfTrueData24 (statusN, instr);
+      jumpIfTrueData24 (statusN, d);
       break;
 
     /***  bnc      Ra+Rc  ***/
     case 77:
-      jumpIfTrueRaRb (!statusN, instr);
+      jumpIfTrueRaRb (!statusN, d);
       break;
 
     /***  bnc      data24  ***/
     case 173:
-      jumpIfTrueData24 (!statusN, instr);
+      jumpIfTrueData24 (!statusN, d);
       break;
 
     /***  bss      Ra+Rc  ***/
     case 78:
-      jumpIfTrueRaRb (statusS, instr);
+      jumpIfTrueRaRb (statusS, d);
       break;
 
     /***  bss      data24  ***/
     case 174:
-      jumpIfTrueData24 (statusS, instr);
+      jumpIfTrueData24 (statusS, d);
       break;
 
     /***  bsc      Ra+Rc  ***/
     case 79:
-      jumpIfTrueRaRb (!statusS, instr);
+      jumpIfTrueRaRb (!statusS, d);
       break;
 
     /***  bsc      data24  ***/
     case 175:
-      jumpIfTrueData24 (!statusS, instr);
+      jumpIfTrueData24 (!statusS, d);
       break;
 
     /***  bis      Ra+Rc  ***/
     case 80:
-      jumpIfTrueRaRb (statusI, instr);
+      jumpIfTrueRaRb (statusI, d);
       break;
 
     /***  bis      data24  ***/
     case 176:
-      jumpIfTrueData24 (statusI, instr);
+      jumpIfTrueData24 (statusI, d);
       break;
 
     /***  bic      Ra+Rc  ***/
     case 81:
-      jumpIfTrueRaRb (!statusI, instr);
+      jumpIfTrueRaRb (!statusI, d);
       break;
 
     /***  bic      data24  ***/
     case 177:
-      jumpIfTrueData24 (!statusI, instr);
+      jumpIfTrueData24 (!statusI, d);
       break;
 
     /***  bps      Ra+Rc  ***/
     case 82:
-      jumpIfTrueRaRb (statusP, instr);
+      jumpIfTrueRaRb (statusP, d);
       break;
 
     /***  bps      data24  ***/
     case 178:
-      jumpIfTrueData24 (statusP, instr);
+      jumpIfTrueData24 (statusP, d);
       break;
 
     /***  bpc      Ra+Rc  ***/
     case 83:
-      jumpIfTrueRaRb (!statusP, instr);
+      jumpIfTrueRaRb (!statusP, d);
       break;
 
     /***  bpc      data24  ***/
     case 179:
-      jumpIfTrueData24 (!statusP, instr);
+      jumpIfTrueData24 (!statusP, d);
       break;
 
     /***  push     Rc,[--Ra]  ***/
     case 84:
-      regNumber = (instr >> 16) & 0x0000000f;
-      z = getRc (instr);
+      regNumber = d->ra;
+      z = regs [d->rc];
       pushOntoStack (regNumber, z);
       if (translateCausedException) {
         break;
@@ -6068,19 +10535,19 @@ void singleStep () {
 
     /***  pop      [Ra++],Rc  ***/
     case 85:
-      regNumber = (instr >> 16) & 0x0000000f;
+      regNumber = d->ra;
       z = popFromStack (regNumber);
       if (translateCausedException) {
         break;
       }
-      putRc (instr, z);
+      if (d->rc) regs [d->rc] = z;
       pc += 4;
       break;
 
     /***  sethi    data16,Rc  ***/
     case 192:
-      z = getData16 (instr);
-      regNumber = (instr >> 20) & 0x0000000f;
+      z = d->data16;
+      regNumber = d->rc;
       if (regNumber != 0) {
         if (statusS) {
           systemRegisters [regNumber] =
@@ -6095,8 +10562,8 @@ void singleStep () {
 
     /***  setlo    data16,Rc  ***/
     case 193:
-      z = getData16 (instr);
-      regNumber = (instr >> 20) & 0x0000000f;
+      z = d->data16;
+      regNumber = d->rc;
       if (regNumber != 0) {
         if (statusS) {
           systemRegisters [regNumber] =
@@ -6111,16 +10578,16 @@ void singleStep () {
 
     /***  ldaddr   data16,Rc  ***/
     case 194:
-      x = getData16 (instr);
+      x = d->data16;
       y = pc + x;
-      putRc (instr, y);
+      if (d->rc) regs [d->rc] = y;
       pc += 4;
       break;
 
     /***  syscall  Rc+data16  ***/
     case 195:
-      x = getRc (instr);
-      y = getData16 (instr);
+      x = regs [d->rc];
+      y = d->data16;
       interruptsSignaled |= SYSCALL_TRAP;
       systemTrapNumber = x+y;
       pc += 4;
@@ -6129,7 +10596,7 @@ void singleStep () {
     /***  nop  ***/
     case 0:
       printf ("WARNING: Executing a NOP instruction at address 0x%08X - Suspending execution!\r\n", pc);
-      controlCPressed = 1;
+      suspendExecution ();
       pc += 4;
       break;
 
@@ -6145,77 +10612,12 @@ void singleStep () {
       /* Enable interrupts. */
       statusI = 1;
 
-      /* Compute the time of the next event; we will ignore timer events... */
-      i = timeOfNextDiskEvent;
-
-      if (timeOfNextSerialOutEvent < i) {
-        i = timeOfNextSerialOutEvent;
-      }
-
-      /* If there is something in the type-ahead buffer... */
-      if (typeAheadBufferCount > 0) {
-        doSerialInEvent (1);
-        if (timeOfNextSerialInEvent < i) {
-          i = timeOfNextSerialInEvent;
-        }
-
-      /* Else, if serial input comes from a file... */
-      } else if (termInputFile != stdin) {
-        /* Then get more input from the file, if any... */
-        if (! feof (termInputFile)) {
-          doSerialInEvent (1);
-          if (timeOfNextSerialInEvent < i) {
-            i = timeOfNextSerialInEvent;
-          }
-        }
-
-      /* Else input comes from stdin... */
-      } else {
-        /* See if there is a character available on the input... */
-        doSerialInEvent (0);
-        if (termInCharAvail && timeOfNextSerialInEvent < i) {
-          i = timeOfNextSerialInEvent;
-        }
-      }
-
-      /* If we still haven't found anything to do
-         and there are no pending interrupts
-         and input is coming from the terminal
-         and the user has asked us to wait instead of terminate...  */
-      if ((i == MAX) &&
-          (getNextInterrupt () == 0) &&
-          (termInputFile == stdin) &&
-          (commandOptionWait)) {
-
-        /* We are about to wait on user input.  Print a message so the
-           user will know we are waiting (unless we're in raw mode)...  */
-        if (! terminalWantRawProcessing) {
-          fprintf (stderr, "\n\r*****  Execution suspended on 'wait' instruction; waiting for additional user input  *****\n\r");
-        }
-
-        /* Wait for some input from stdin... */
-        doSerialInEvent (1);
-        if (timeOfNextSerialInEvent < i) {
-          i = timeOfNextSerialInEvent;
-        }
-      }
-
-      /* If we now have an interrupt that will be processed on the next cycle... */
-      if (getNextInterrupt ()) {
-        /* Do nothing thing; continue execution */
-
-      /* Else if we have a disk or serial event in the future... */
-      } else if (i != MAX) {
-
-        /* Move currentTime up to the time of the next event. */
-        timeSpentAsleep += (timeOfNextEvent-1) - currentTime;
-        currentTime = timeOfNextEvent-1;
-
-      /* Else halt execution. */
+      /* With more than one CPU, this CPU waits until it is interrupted (see
+         multiprocessorStep); otherwise, sleep until the next event. */
+      if (numberOfCpus > 1) {
+        cpus [currentCpu].state = CPU_WAITING;
       } else {
-     
-        fprintf (stderr, "\n\r*****  A 'wait' instruction was executed and no more interrupts are scheduled... halting emulation!  *****\n\r\n\r");
-        executionHalted = 1;
+        sleepUntilNextEvent ();
       }
 
       /* Increment PC; executing go after a wait will resume execution. */
@@ -6226,7 +10628,7 @@ void singleStep () {
     case 2:
       /* Stop instruction emulation and print a message.  Advance the
          PC so that we can easily resume execution. */
-      controlCPressed = 1;
+      suspendExecution ();
       turnOffTerminal ();
       fprintf (stderr, "\n\r****  A 'debug' instruction was encountered  *****\n\r");
       turnOnTerminal ();
@@ -6261,7 +10663,7 @@ void singleStep () {
           z = userRegisters [3];
         }
         if ((z < 0) | (z > 100000)) {
-          controlCPressed = 1;
+          suspendExecution ();
           fprintf (stderr, "\n\r****  An error occurred during a 'debug2' instruction - invalid string length in print  *****\n\r");
           z = -1;
         }
@@ -6270,7 +10672,7 @@ void singleStep () {
           /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
           physAddr = translate (y&0xfffffffc, 1, 0, 1);
           if (translateCausedException) {
-            controlCPressed = 1;
+            suspendExecution ();
             fprintf (stderr, "\n\r****  An error occurred during a 'debug2' instruction - address exception in print  *****\n\r");
             break;
           }
@@ -6313,7 +10715,7 @@ void singleStep () {
         } else if (y == 1) {
           printf ("TRUE");
         } else {
-          controlCPressed = 1;
+          suspendExecution ();
           fprintf (stderr, "\n\r****  An error occurred during a 'debug2' instruction - invalid boolean value in printBool  *****\n\r");
         }
 
@@ -6324,7 +10726,7 @@ void singleStep () {
 
       /* Function = ERROR */
       } else {
-        controlCPressed = 1;
+        suspendExecution ();
         fprintf (stderr, "\n\r****  An error occurred during a 'debug2' instruction - invalid function code  *****\n\r");
       }
 
@@ -6415,13 +10817,14 @@ void singleStep () {
 
     /***  tset     [Ra],Rc  ***/
     case 88:
-      x = getRa (instr);
+      x = regs [d->ra];
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       physAddr = translate (x, 0, 0, 1);
       if (translateCausedException) {
         break;
       }
-      putRc (instr, getPhysicalWordAndLock (physAddr));
+      word = getPhysicalWordAndLock (physAddr);
+      if (d->rc) regs [d->rc] = word;
       putPhysicalWordAndRelease (physAddr, 0x00000001);
       pc += 4;
       break;
@@ -6432,8 +10835,8 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      regC = (instr >> 20) & 0x0000000f;
-      regA = (instr >> 16) & 0x0000000f;
+      regC = d->rc;
+      regA = d->ra;
       pc += 4;
       if (regA == 0) break;
       systemRegisters [regA] = userRegisters [regC];
@@ -6445,15 +10848,15 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 0, 0, 1);
       if (translateCausedException) {
         break;
       }
-      regC = (instr >> 20) & 0x0000000f;
+      regC = d->rc;
       putPhysicalWord (physAddr, userRegisters [regC]);
       pc += 4;
       break;
@@ -6464,8 +10867,8 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      regC = (instr >> 20) & 0x0000000f;
-      regA = (instr >> 16) & 0x0000000f;
+      regC = d->rc;
+      regA = d->ra;
       pc += 4;
       if (regC == 0) break;
       userRegisters [regC] = systemRegisters [regA];
@@ -6477,15 +10880,15 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 1, 0, 1);
       if (translateCausedException) {
         break;
       }
-      regC = (instr >> 20) & 0x0000000f;
+      regC = d->rc;
       pc += 4;
       if (regC == 0) break;
       userRegisters [regC] = getPhysicalWord (physAddr);
@@ -6497,12 +10900,16 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRc (instr);
+      x = regs [d->rc];
       if (x % 4 != 0) {
         interruptsSignaled |= ALIGNMENT_EXCEPTION;
         break;
       }
+      if (commandOptionAcct) {
+        chargeAddressSpace ();
+      }
       ptbr = x;
+      flushTLB ();
       pc += 4;
       break;
 
@@ -6512,71 +10919,72 @@ void singleStep () {
         interruptsSignaled |= PRIVILEGED_INSTRUCTION;
         break;
       }
-      x = getRc (instr);
+      x = regs [d->rc];
       if (x % 4 != 0) {
         interruptsSignaled |= ALIGNMENT_EXCEPTION;
         break;
       }
       ptlr = x;
+      flushTLB ();
       pc += 4;
       break;
 
     /***  ftoi      FRa,Rc  ***/
     case 89:
-      d1 = getFRa (instr);
+      d1 = floatRegisters [d->ra];
       i = d1;
-      putRc (instr, i);
+      if (d->rc) regs [d->rc] = i;
       pc += 4;
       break;
 
     /***  itof      Ra,FRc  ***/
     case 90:
-      i = getRa (instr);
+      i = regs [d->ra];
       d1 = i;
-      putFRc (instr, d1);
+      floatRegisters [d->rc] = d1;
       pc += 4;
       break;
 
     /***  fadd      FRa,FRb,FRc  ***/
     case 116:
-      d1 = getFRa (instr);
-      d2 = getFRb (instr);
+      d1 = floatRegisters [d->ra];
+      d2 = floatRegisters [d->rb];
       d3 = d1 + d2;
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fsub      FRa,FRb,FRc  ***/
     case 117:
-      d1 = getFRa (instr);
-      d2 = getFRb (instr);
+      d1 = floatRegisters [d->ra];
+      d2 = floatRegisters [d->rb];
       d3 = d1 - d2;
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fmul      FRa,FRb,FRc  ***/
     case 118:
-      d1 = getFRa (instr);
-      d2 = getFRb (instr);
+      d1 = floatRegisters [d->ra];
+      d2 = floatRegisters [d->rb];
       d3 = d1 * d2;
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fdiv      FRa,FRb,FRc  ***/
     case 119:
-      d1 = getFRa (instr);
-      d2 = getFRb (instr);
+      d1 = floatRegisters [d->ra];
+      d2 = floatRegisters [d->rb];
       d3 = d1 / d2;
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fcmp      FRa,FRc  ***/
     case 91:
-      d1 = getFRa (instr);
-      d2 = getFRc (instr);
+      d1 = floatRegisters [d->ra];
+      d2 = floatRegisters [d->rc];
       statusZ = statusN = statusV = 0;
       if (d1 == d2) {
         statusZ = 1;
@@ -6595,32 +11003,32 @@ void singleStep () {
 
     /***  fsqrt      FRa,FRc  ***/
     case 92:
-      d1 = getFRa (instr);
+      d1 = floatRegisters [d->ra];
       d3 = sqrt (d1);
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fneg      FRa,FRc  ***/
     case 93:
-      d1 = getFRa (instr);
+      d1 = floatRegisters [d->ra];
       d3 = -d1;
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fabs      FRa,FRc  ***/
     case 94:
-      d1 = getFRa (instr);
+      d1 = floatRegisters [d->ra];
       d3 = fabs (d1);
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fload      [Ra+Rb],FRc  ***/
     case 120:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 1, 0, 1);
@@ -6640,14 +11048,14 @@ void singleStep () {
       *p = getPhysicalWord (physAddr);
       *(p+1) = getPhysicalWord (physAddr2);
 #endif
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fload      [Ra+data16],FRc  ***/
     case 150:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=true, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 1, 0, 1);
@@ -6667,14 +11075,14 @@ void singleStep () {
       *p = getPhysicalWord (physAddr);
       *(p+1) = getPhysicalWord (physAddr2);
 #endif
-      putFRc (instr, d3);
+      floatRegisters [d->rc] = d3;
       pc += 4;
       break;
 
     /***  fstore      FRc,[Ra+Rb]  ***/
     case 121:
-      x = getRa (instr);
-      y = getRb (instr);
+      x = regs [d->ra];
+      y = regs [d->rb];
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 0, 0, 1);
@@ -6687,7 +11095,7 @@ void singleStep () {
         break;
       }
       p = (int *) (& d3);
-      d3 = getFRc (instr);
+      d3 = floatRegisters [d->rc];
 #ifdef BLITZ_HOST_IS_LITTLE_ENDIAN
       putPhysicalWord (physAddr2, *p);
       putPhysicalWord (physAddr, *(p+1));
@@ -6700,8 +11108,8 @@ void singleStep () {
 
     /***  fstore      FRc,[Ra+data16]  ***/
     case 151:
-      x = getRa (instr);
-      y = getData16 (instr);
+      x = regs [d->ra];
+      y = d->data16;
       z = x + y;
       /* Call translate with reading=false, wantPrinting=0, doUpdates=1 */
       physAddr = translate (z, 0, 0, 1);
@@ -6714,7 +11122,7 @@ void singleStep () {
         break;
       }
       p = (int *) (& d3);
-      d3 = getFRc (instr);
+      d3 = floatRegisters [d->rc];
 #ifdef BLITZ_HOST_IS_LITTLE_ENDIAN
       putPhysicalWord (physAddr2, *p);
       putPhysicalWord (physAddr, *(p+1));
@@ -6943,6 +11351,11 @@ void setSR (int value, int overflow) {
 ** to the incorrect thread.
 */
 int getNextInterrupt () {
+  /* First, quickly deal with the usual case, in which there is nothing to
+     do: no interrupts, or only maskable ones with interrupts disabled. */
+  if ((interruptsSignaled & (statusI ? -1 : ~MASKABLE_INTERRUPTS)) == 0) {
+    return 0;
+  }
   if (interruptsSignaled & POWER_ON_RESET) {
     return POWER_ON_RESET;
   } else if (interruptsSignaled & HARDWARE_FAULT) {
@@ -6971,6 +11384,8 @@ int getNextInterrupt () {
     return DISK_INTERRUPT;
   } else if ((interruptsSignaled & SERIAL_INTERRUPT) && statusI) {
     return SERIAL_INTERRUPT;
+  } else if ((interruptsSignaled & INTERPROCESSOR_INTERRUPT) && statusI) {
+    return INTERPROCESSOR_INTERRUPT;
   } else {
     return 0;
   }
@@ -6999,6 +11414,7 @@ int getNextInterrupt () {
 **      002C   Alignment Exception            No
 **      0030   Exception During Interrupt     No
 **      0034   Syscall Trap                  Yes
+**      0038   Interprocessor Interrupt      Yes
 */
 int getVectorNumber (int interruptType) {
   if (interruptType == POWER_ON_RESET) {
@@ -7029,6 +11445,8 @@ int getVectorNumber (int interruptType) {
     return 0x00000030;
   } else if (interruptType == SYSCALL_TRAP) {
     return 0x00000034;
+  } else if (interruptType == INTERPROCESSOR_INTERRUPT) {
+    return 0x00000038;
   } else {
     fatalError ("PROGRAM LOGIC ERROR: Unknown exception vector");
   }
@@ -7110,136 +11528,436 @@ int getVectorNumber (int interruptType) {
 ** we had an exception or to call a routine (such as getPhysicalWord) to
 ** fetch or store a word from/to memory.
 **
-**************************************************************************/
+**************************************************************************/
+
+
+
+
+/* physicalAddressOk (addr)
+**
+** This routine is passed a physical memory address.  It returns TRUE
+** if this is a legal physical memory address, i.e., if no "Address
+** Exception" should be thrown.  The address may be in the memory mapped
+** area; this is still considered OK.
+*/
+int physicalAddressOk (int addr) {
+  return ((0 <= addr ) && (addr < MEMORY_SIZE));
+}
+
+
+
+/* isAligned (addr)
+**
+** This function returns TRUE if this address is word aligned.
+*/
+int isAligned (int addr) {
+  return addr%4 == 0;
+}
+
+
+
+/* getPhysicalWord (physAddr)
+**
+** This routine is passed a physical memory address.  It returns the
+** word stored at that address.  The address is assumed to be OK, i.e.,
+** both aligned and within physical memory.  Therefore, no exceptions
+** are possible.  If the address is in the memory-mapped region, it calls
+** the I/O subsystem.
+*/
+int getPhysicalWord (int physAddr) {
+  intptr_t implAddr;
+  if (!physicalAddressOk (physAddr)) {
+    fatalError ("PROGRAM LOGIC ERROR: Invalid address in getPhysicalWord");
+  }
+  if (physAddr % 4 != 0) {
+    fatalError ("PROGRAM LOGIC ERROR: Unaligned address in getPhysicalWord");
+  }
+  if (frameFlags [physAddr / PAGE_SIZE]) {
+    checkDiskBufferError (physAddr);
+    if (inMemoryMappedArea (physAddr)) {
+      return getMemoryMappedWord (physAddr);
+    }
+  }
+  implAddr = ((intptr_t) memory) + physAddr;
+  return MEMORY_WORD (* (int *) implAddr);
+}
+
+
+
+/* getPhysicalWordAndLock (physAddr)
+**
+** Acquire a lock on this word and then get the word from memory.
+*/
+int getPhysicalWordAndLock (int physAddr) {
+  if (currentMemoryLock != -1) {
+    fatalError ("PROGRAM LOGIC ERROR: In getPhysicalWordAndLock - lock is not clear");
+  }
+  currentMemoryLock = physAddr;
+  return getPhysicalWord (physAddr);
+}
+
+
+
+/* putPhysicalWord (physAddr, value)
+**
+** This routine is passed a physical memory address.  It stores the word
+** "value" at that address.  The address is assumed to be OK, i.e.,
+** both aligned and within physical memory.  Therefore, no exceptions
+** are possible.  If the address is in the memory-mapped region, it calls
+** the I/O subsystem.
+*/
+void putPhysicalWord (int physAddr, int value) {
+  intptr_t implAddr;
+  if (!physicalAddressOk (physAddr)) {
+    fatalError ("PROGRAM LOGIC ERROR: Invalid address in putPhysicalWord");
+  }
+  if (physAddr % 4 != 0) {
+    fatalError ("PROGRAM LOGIC ERROR: Unaligned address in putPhysicalWord");
+  }
+  if (frameFlags [physAddr / PAGE_SIZE]) {
+    checkDiskBufferError (physAddr);
+    if (inMemoryMappedArea (physAddr)) {
+      putMemoryMappedWord (physAddr, value);
+      return;
+    }
+  }
+  implAddr = ((intptr_t) memory) + physAddr;
+  * (int *) implAddr = MEMORY_WORD (value);
+  if (decodedPages [physAddr / PAGE_SIZE] != NULL) {
+    invalidateDecodedWord (physAddr);
+  }
+  if (physAddr >= ptbr && physAddr < ptbr + ptlr) {
+    invalidateTLBEntry (physAddr);
+  }
+  if (numberOfCpus > 1) {
+    invalidateOtherTLBs (physAddr);
+  }
+}
+
+
+
+/* swapMemoryWords (low, high)
+**
+** If BLITZ_HOST_ORDER_MEMORY is defined, this routine swaps the bytes of
+** each word in "memory" from "low" up to (but not including) "high",
+** converting between the host order used in "memory" and the BLITZ order
+** used in files.  Otherwise, "memory" is already in BLITZ order and this
+** routine does nothing.
+*/
+void swapMemoryWords (int low, int high) {
+#ifdef BLITZ_HOST_ORDER_MEMORY
+  int * p, * end;
+  p = (int *) (memory + (low & 0xfffffffc));
+  end = (int *) (memory + ((high + 3) & 0xfffffffc));
+  while (p < end) {
+    * p = SWAP_BYTES (* p);
+    p++;
+  }
+#endif
+}
+
+
+
+/* putPhysicalWordAndRelease (physAddr, value)
+**
+** This routine writes a word to memory and then releases the lock.
+*/
+void putPhysicalWordAndRelease (int physAddr, int value) {
+  if (currentMemoryLock != physAddr) {
+    fatalError ("PROGRAM LOGIC ERROR: In putPhysicalWordAndRelease - lock is not held for this address");
+  }
+  currentMemoryLock = -1;
+  putPhysicalWord (physAddr, value);
+}
+
+
+
+/* releaseMemoryLock (physAddr)
+**
+** This routine releases the lock on this memory location.
+*/
+void releaseMemoryLock (int physAddr) {
+  if (currentMemoryLock != physAddr) {
+    fatalError ("PROGRAM LOGIC ERROR: In releaseMemoryLock - Lock not held on this address");
+  }
+  currentMemoryLock = -1;
+}
+
+
+
+/* inMemoryMappedArea (addr)
+**
+** This routine is passed a physical address.  It returns true if
+** this address is the range of memory-mapped bytes.
+*/
+int inMemoryMappedArea (int addr) {
+  return (addr >= MEMORY_MAPPED_AREA_LOW) && (addr <= MEMORY_MAPPED_AREA_HIGH);
+}
+
+
+
+/* fetchDecodedInstruction (physAddr) --> DecodedInstruction *
+**
+** This routine is passed the physical address of an instruction.  The
+** address is assumed to be OK, i.e., both aligned and within physical memory.
+** It returns a pointer to the decoded form of the instruction, decoding the
+** word first if it is not already in the decoded instruction cache.
+** Instructions fetched from the memory-mapped area are never cached.
+*/
+DecodedInstruction * fetchDecodedInstruction (int physAddr) {
+  DecodedInstruction * page, * d;
+  int frame;
+
+  /* First, the usual case: the word has already been decoded, and the
+     frame needs no special handling. */
+  frame = physAddr / PAGE_SIZE;
+  page = decodedPages [frame];
+  if ((page != NULL) && (frameFlags [frame] == 0)) {
+    d = & page [(physAddr % PAGE_SIZE) / 4];
+    if (d->valid) {
+      return d;
+    }
+  }
 
+  if ((frameFlags [physAddr / PAGE_SIZE] & FRAME_MEMORY_MAPPED) &&
+      inMemoryMappedArea (physAddr)) {
+    decodeInstruction (& uncachedInstruction, getPhysicalWord (physAddr));
+    return & uncachedInstruction;
+  }
+  page = decodedPages [physAddr / PAGE_SIZE];
+  if (page == NULL) {
+    page = (DecodedInstruction *) calloc (INSTRS_PER_PAGE,
+                                          sizeof (DecodedInstruction));
+    if (page == NULL) {
+      fatalError ("Calloc failed - insufficient memory available");
+    }
+    decodedPages [physAddr / PAGE_SIZE] = page;
+  }
+  d = & page [(physAddr % PAGE_SIZE) / 4];
+  if (d->valid) {
+    if (frameFlags [physAddr / PAGE_SIZE] & FRAME_DISK_BUSY) {
+      checkDiskBufferError (physAddr);
+    }
+  } else {
+    decodeInstruction (d, getPhysicalWord (physAddr));
+  }
+  return d;
+}
 
 
 
-/* physicalAddressOk (addr)
+/* decodeInstruction (d, instr)
 **
-** This routine is passed a physical memory address.  It returns TRUE
-** if this is a legal physical memory address, i.e., if no "Address
-** Exception" should be thrown.  The address may be in the memory mapped
-** area; this is still considered OK.
+** This routine is passed an instruction word.  It extracts the op-code,
+** the register fields, and the sign-extended immediate fields and stores
+** them into the DecodedInstruction pointed to by "d".
 */
-int physicalAddressOk (int addr) {
-  return ((0 <= addr ) && (addr < MEMORY_SIZE));
+void decodeInstruction (DecodedInstruction * d, int instr) {
+  d->instr = instr;
+  d->opcode = (instr >> 24) & 0x000000ff;
+  d->ra = (instr >> 16) & 0x0000000f;
+  d->rb = (instr >> 12) & 0x0000000f;
+  d->rc = (instr >> 20) & 0x0000000f;
+  d->data16 = getData16 (instr);
+  d->data24 = getData24 (instr);
+  d->endsBlock = endsBasicBlock (d->opcode);
+  d->valid = 1;
 }
 
 
 
-/* isAligned (addr)
+/* endsBasicBlock (opcode)
 **
-** This function returns TRUE if this address is word aligned.
+** This routine returns TRUE if an instruction with this op-code must be the
+** last instruction in a basic block, i.e., unless it is one of the
+** instructions that always continues with the next instruction and leaves
+** the S, P, and I bits, ptbr, and ptlr unchanged.  (Exceptions are dealt
+** with separately, in runBlock.)
 */
-int isAligned (int addr) {
-  return addr%4 == 0;
+int endsBasicBlock (int opcode) {
+  switch (opcode) {
+    case 96:  case 97:  case 98:  case 99:  case 100: case 101: case 102:
+    case 103: case 104: case 105: case 106: case 115:           /* add ... rem */
+    case 128: case 129: case 130: case 131: case 132: case 133: case 134:
+    case 135: case 136: case 137: case 138: case 149:           /* add ... rem */
+    case 107: case 108: case 109: case 110: case 111: case 112: case 113:
+    case 114:                                                   /* load ... storebv */
+    case 139: case 140: case 141: case 142: case 143: case 144: case 145:
+    case 146:                                                   /* load ... storebv */
+    case 84:  case 85:                                          /* push, pop */
+    case 192: case 193: case 194:                               /* sethi, setlo, ldaddr */
+    case 86:  case 87:  case 88:  case 147: case 148:           /* readu, writeu, tset */
+    case 89:  case 90:  case 91:  case 92:  case 93:  case 94:  /* ftoi ... fabs */
+    case 116: case 117: case 118: case 119:                     /* fadd ... fdiv */
+    case 120: case 121: case 150: case 151:                     /* fload, fstore */
+      return 0;
+    default:
+      return 1;
+  }
 }
 
 
 
-/* getPhysicalWord (physAddr)
+/* invalidateDecodedWord (physAddr)
 **
-** This routine is passed a physical memory address.  It returns the
-** word stored at that address.  The address is assumed to be OK, i.e.,
-** both aligned and within physical memory.  Therefore, no exceptions
-** are possible.  If the address is in the memory-mapped region, it calls
-** the I/O subsystem.
+** This routine is called whenever a word of memory is modified.  If the
+** word has been decoded as an instruction, the decoded form is discarded.
 */
-int getPhysicalWord (int physAddr) {
-  intptr_t implAddr;
-  if (!physicalAddressOk (physAddr)) {
-    fatalError ("PROGRAM LOGIC ERROR: Invalid address in getPhysicalWord");
-  }
-  if (physAddr % 4 != 0) {
-    fatalError ("PROGRAM LOGIC ERROR: Unaligned address in getPhysicalWord");
+void invalidateDecodedWord (int physAddr) {
+  DecodedInstruction * page = decodedPages [physAddr / PAGE_SIZE];
+  if (page != NULL) {
+    page [(physAddr % PAGE_SIZE) / 4].valid = 0;
   }
-  checkDiskBufferError (physAddr);
-  if (inMemoryMappedArea (physAddr)) {
-    return getMemoryMappedWord (physAddr);
-  } else {
-    implAddr = ((intptr_t) memory) + physAddr;
-    return SWAP_BYTES (* (int *) implAddr);
+}
+
+
+
+/* invalidateDecodedRange (low, high)
+**
+** This routine is called when the memory from "low" up to (but not including)
+** "high" is modified other than by a store instruction, e.g., by a disk read.
+** The decoded instructions for every page frame in this range are discarded.
+*/
+void invalidateDecodedRange (int low, int high) {
+  int frame;
+  for (frame = low / PAGE_SIZE;
+       frame <= (high - 1) / PAGE_SIZE && frame < numberOfDecodedPages;
+       frame++) {
+    if (decodedPages [frame] != NULL) {
+      free (decodedPages [frame]);
+      decodedPages [frame] = NULL;
+    }
   }
 }
 
 
 
-/* getPhysicalWordAndLock (physAddr)
+/* resetDecodedInstructions ()
 **
-** Acquire a lock on this word and then get the word from memory.
+** This routine discards the entire decoded instruction cache and allocates
+** an empty table, with one entry for each page frame in physical memory.
+** It is called whenever memory is (re-)allocated.
 */
-int getPhysicalWordAndLock (int physAddr) {
-  if (currentMemoryLock != -1) {
-    fatalError ("PROGRAM LOGIC ERROR: In getPhysicalWordAndLock - lock is not clear");
+void resetDecodedInstructions () {
+  int frame;
+  if (decodedPages != NULL) {
+    for (frame = 0; frame < numberOfDecodedPages; frame++) {
+      if (decodedPages [frame] != NULL) {
+        free (decodedPages [frame]);
+      }
+    }
+    free (decodedPages);
+  }
+  numberOfDecodedPages = (MEMORY_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+  decodedPages = (DecodedInstruction **) calloc (numberOfDecodedPages,
+                                                 sizeof (DecodedInstruction *));
+  if (decodedPages == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
   }
-  currentMemoryLock = physAddr;
-  return getPhysicalWord (physAddr);
 }
 
 
 
-/* putPhysicalWord (physAddr, value)
+/* resetFrameFlags ()
 **
-** This routine is passed a physical memory address.  It stores the word
-** "value" at that address.  The address is assumed to be OK, i.e.,
-** both aligned and within physical memory.  Therefore, no exceptions
-** are possible.  If the address is in the memory-mapped region, it calls
-** the I/O subsystem.
+** This routine allocates the frameFlags array, with one entry for each page
+** frame in physical memory, and marks the frames that overlap the
+** memory-mapped area.  It is called whenever memory is (re-)allocated.
 */
-void putPhysicalWord (int physAddr, int value) {
-  intptr_t implAddr;
-  if (!physicalAddressOk (physAddr)) {
-    fatalError ("PROGRAM LOGIC ERROR: Invalid address in putPhysicalWord");
+void resetFrameFlags () {
+  int frame;
+  if (frameFlags != NULL) {
+    free (frameFlags);
   }
-  if (physAddr % 4 != 0) {
-    fatalError ("PROGRAM LOGIC ERROR: Unaligned address in putPhysicalWord");
+  numberOfFrames = (MEMORY_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+  frameFlags = (char *) calloc (numberOfFrames, sizeof (char));
+  if (frameFlags == NULL) {
+    fatalError ("Calloc failed - insufficient memory available");
   }
-  checkDiskBufferError (physAddr);
-  if (inMemoryMappedArea (physAddr)) {
-    putMemoryMappedWord (physAddr, value);
-  } else {
-    implAddr = ((intptr_t) memory) + physAddr;
-    * (int *) implAddr = SWAP_BYTES (value);
+  for (frame = MEMORY_MAPPED_AREA_LOW / PAGE_SIZE;
+       frame <= MEMORY_MAPPED_AREA_HIGH / PAGE_SIZE && frame < numberOfFrames;
+       frame++) {
+    frameFlags [frame] |= FRAME_MEMORY_MAPPED;
   }
+  diskBusyFrameLow = 0;
+  diskBusyFrameHigh = 0;
+  updateDiskBusyFrames ();
 }
 
 
 
-/* putPhysicalWordAndRelease (physAddr, value)
+/* updateDiskBusyFrames ()
 **
-** This routine writes a word to memory and then releases the lock.
+** This routine must be called whenever "currentDiskStatus", "diskBufferLow"
+** or "diskBufferHigh" changes.  It clears FRAME_DISK_BUSY from the frames that
+** were marked and, if the disk is busy, marks the frames that overlap the
+** buffer.  (Those parts of the buffer outside of physical memory are ignored,
+** since getPhysicalWord and putPhysicalWord will never see them.)
 */
-void putPhysicalWordAndRelease (int physAddr, int value) {
-  if (currentMemoryLock != physAddr) {
-    fatalError ("PROGRAM LOGIC ERROR: In putPhysicalWordAndRelease - lock is not held for this address");
+void updateDiskBusyFrames () {
+  int frame, low, high;
+  if (frameFlags == NULL) {
+    return;
+  }
+  for (frame = diskBusyFrameLow; frame < diskBusyFrameHigh; frame++) {
+    frameFlags [frame] &= ~FRAME_DISK_BUSY;
+  }
+  diskBusyFrameLow = 0;
+  diskBusyFrameHigh = 0;
+  if (currentDiskStatus != DISK_BUSY) {
+    return;
+  }
+  low = diskBufferLow;
+  high = diskBufferHigh;
+  if (low < 0) {
+    low = 0;
+  }
+  if (high > MEMORY_SIZE) {
+    high = MEMORY_SIZE;
+  }
+  if (low >= high) {
+    return;
+  }
+  diskBusyFrameLow = low / PAGE_SIZE;
+  diskBusyFrameHigh = (high - 1) / PAGE_SIZE + 1;
+  for (frame = diskBusyFrameLow; frame < diskBusyFrameHigh; frame++) {
+    frameFlags [frame] |= FRAME_DISK_BUSY;
   }
-  currentMemoryLock = -1;
-  putPhysicalWord (physAddr, value);
 }
 
 
 
-/* releaseMemoryLock (physAddr)
+/* flushTLB ()
 **
-** This routine releases the lock on this memory location.
+** This routine invalidates every entry in the TLB of every CPU.  It is called
+** whenever ptbr or ptlr is changed and whenever the page table may have been
+** altered other than by a store instruction.
 */
-void releaseMemoryLock (int physAddr) {
-  if (currentMemoryLock != physAddr) {
-    fatalError ("PROGRAM LOGIC ERROR: In releaseMemoryLock - Lock not held on this address");
+void flushTLB () {
+  int i, c;
+  for (c = 0; c < numberOfCpus; c++) {
+    for (i = 0; i < TLB_SIZE; i++) {
+      cpus [c].tlb [i].valid = 0;
+    }
   }
-  currentMemoryLock = -1;
+  tlbGeneration++;
 }
 
 
 
-/* inMemoryMappedArea (addr)
+/* invalidateTLBEntry (tableEntryAddr)
 **
-** This routine is passed a physical address.  It returns true if
-** this address is the range of memory-mapped bytes.
+** This routine is called whenever a word within the current page table is
+** modified.  If the TLB holds a copy of this page table entry, the copy is
+** invalidated.
 */
-int inMemoryMappedArea (int addr) {
-  return (addr >= MEMORY_MAPPED_AREA_LOW) && (addr <= MEMORY_MAPPED_AREA_HIGH);
+void invalidateTLBEntry (int tableEntryAddr) {
+  TLBEntry * tlbEntry;
+  tlbEntry = & tlb [((tableEntryAddr - ptbr) >> 2) & (TLB_SIZE - 1)];
+  if (tlbEntry->tableEntryAddr == tableEntryAddr) {
+    tlbEntry->valid = 0;
+  }
+  tlbGeneration++;
 }
 
 
@@ -7275,6 +11993,7 @@ int inMemoryMappedArea (int addr) {
 */
 int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
   int tableIndex, tableEntryAddr, tableEntry, frameNumber, offset, physAddr;
+  TLBEntry * tlbEntry;
 
   translateCausedException = 0;
   if (wantPrinting) {
@@ -7312,6 +12031,9 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
       return 0;
     }
     /* Return the virtual address as the physical address. */
+    if (watchingAccesses && doUpdates) {
+      memoryAccess (virtAddr, virtAddr, reading);
+    }
     return virtAddr;
 
   /* If paging is turned on... */
@@ -7336,6 +12058,25 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
       return 0;
     }
 
+    /* See if the TLB holds this page table entry.  We can skip the walk
+       if it does, provided no R or D bit would be changed (for a write,
+       both W and D must be set) and the entry is not in a frame needing
+       special handling, such as a buffer involved in a disk operation. */
+    tlbEntry = & tlb [(virtAddr >> 13) & (TLB_SIZE - 1)];
+    if (tlbEntry->valid &&
+        tlbEntry->page == tableIndex &&
+        !wantPrinting &&
+        (reading || (tlbEntry->tableEntry & 0x0000000a) == 0x0000000a) &&
+        frameFlags [tlbEntry->tableEntryAddr / PAGE_SIZE] == 0) {
+      tlbHits += doUpdates;
+      physAddr = (tlbEntry->tableEntry & 0xffffe000) | offset;
+      if (watchingAccesses && doUpdates) {
+        memoryAccess (virtAddr, physAddr, reading);
+      }
+      return physAddr;
+    }
+    pageTableWalks += doUpdates;
+
     /* Determine which page table entry we will be accessing. */
     tableIndex = tableIndex >> 11;
     tableEntryAddr = ptbr + tableIndex;
@@ -7357,6 +12098,7 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
       if (doUpdates) {
         interruptsSignaled |= PAGE_INVALID_EXCEPTION;
         pageInvalidOffendingAddress = virtAddr;
+        pageInvalidExceptions++;
       }
       return 0;
     }
@@ -7411,6 +12153,7 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
       if (doUpdates) {
         interruptsSignaled |= PAGE_INVALID_EXCEPTION;
         pageInvalidOffendingAddress = virtAddr;
+        pageInvalidExceptions++;
       }
       releaseMemoryLock (tableEntryAddr);
       return 0;
@@ -7428,6 +12171,7 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
         if (doUpdates) {
           interruptsSignaled |= PAGE_READONLY_EXCEPTION;
           pageReadonlyOffendingAddress = virtAddr;
+          pageReadonlyExceptions++;
         }
         releaseMemoryLock (tableEntryAddr);
         return 0;
@@ -7465,9 +12209,17 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
       return 0;
     }
 
-    /* If we are supposed to update the page table, then update it. */
+    /* If we are supposed to update the page table, then update it.  The
+       entry in memory is now current, so remember it in the TLB, as long
+       as every address in the frame is within physical memory. */
     if (doUpdates) {
       putPhysicalWordAndRelease (tableEntryAddr, tableEntry);
+      if (physicalAddressOk (frameNumber + PAGE_SIZE - 1)) {
+        tlbEntry->valid = 1;
+        tlbEntry->page = virtAddr & 0x00ffe000;
+        tlbEntry->tableEntryAddr = tableEntryAddr;
+        tlbEntry->tableEntry = tableEntry;
+      }
     } else {
       releaseMemoryLock (tableEntryAddr);
     }
@@ -7482,6 +12234,9 @@ int translate (int virtAddr, int reading, int wantPrinting, int doUpdates) {
     }
 
     /* Return the physical address. */
+    if (watchingAccesses && doUpdates) {
+      memoryAccess (virtAddr, physAddr, reading);
+    }
     return physAddr;
   }
 }
@@ -7496,6 +12251,9 @@ int getMemoryMappedWord (int physAddr) {
 
   /* Terminal status word... */
   if (physAddr == SERIAL_STATUS_WORD_ADDRESS) {
+    if (SERIAL_FIFO_DEPTH > 0) {
+      return getSerialFifoStatus ();
+    }
     x = 0;
     if (termInCharAvail) {
       x = x | 0x00000001;
@@ -7507,6 +12265,12 @@ int getMemoryMappedWord (int physAddr) {
 
   /* Terminal input buffer... */
   } else if (physAddr == SERIAL_DATA_WORD_ADDRESS) {
+    if (SERIAL_FIFO_DEPTH > 0) {
+      return readReceiveFifo ();
+    }
+    if (termInCharAvail) {
+      serialCharsIn++;
+    }
     termInCharWasUsed = 1;
     termInCharAvail = 0;
     return termInChar;
@@ -7527,10 +12291,30 @@ int getMemoryMappedWord (int physAddr) {
   } else if (physAddr == DISK_SECTOR_COUNT_REGISTER) {
     return diskSectorCountRegister;
 
+  /* Performance counter device... */
+  } else if ((physAddr >= PERF_COUNTER_ADDRESS) &&
+             (physAddr < PERF_COUNTER_ADDRESS + PERF_COUNTER_BYTES)) {
+    return getPerfCounterWord (physAddr - PERF_COUNTER_ADDRESS);
+
+  /* CPU device... */
+  } else if ((physAddr >= CPU_DEVICE_ADDRESS) &&
+             (physAddr < CPU_DEVICE_ADDRESS + CPU_DEVICE_BYTES)) {
+    return getCpuDeviceWord (physAddr - CPU_DEVICE_ADDRESS);
+
+  /* DMA disk controller... */
+  } else if ((physAddr >= DMA_CONTROLLER_ADDRESS) &&
+             (physAddr < DMA_CONTROLLER_ADDRESS + DMA_CONTROLLER_BYTES)) {
+    return getDmaControllerWord (physAddr - DMA_CONTROLLER_ADDRESS);
+
+  /* Timer device... */
+  } else if ((physAddr >= TIMER_DEVICE_ADDRESS) &&
+             (physAddr < TIMER_DEVICE_ADDRESS + TIMER_DEVICE_BYTES)) {
+    return getTimerDeviceWord (physAddr - TIMER_DEVICE_ADDRESS);
+
   /* All other words in the memory-mapped I/O region... */
   } else {
     fprintf (stderr, "\n\rERROR: Attempt to access undefined address in memory-mapped area\n\r");
-    controlCPressed = 1;
+    suspendExecution ();
   }
 }
 
@@ -7541,11 +12325,12 @@ int getMemoryMappedWord (int physAddr) {
 */
 void putMemoryMappedWord (int physAddr, int value) {
   int x;
+  long long time;
 
   /* Terminal status word... */
   if (physAddr == SERIAL_STATUS_WORD_ADDRESS) {
     fprintf (stderr, "\n\rAttempt to write to the SERIAL_STATUS_WORD in the memory-mapped area\n\r");
-    controlCPressed = 1;
+    suspendExecution ();
     return;
 
   /* Terminal output buffer... */
@@ -7554,27 +12339,31 @@ void putMemoryMappedWord (int physAddr, int value) {
     if (!termOutputReady) {
       fprintf (stderr, "\n\rERROR: Serial device output overrun; char \"%c\" was lost\n\r",
                x);
-      controlCPressed = 1;
+      suspendExecution ();
       return;
     }
     /***  fprintf (termOutputFile, "OUTPUT >>>%c<<<\n\r", x);  ***/
     fprintf (termOutputFile, "%c", x);
+    serialCharsOut++;
+    if (SERIAL_FIFO_DEPTH > 0) {
+      writeTransmitFifo ();
+      return;
+    }
     fflush (termOutputFile);
     termOutputReady = 0;
-    timeOfNextSerialOutEvent =
-         randomBetween (
-            currentTime + TERM_OUT_DELAY,
-            currentTime + TERM_OUT_DELAY + TERM_OUT_DELAY_VARIATION);
-    if (timeOfNextSerialOutEvent <= currentTime) {
-      timeOfNextSerialOutEvent = currentTime + 1;
+    time = currentTime +
+           randomBetween (TERM_OUT_DELAY,
+                          TERM_OUT_DELAY + TERM_OUT_DELAY_VARIATION);
+    if (time <= currentTime) {
+      time = currentTime + 1;
     }
-    updateTimeOfNextEvent ();
+    scheduleEvent (& serialOutEvent, time);
 
   /* DISK_COMMAND_WORD_ADDRESS... */
   } else if (physAddr == DISK_COMMAND_WORD_ADDRESS) {
     if (currentDiskStatus == DISK_BUSY) {
       fprintf (stderr, "\n\rERROR: Attempt to write to DISK_COMMAND_WORD while disk is busy!\n\r");
-      controlCPressed = 1;
+      suspendExecution ();
       return;
     } else {
       performDiskIO (value);
@@ -7584,7 +12373,7 @@ void putMemoryMappedWord (int physAddr, int value) {
   } else if (physAddr == DISK_MEMORY_ADDRESS_REGISTER) {
     if (currentDiskStatus == DISK_BUSY) {
       fprintf (stderr, "\n\rERROR: Attempt to write to DISK_MEMORY_ADDRESS_REGISTER while disk is busy!\n\r");
-      controlCPressed = 1;
+      suspendExecution ();
       return;
     } else {
       diskMemoryAddressRegister = value;
@@ -7594,7 +12383,7 @@ void putMemoryMappedWord (int physAddr, int value) {
   } else if (physAddr == DISK_SECTOR_NUMBER_REGISTER) {
     if (currentDiskStatus == DISK_BUSY) {
       fprintf (stderr, "\n\rERROR: Attempt to write to DISK_SECTOR_NUMBER_REGISTER while disk is busy!\n\r");
-      controlCPressed = 1;
+      suspendExecution ();
       return;
     } else {
       diskSectorNumberRegister = value;
@@ -7604,16 +12393,36 @@ void putMemoryMappedWord (int physAddr, int value) {
   } else if (physAddr == DISK_SECTOR_COUNT_REGISTER) {
     if (currentDiskStatus == DISK_BUSY) {
       fprintf (stderr, "\n\rERROR: Attempt to write to DISK_SECTOR_COUNT_REGISTER while disk is busy!\n\r");
-      controlCPressed = 1;
+      suspendExecution ();
       return;
     } else {
       diskSectorCountRegister = value;
     }
 
+  /* Performance counter device... */
+  } else if ((physAddr >= PERF_COUNTER_ADDRESS) &&
+             (physAddr < PERF_COUNTER_ADDRESS + PERF_COUNTER_BYTES)) {
+    putPerfCounterWord (physAddr - PERF_COUNTER_ADDRESS, value);
+
+  /* CPU device... */
+  } else if ((physAddr >= CPU_DEVICE_ADDRESS) &&
+             (physAddr < CPU_DEVICE_ADDRESS + CPU_DEVICE_BYTES)) {
+    putCpuDeviceWord (physAddr - CPU_DEVICE_ADDRESS, value);
+
+  /* DMA disk controller... */
+  } else if ((physAddr >= DMA_CONTROLLER_ADDRESS) &&
+             (physAddr < DMA_CONTROLLER_ADDRESS + DMA_CONTROLLER_BYTES)) {
+    putDmaControllerWord (physAddr - DMA_CONTROLLER_ADDRESS, value);
+
+  /* Timer device... */
+  } else if ((physAddr >= TIMER_DEVICE_ADDRESS) &&
+             (physAddr < TIMER_DEVICE_ADDRESS + TIMER_DEVICE_BYTES)) {
+    putTimerDeviceWord (physAddr - TIMER_DEVICE_ADDRESS, value);
+
   /* All other words in the memory-mapped I/O region... */
   } else {
     fprintf (stderr, "\n\rERROR: Attempt to access undefined address in memory-mapped area\n\r");
-    controlCPressed = 1;
+    suspendExecution ();
   }
 }
 
@@ -8369,17 +13178,20 @@ void printHexDecimalAscii (int i) {
 
 
 
-/* jumpIfTrueRaRb (cond, instr)
+/* jumpIfTrueRaRb (cond, d)
 **
 ** This routine is used in the implementation of the conditional jumping
 ** instructions.  If the condition is true, it updates pc to effect the
-** jump.  Otherwise, it increments the pc.
+** jump.  Otherwise, it increments the pc.  It is passed the decoded
+** instruction.
 */
-void jumpIfTrueRaRb (int cond, int instr) {
+void jumpIfTrueRaRb (int cond, DecodedInstruction * d) {
   int x, y, z;
+  int * regs;
   if (cond) {
-    x = getRa (instr);
-    y = getRc (instr);
+    regs = statusS ? systemRegisters : userRegisters;
+    x = regs [d->ra];
+    y = regs [d->rc];
     z = x + y;
     if (z % 4 != 0) {
       interruptsSignaled |= ALIGNMENT_EXCEPTION;
@@ -8393,16 +13205,17 @@ void jumpIfTrueRaRb (int cond, int instr) {
 
 
 
-/* jumpIfTrueData24 (cond, instr)
+/* jumpIfTrueData24 (cond, d)
 **
 ** This routine is used in the implementation of the conditional jumping
 ** instructions.  If the condition is true, it updates pc to effect the
-** jump.  Otherwise, it increments the pc.
+** jump.  Otherwise, it increments the pc.  It is passed the decoded
+** instruction.
 */
-void jumpIfTrueData24 (int cond, int instr) {
+void jumpIfTrueData24 (int cond, DecodedInstruction * d) {
   int z;
   if (cond) {
-    z = getData24 (instr);
+    z = d->data24;
     if (z % 4 != 0) {
       interruptsSignaled |= ALIGNMENT_EXCEPTION;
       return;
@@ -8418,10 +13231,10 @@ void jumpIfTrueData24 (int cond, int instr) {
 /* controlC (sig)
 **
 ** This routine is called when the user hits control-C.  It sets
-** "controlCPressed" to TRUE.  In the fetch-increment-execute loop, this
-** variable is checked before each instruction and execution of BLITZ
-** instructions is terminated if it is ever found to be true.  The variable
-** is also reset to false at that time.
+** "controlCPressed" to TRUE (see suspendExecution).  In the
+** fetch-increment-execute loop, this variable is checked and execution of
+** BLITZ instructions is terminated if it is ever found to be true.  The
+** variable is also reset to false at that time.
 **
 ** If "controlCPressed" was already TRUE when this routine is called,
 ** then it must be that control-C has just been pressed twice in a row, with
@@ -8441,12 +13254,27 @@ void controlC (int sig) {
     /* raise (SIGSEGV);  Produce a core dump. */
     errorExit ();
   } else {
-    controlCPressed = 1;
+    suspendExecution ();
   }
 }
 
 
 
+/* suspendExecution ()
+**
+** This routine is called whenever execution must stop before the next
+** instruction: on control-C, on a "debug" instruction, and on any error
+** that returns the user to the emulator command loop.  It sets
+** "controlCPressed" and ends the slice that commandGo is running, so that
+** commandGo need not check "controlCPressed" after every instruction.
+*/
+void suspendExecution () {
+  controlCPressed = 1;
+  instructionsLeftInSlice = 0;
+}
+
+
+
 /* randomBetween (lo, high)
 **
 ** This routine returns the next random number between the given numbers,
@@ -8496,24 +13324,144 @@ int genRandom () {
 ** interrupt and schedule another timer event in the future.
 */
 void doTimerEvent () {
+  int c;
+
+  /* Schedule the next timer event. */
+  if ((TIME_SLICE <= 0) || timerTickDisabled) {
+    scheduleEvent (& timerEvent, MAX_TIME);
+  } else {
+    scheduleTimerTick ();
+    /* Signal a timer interrupt, on every CPU that has been started. */
+    signalCpu (0, TIMER_INTERRUPT);
+    for (c = 1; c < numberOfCpus; c++) {
+      if (cpus [c].state != CPU_STOPPED) {
+        signalCpu (c, TIMER_INTERRUPT);
+      }
+    }
+  }
+}
+
+
+
+/* scheduleTimerTick ()
+**
+** This routine schedules the next periodic timer event, one time slice
+** from now.
+*/
+void scheduleTimerTick () {
+  long long time;
+  time = currentTime +
+         randomBetween (TIME_SLICE, TIME_SLICE + TIME_SLICE_VARIATION);
+  if (time <= currentTime) {
+    time = currentTime + 1;
+  }
+  scheduleEvent (& timerEvent, time);
+}
+
+
 
-  /* Set the timeOfNextTimerEvent. */
-  if (TIME_SLICE <= 0) {
-    timeOfNextTimerEvent = MAX;
+/* resetTimerDevice ()
+**
+** This routine turns the periodic timer back on and disarms the one-shot
+** timer.  It is called whenever the machine is reset, before the first
+** timer event.
+*/
+void resetTimerDevice () {
+  timerTickDisabled = 0;
+  timerLowWordLatched = 0;
+  timerLatchedLowWord = 0;
+  oneShotCpu = 0;
+  scheduleEvent (& oneShotEvent, MAX_TIME);
+}
+
+
+
+/* getTimerDeviceWord (offset) --> int
+**
+** This routine returns the word of the timer device at the given offset
+** from TIMER_DEVICE_ADDRESS.  Reading the high word of the time latches
+** its low word, which is then returned by the next read of the low word.
+*/
+int getTimerDeviceWord (int offset) {
+  long long remaining;
+  if (offset == TIMER_CONTROL_REGISTER) {
+    return timerTickDisabled ? TIMER_NO_TICK : 0;
+  } else if (offset == TIMER_TIME_HIGH_REGISTER) {
+    timerLowWordLatched = 1;
+    timerLatchedLowWord = (int) currentTime;
+    return (int) (currentTime >> 32);
+  } else if (offset == TIMER_TIME_LOW_REGISTER) {
+    if (timerLowWordLatched) {
+      timerLowWordLatched = 0;
+      return timerLatchedLowWord;
+    }
+    return (int) currentTime;
   } else {
-    timeOfNextTimerEvent =
-         randomBetween (currentTime + TIME_SLICE,
-                        currentTime + TIME_SLICE + TIME_SLICE_VARIATION);
-    if (timeOfNextTimerEvent <= currentTime) {
-      timeOfNextTimerEvent = currentTime + 1;
+    if (oneShotEvent.time == MAX_TIME) {
+      return 0;
+    }
+    remaining = oneShotEvent.time - currentTime;
+    return (remaining > 0x7fffffff) ? 0x7fffffff : (int) remaining;
+  }
+}
+
+
+
+/* putTimerDeviceWord (offset, value)
+**
+** This routine is called when the BLITZ program stores into the timer
+** device, at the given offset from TIMER_DEVICE_ADDRESS.
+*/
+void putTimerDeviceWord (int offset, int value) {
+
+  /* Turn the periodic timer off or on... */
+  if (offset == TIMER_CONTROL_REGISTER) {
+    if (value & ~TIMER_NO_TICK) {
+      fprintf (stderr, "\n\rERROR: Invalid value 0x%08X written to the timer control word\n\r", value);
+      suspendExecution ();
+    } else if (value == TIMER_NO_TICK) {
+      timerTickDisabled = 1;
+      scheduleEvent (& timerEvent, MAX_TIME);
+    } else if (timerTickDisabled) {
+      timerTickDisabled = 0;
+      if (TIME_SLICE > 0) {
+        scheduleTimerTick ();
+      }
     }
-    /* Signal a timer interrupt. */
-    interruptsSignaled |= TIMER_INTERRUPT;
+
+  /* The time may only be read... */
+  } else if ((offset == TIMER_TIME_HIGH_REGISTER) ||
+             (offset == TIMER_TIME_LOW_REGISTER)) {
+    fprintf (stderr, "\n\rERROR: Attempt to write to a read-only timer device register\n\r");
+    suspendExecution ();
+
+  /* Arm or disarm the one-shot timer... */
+  } else if (value < 0) {
+    fprintf (stderr, "\n\rERROR: The one-shot timer delay may not be negative\n\r");
+    suspendExecution ();
+  } else if (value == 0) {
+    scheduleEvent (& oneShotEvent, MAX_TIME);
+  } else {
+    oneShotCpu = currentCpu;
+    scheduleEvent (& oneShotEvent, currentTime + value);
   }
 }
 
 
 
+/* doOneShotEvent ()
+**
+** This routine is called when the one-shot timer goes off.  It signals a
+** TIMER_INTERRUPT on the CPU which armed it, and does not schedule another
+** one-shot event.
+*/
+void doOneShotEvent () {
+  signalCpu (oneShotCpu, TIMER_INTERRUPT);
+  scheduleEvent (& oneShotEvent, MAX_TIME);
+}
+
+
+
 /* doDiskEvent ()
 **
 ** This routine is called when a disk event is due.  It will:
@@ -8523,14 +13471,18 @@ void doTimerEvent () {
 */
 void doDiskEvent () {
 
+  /* Make sure any transfer on the DISK I/O thread is complete. */
+  waitForDiskIO ();
+
   /* Signal a disk interrupt. */
-  interruptsSignaled |= DISK_INTERRUPT;
+  signalCpu (0, DISK_INTERRUPT);
 
   /* Change the disk status to WAITING. */
   currentDiskStatus = futureDiskStatus;
+  updateDiskBusyFrames ();
 
   /* Do not schedule another disk event. */
-  timeOfNextDiskEvent = MAX;
+  scheduleEvent (& diskEvent, MAX_TIME);
 }
 
 
@@ -8541,85 +13493,251 @@ void doDiskEvent () {
 ** the input and see if we have a new character on the input.  If so, we
 ** need to signal a serial interrupt.  Normally, we do not wait for the user
 ** to type something, but if "waitForKeystroke" is true, we will wait for
-** at least one keystroke.
+** at least one keystroke.  (With FIFOs, see fillReceiveFifo.)
 */
 void doSerialInEvent (int waitForKeystroke) {
   int ch;
+  long long time;
 
-  /* If the last character was never used, report it. */
-  if (!termInCharWasUsed) {
-    termInCharWasUsed = 1;
-    if ((termInChar >= ' ') && (termInChar < 0x7f)) {
-      fprintf (stderr, "\n\rERROR: The serial input character \"%c\" was not fetched in a timely way and has been lost!\n\r",
-             termInChar);
-    } else {
-      fprintf (stderr, "\n\rERROR: The serial input character 0x%02X was not fetched in a timely way and has been lost!\n\r",
-             termInChar);
+  /* With FIFOs, move all available input into the receive FIFO. */
+  if (SERIAL_FIFO_DEPTH > 0) {
+    fillReceiveFifo (waitForKeystroke);
+  } else {
+
+    /* If the last character was never used, report it. */
+    if (!termInCharWasUsed) {
+      termInCharWasUsed = 1;
+      if ((termInChar >= ' ') && (termInChar < 0x7f)) {
+        fprintf (stderr, "\n\rERROR: The serial input character \"%c\" was not fetched in a timely way and has been lost!\n\r",
+               termInChar);
+      } else {
+        fprintf (stderr, "\n\rERROR: The serial input character 0x%02X was not fetched in a timely way and has been lost!\n\r",
+               termInChar);
+      }
+      // controlCPressed = 1;
+      /* Check the input again on the next cycle.  (If we came from the
+         event queue, the event has been removed and must be put back.) */
+      if ((serialInEvent.heapIndex < 0) && (serialInEvent.time != MAX_TIME)) {
+        scheduleEvent (& serialInEvent, currentTime + 1);
+      }
+      return;
+    }
+
+    /* See if we have a new key pressed.  If so, signal an interrupt. */
+    ch = checkForInput (waitForKeystroke);
+    if (ch != 0) {
+      termInChar = ch;
+      termInCharWasUsed = 0;
+      termInCharAvail = 1;
+      signalCpu (0, SERIAL_INTERRUPT);
     }
-    // controlCPressed = 1;
+  }
+
+  /* Figure out when to check the keyboard next. */
+  if (serialInEvent.time != MAX_TIME) {
+    time = currentTime +
+           randomBetween (KEYBOARD_WAIT_TIME,
+                          KEYBOARD_WAIT_TIME + KEYBOARD_WAIT_TIME_VARIATION);
+    if (time <= currentTime) {
+      time = currentTime + 1;
+    }
+    scheduleEvent (& serialInEvent, time);
+  }
+
+}
+
+
+
+/* doSerialOutEvent ()
+**
+** This routine is called when a serial outout event is due.  If we are
+** busy sending a character to the terminal, then at this event, we are
+** done and the terminal is once again ready.  Set the terminal output
+** status to "output ready" and signal an interrupt.
+*/
+void doSerialOutEvent () {
+  if (SERIAL_FIFO_DEPTH > 0) {
+    doTransmitFifoEvent ();
     return;
   }
+  if (!termOutputReady) {
+    termOutputReady = 1;
+    signalCpu (0, SERIAL_INTERRUPT);
+  }
+  scheduleEvent (& serialOutEvent, MAX_TIME);
+}
+
+
+
+/* doSerialInEventFromQueue ()
+**
+** This routine is the handler for the serial input event.  When the event
+** comes due, we check the keyboard without waiting for a keystroke.
+*/
+void doSerialInEventFromQueue () {
+  doSerialInEvent (0);
+}
+
+
+
+/* initializeEventQueue ()
+**
+** This routine empties the event queue and registers the events for all
+** devices, in the order in which events due at the same time are handled.
+** None of the events are scheduled.
+*/
+void initializeEventQueue () {
+  numberOfQueuedEvents = 0;
+  numberOfRegisteredEvents = 0;
+  timeOfNextEvent = MAX_TIME;
+  registerEvent (& timerEvent, "timer", doTimerEvent);
+  registerEvent (& diskEvent, "disk", doDiskEvent);
+  registerEvent (& serialInEvent, "serial in", doSerialInEventFromQueue);
+  registerEvent (& serialOutEvent, "serial out", doSerialOutEvent);
+  registerEvent (& dmaEvent, "dma", doDmaEvent);
+  registerEvent (& oneShotEvent, "one-shot timer", doOneShotEvent);
+}
+
+
+
+/* registerEvent (event, name, handler)
+**
+** This routine initializes an Event for a device.  The handler will be
+** called whenever the event comes due.  The event is not scheduled.
+*/
+void registerEvent (Event * event, char * name, void (* handler) ()) {
+  if (numberOfRegisteredEvents >= MAX_NUMBER_OF_EVENTS) {
+    fatalError ("PROGRAM LOGIC ERROR: Too many events registered");
+  }
+  event->time = MAX_TIME;
+  event->priority = numberOfRegisteredEvents++;
+  event->heapIndex = -1;
+  event->handler = handler;
+  event->name = name;
+}
+
 
-  /* See if we have a new key pressed.  If so, signal an interrupt. */
-  ch = checkForInput (waitForKeystroke);
-  if (ch != 0) {
-    termInChar = ch;
-    termInCharWasUsed = 0;
-    termInCharAvail = 1;
-    interruptsSignaled |= SERIAL_INTERRUPT;
+
+/* scheduleEvent (event, time)
+**
+** This routine sets the time at which an event will next come due, adding
+** it to the event queue or moving it within the queue as necessary.  If
+** time is MAX_TIME, the event is removed from the queue.
+*/
+void scheduleEvent (Event * event, long long time) {
+  int i;
+  Event * last;
+  event->time = time;
+  i = event->heapIndex;
+  if (time == MAX_TIME) {
+    /* Remove the event, if queued, by moving the last event into its place. */
+    if (i >= 0) {
+      event->heapIndex = -1;
+      last = eventQueue [--numberOfQueuedEvents];
+      if (last != event) {
+        eventQueue [i] = last;
+        last->heapIndex = i;
+        siftEventUp (i);
+        siftEventDown (last->heapIndex);
+      }
+    }
+  } else if (i < 0) {
+    /* Add the event at the bottom of the heap. */
+    i = numberOfQueuedEvents++;
+    eventQueue [i] = event;
+    event->heapIndex = i;
+    siftEventUp (i);
+  } else {
+    /* The event was already queued; its time has changed. */
+    siftEventUp (i);
+    siftEventDown (event->heapIndex);
+  }
+  if (numberOfQueuedEvents > 0) {
+    timeOfNextEvent = eventQueue [0]->time;
+  } else {
+    timeOfNextEvent = MAX_TIME;
   }
+}
 
-  /* Figure out when to check the keyboard next. */
-  if (timeOfNextSerialInEvent != MAX) {
-    timeOfNextSerialInEvent =
-        randomBetween (
-           currentTime + KEYBOARD_WAIT_TIME,
-           currentTime + KEYBOARD_WAIT_TIME + KEYBOARD_WAIT_TIME_VARIATION);
-    if (timeOfNextSerialInEvent <= currentTime) {
-      timeOfNextSerialInEvent = currentTime + 1;
+
+
+/* processEvents ()
+**
+** This routine is called when "currentTime" has reached "timeOfNextEvent".
+** It removes each event that is due from the queue and calls its handler.
+** Each handler schedules its event in the future (or never), so this
+** loop will terminate.
+*/
+void processEvents () {
+  Event * event;
+  while (currentTime >= timeOfNextEvent) {
+    event = eventQueue [0];
+    /* Remove the event, leaving its time unchanged for the handler. */
+    event->heapIndex = -1;
+    eventQueue [0] = eventQueue [--numberOfQueuedEvents];
+    if (numberOfQueuedEvents > 0) {
+      eventQueue [0]->heapIndex = 0;
+      siftEventDown (0);
+      timeOfNextEvent = eventQueue [0]->time;
+    } else {
+      timeOfNextEvent = MAX_TIME;
     }
+    event->handler ();
   }
-
 }
 
 
 
-/* doSerialOutEvent ()
+/* eventBefore (a, b)
 **
-** This routine is called when a serial outout event is due.  If we are
-** busy sending a character to the terminal, then at this event, we are
-** done and the terminal is once again ready.  Set the terminal output
-** status to "output ready" and signal an interrupt.
+** This routine returns TRUE if event "a" should be handled before event "b".
 */
-void doSerialOutEvent () {
-  if (!termOutputReady) {
-    termOutputReady = 1;
-    interruptsSignaled |= SERIAL_INTERRUPT;
+int eventBefore (Event * a, Event * b) {
+  if (a->time != b->time) {
+    return a->time < b->time;
   }
-  timeOfNextSerialOutEvent = MAX;
+  return a->priority < b->priority;
 }
 
 
 
-/* updateTimeOfNextEvent ()
+/* siftEventUp (i)
+** siftEventDown (i)
 **
-** This routine sets "timeOfNextEvent".  It looks at the times of all of
-** the next scheduled events and uses the minimum of all of these.
+** These routines restore the heap ordering of the event queue after the
+** event at position "i" has been added or changed.
 */
-void updateTimeOfNextEvent () {
-  timeOfNextEvent = MAX;
-  if (timeOfNextEvent > timeOfNextTimerEvent) {
-    timeOfNextEvent = timeOfNextTimerEvent;
-  }
-  if (timeOfNextEvent > timeOfNextDiskEvent) {
-    timeOfNextEvent = timeOfNextDiskEvent;
-  }
-  if (timeOfNextEvent > timeOfNextSerialInEvent) {
-    timeOfNextEvent = timeOfNextSerialInEvent;
+void siftEventUp (int i) {
+  Event * event = eventQueue [i];
+  int parent;
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!eventBefore (event, eventQueue [parent])) break;
+    eventQueue [i] = eventQueue [parent];
+    eventQueue [i]->heapIndex = i;
+    i = parent;
   }
-  if (timeOfNextEvent > timeOfNextSerialOutEvent) {
-    timeOfNextEvent = timeOfNextSerialOutEvent;
+  eventQueue [i] = event;
+  event->heapIndex = i;
+}
+
+void siftEventDown (int i) {
+  Event * event = eventQueue [i];
+  int child;
+  while (1) {
+    child = 2 * i + 1;
+    if (child >= numberOfQueuedEvents) break;
+    if (child + 1 < numberOfQueuedEvents &&
+        eventBefore (eventQueue [child + 1], eventQueue [child])) {
+      child++;
+    }
+    if (!eventBefore (eventQueue [child], event)) break;
+    eventQueue [i] = eventQueue [child];
+    eventQueue [i]->heapIndex = i;
+    i = child;
   }
+  eventQueue [i] = event;
+  event->heapIndex = i;
 }
 
 
@@ -8830,11 +13948,11 @@ char checkForInput (int waitForKeystroke) {
     } else {
       if (waitForKeystroke) {
         printf ("\n\r*****  EOF encountered on input  *****\n\r");
-        controlCPressed = 1;
+        suspendExecution ();
         return 0;
       } else {
         /* No further input is available... */
-        timeOfNextSerialInEvent = MAX;
+        scheduleEvent (& serialInEvent, MAX_TIME);
         return 0;
       }
     }
@@ -8871,7 +13989,7 @@ char checkForInput (int waitForKeystroke) {
   if (termInputFile == stdin) {
     if (ch == 3) {   /* if ch = Control-C... */
       printf ("\n\r*****  Control-C  *****\n\r");  /* raw mode: use \n\r... */
-      controlCPressed = 1;
+      suspendExecution ();
       // printf ("  returning (ch == contgrol-C): \"\\0\"...\n");
       return 0;
     }
@@ -8929,17 +14047,26 @@ void initializeDisk () {
   diskSectorCount = 0;
   diskBufferLow = 0;
   diskBufferHigh = 0;
+  updateDiskBusyFrames ();
   diskMemoryAddressRegister = 0x00000000;
   diskSectorNumberRegister = 0x00000000;
   diskSectorCountRegister = 0x00000000;
 
   /* Close the DISK file if open... */
+  unmapDiskFile ();
   if (diskFile != NULL) {
     fclose (diskFile);
   }
 
-  /* Open the DISK file for updating... */
-  diskFile = fopen (diskFileName, "rb+");
+  /* A library caller may have no DISK attached... */
+  if (diskFileName == NULL) {
+    diskFile = NULL;
+    return;
+  }
+
+  /* Open the DISK file for updating (or, in a -sweep run, for reading
+     only, since changes will go to a private mapping)... */
+  diskFile = fopen (diskFileName, diskCopyOnWrite ? "rb" : "rb+");
   if (diskFile == NULL) {
     fprintf (stderr,
              "Error in DISK File: File \"%s\" could not be opened for updating.  Simulated disk I/O has been disabled!\n",
@@ -9017,6 +14144,11 @@ void initializeDisk () {
     return;
   }
 
+
+  /* Map the DISK file into memory, if requested... */
+  if (commandOptionMmap || diskCopyOnWrite) {
+    mapDiskFile (length);
+  }
 }
 
 
@@ -9032,12 +14164,16 @@ void initializeDisk () {
 ** and the disk status will then change.
 */
 void performDiskIO (int command) {
-  int seekTime, accessTime, futureTime, currentAngle, desiredAngle, angleChange, transferTime;
+  int seekTime, accessTime, currentAngle, desiredAngle, angleChange, transferTime;
+  long long futureTime;
+
+  /* Finish any earlier transfer before looking at the DISK registers... */
+  waitForDiskIO ();
 
   /* Make sure the DISK is working... */
   if (diskFile == NULL) {
     fprintf (stderr, "\n\rERROR:  A store into the DISK_COMMAND_WORD has occurred, but the DISK is currently disabled.  (See the \"format\" command.)\n\r");
-    controlCPressed = 1;
+    suspendExecution ();
     return;
   }
 
@@ -9048,23 +14184,23 @@ void performDiskIO (int command) {
     // fprintf (stderr, "\n\rNOTE: A disk write command has been initiated...\n\r");
   }  else {
     currentDiskStatus = DISK_BUSY;
+    updateDiskBusyFrames ();
     futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_5;
-    timeOfNextDiskEvent = currentTime+1;
-    updateTimeOfNextEvent ();
+    scheduleEvent (& diskEvent, currentTime+1);
     fprintf (stderr, "\n\rERROR: The program has stored an invalid command into the DISK_COMMAND_WORD.  An interrupt will occur when you proceed!\n\r");
-    controlCPressed = 1;
+    suspendExecution ();
     return;
   }
 
   currentDiskStatus = DISK_BUSY;
+  updateDiskBusyFrames ();
 
   /* Check for ERROR 1... */
   if (diskMemoryAddressRegister % PAGE_SIZE != 0) {
     fprintf (stderr, "\n\rDISK ERROR: The DISK_MEMORY_ADDRESS_REGISTER is not page-aligned.  An interrupt will occur when you proceed!\n\r");
     futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_1;
-    timeOfNextDiskEvent = currentTime+1;
-    updateTimeOfNextEvent ();
-    controlCPressed = 1;
+    scheduleEvent (& diskEvent, currentTime+1);
+    suspendExecution ();
     return;
   }
 
@@ -9072,15 +14208,15 @@ void performDiskIO (int command) {
   if (diskSectorCountRegister <= 0) {
     fprintf (stderr, "\n\rDISK ERROR: The DISK_SECTOR_COUNT_REGISTER is not positive.  An interrupt will occur when you proceed!\n\r");
     futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_1;
-    timeOfNextDiskEvent = currentTime+1;
-    updateTimeOfNextEvent ();
-    controlCPressed = 1;
+    scheduleEvent (& diskEvent, currentTime+1);
+    suspendExecution ();
     return;
   }
 
   /* Compute the area of memory affected... */
   diskBufferLow = diskMemoryAddressRegister;
   diskBufferHigh = diskBufferLow + (diskSectorCountRegister * PAGE_SIZE);
+  updateDiskBusyFrames ();
 
   /* Make sure the memory buffer is in physical memory... */
   if (!physicalAddressOk (diskBufferLow) ||
@@ -9089,9 +14225,8 @@ void performDiskIO (int command) {
       inMemoryMappedArea (diskBufferHigh-1)) {
     fprintf (stderr, "\n\rDISK ERROR: The memory buffer is not all in physical memory or is in the memory-mapped region.  An interrupt will occur when you proceed!\n\r");
     futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_2;
-    timeOfNextDiskEvent = currentTime+1;
-    updateTimeOfNextEvent ();
-    controlCPressed = 1;
+    scheduleEvent (& diskEvent, currentTime+1);
+    suspendExecution ();
     return;
   }
 
@@ -9100,9 +14235,8 @@ void performDiskIO (int command) {
       (diskSectorNumberRegister + diskSectorCountRegister > diskSectorCount)) {
     fprintf (stderr, "\n\rDISK ERROR: Attempting to read sectors that do not exist on the disk.  An interrupt will occur when you proceed!\n\r");
     futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_3;
-    timeOfNextDiskEvent = currentTime+1;
-    updateTimeOfNextEvent ();
-    controlCPressed = 1;
+    scheduleEvent (& diskEvent, currentTime+1);
+    suspendExecution ();
     return;
   }
 
@@ -9112,11 +14246,10 @@ void performDiskIO (int command) {
       if (1 == randomBetween (1, DISK_READ_ERROR_PROBABILITY)) {
         /***
         fprintf (stderr, "\n\rDISK ERROR: A random disk read error will be simulated at this time.  An interrupt will occur when you proceed!\n\r");
-        controlCPressed = 1;
+        suspendExecution ();
         ***/
         futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_4;
-        timeOfNextDiskEvent = currentTime+1;
-        updateTimeOfNextEvent ();
+        scheduleEvent (& diskEvent, currentTime+1);
         return;
       }
     }
@@ -9125,11 +14258,10 @@ void performDiskIO (int command) {
       if (1 == randomBetween (1, DISK_WRITE_ERROR_PROBABILITY)) {
         /***
         fprintf (stderr, "\n\rDISK ERROR: A random disk write error will be simulated at this time.  An interrupt will occur when you proceed!\n\r");
-        controlCPressed = 1;
+        suspendExecution ();
         ***/
         futureDiskStatus = OPERATION_COMPLETED_WITH_ERROR_4;
-        timeOfNextDiskEvent = currentTime+1;
-        updateTimeOfNextEvent ();
+        scheduleEvent (& diskEvent, currentTime+1);
         return;
       }
     }
@@ -9151,9 +14283,9 @@ void performDiskIO (int command) {
     accessTime = accessTime + DISK_SETTLE_TIME;
   }
   // printf ("    Access time = %d\n", accessTime);
-  // printf ("    Current time before seek,settle = %d\n", currentTime);
+  // printf ("    Current time before seek,settle = %lld\n", currentTime);
   futureTime = currentTime + accessTime;
-  // printf ("    Time after seek,settle = %d\n", futureTime);
+  // printf ("    Time after seek,settle = %lld\n", futureTime);
   currentAngle = (futureTime / DISK_ROTATIONAL_DELAY) % SECTORS_PER_TRACK; 
   // printf ("    Rotational Angle (0..15) at that time = %d\n", currentAngle);
   desiredAngle = diskSectorNumberRegister % SECTORS_PER_TRACK;
@@ -9162,75 +14294,785 @@ void performDiskIO (int command) {
   if (angleChange < 0) {
     angleChange = angleChange + SECTORS_PER_TRACK;
   }
-  // printf ("    Angle Change (0..15) = %d\n", angleChange);
-  futureTime = futureTime + angleChange * DISK_ROTATIONAL_DELAY;
-  // printf ("    Time after seek,settle,rotate = %d\n", futureTime);
-  // printf ("    Number of sectors transfered = %d\n", diskSectorCountRegister);
-  transferTime = diskSectorCountRegister * DISK_ROTATIONAL_DELAY;
-  // printf ("    Transfer time = %d\n", transferTime);
-  futureTime = futureTime + transferTime;
-  // printf ("    Time after seek,settle,rotate,transfer = %d\n", futureTime);
-  futureTime = randomBetween (futureTime, futureTime + DISK_ACCESS_VARIATION);
-  // printf ("    Time after seek,settle,rotate,transfer,random = %d\n", futureTime);
+  // printf ("    Angle Change (0..15) = %d\n", angleChange);
+  futureTime = futureTime + angleChange * DISK_ROTATIONAL_DELAY;
+  // printf ("    Time after seek,settle,rotate = %lld\n", futureTime);
+  // printf ("    Number of sectors transfered = %d\n", diskSectorCountRegister);
+  transferTime = diskSectorCountRegister * DISK_ROTATIONAL_DELAY;
+  // printf ("    Transfer time = %d\n", transferTime);
+  futureTime = futureTime + transferTime;
+  // printf ("    Time after seek,settle,rotate,transfer = %lld\n", futureTime);
+  futureTime = futureTime + randomBetween (0, DISK_ACCESS_VARIATION);
+  // printf ("    Time after seek,settle,rotate,transfer,random = %lld\n", futureTime);
+
+  // Set up the next disk event, based on the computed time of completion...
+  if (futureTime <= currentTime) {
+    scheduleEvent (& diskEvent, currentTime + 1);
+  } else {
+    scheduleEvent (& diskEvent, futureTime);
+  }
+
+  /* Set the new Current Disk Position... */
+  currentDiskSector = diskSectorNumberRegister + diskSectorCountRegister;
+
+  diskLatencyTotal += diskEvent.time - currentTime;
+  if (command == DISK_READ_COMMAND) {
+    numberOfDiskReads++;
+    diskSectorsRead += diskSectorCountRegister;
+    /* Discard any decoded instructions and TLB entries, since the
+       buffer may hold code or page tables, which will be overwritten... */
+    invalidateDecodedRange (diskBufferLow, diskBufferHigh);
+    flushTLB ();
+  } else {
+    numberOfDiskWrites++;
+    diskSectorsWritten += diskSectorCountRegister;
+  }
+
+  /* Move the data, now or on the DISK I/O thread... */
+  diskTransferCommand = command;
+  diskTransferSector = diskSectorNumberRegister;
+  diskTransferCount = diskSectorCountRegister;
+  diskTransferLow = diskBufferLow;
+  diskTransferHigh = diskBufferHigh;
+  if (commandOptionAsync) {
+    startDiskTransfer ();
+  } else {
+    reportDiskTransferError (transferDiskSectors ());
+  }
+}
+
+
+
+/* transferDiskSectors ()  --> DISK_TRANSFER_OK, ..._SEEK_ERROR, etc.
+**
+** This routine moves the sectors described by the diskTransfer... variables
+** between "memory" and the DISK file.  It may be run on the DISK I/O thread,
+** so it prints nothing and touches nothing but the buffer and the file.
+** If there is a problem, it saves errno in "diskTransferErrno".
+*/
+int transferDiskSectors () {
+  size_t offset, length;
+  offset = 4 + (size_t) diskTransferSector * PAGE_SIZE;
+  length = (size_t) diskTransferCount * PAGE_SIZE;
+
+  /* If the DISK file is mapped, just copy N sectors of data... */
+  if (diskMapping != NULL) {
+    if (diskTransferCommand == DISK_READ_COMMAND) {
+      memcpy (memory + diskTransferLow, diskMapping + offset, length);
+      swapMemoryWords (diskTransferLow, diskTransferHigh);
+    } else {
+      swapMemoryWords (diskTransferLow, diskTransferHigh);
+      memcpy (diskMapping + offset, memory + diskTransferLow, length);
+      swapMemoryWords (diskTransferLow, diskTransferHigh);
+      diskWritesSinceSync++;
+      if (commandOptionMsync > 0 && diskWritesSinceSync >= commandOptionMsync) {
+        diskTransferErrno = flushDiskMapping ();
+        if (diskTransferErrno) {
+          return DISK_TRANSFER_SYNC_ERROR;
+        }
+      }
+    }
+    return DISK_TRANSFER_OK;
+  }
+
+  /* Seek to the proper location in the file... */
+  errno = 0;
+  if (fseek (diskFile, (long) offset, SEEK_SET)) {
+    diskTransferErrno = errno;
+    return DISK_TRANSFER_SEEK_ERROR;
+  }
+
+  if (diskTransferCommand == DISK_READ_COMMAND) {
+
+    /* Read in N sectors of data... */
+    errno = 0;
+    fread ( (void *) (((intptr_t) memory) + diskTransferLow),
+            PAGE_SIZE, diskTransferCount, diskFile );
+    swapMemoryWords (diskTransferLow, diskTransferHigh);
+    if (errno) {
+      diskTransferErrno = errno;
+      return DISK_TRANSFER_READ_ERROR;
+    }
+
+  } else {
+
+    /* Write in N sectors of data... */
+    errno = 0;
+    swapMemoryWords (diskTransferLow, diskTransferHigh);
+    fwrite ( (void *) (((intptr_t) memory) + diskTransferLow),
+            PAGE_SIZE, diskTransferCount, diskFile );
+    swapMemoryWords (diskTransferLow, diskTransferHigh);
+    if (errno) {
+      diskTransferErrno = errno;
+      return DISK_TRANSFER_WRITE_ERROR;
+    }
+  }
+  return DISK_TRANSFER_OK;
+}
+
+
+
+/* diskThreadMain (arg)
+**
+** This is the body of the DISK I/O thread.
+*/
+void * diskThreadMain (void * arg) {
+  diskTransferResult = transferDiskSectors ();
+  return NULL;
+}
+
+
+
+/* startDiskTransfer ()
+**
+** This routine starts the DISK I/O thread to perform the transfer described
+** by the diskTransfer... variables.  If the thread cannot be created, the
+** transfer is done immediately.
+*/
+void startDiskTransfer () {
+#if defined(_WIN32) || defined(_WIN64)
+  reportDiskTransferError (transferDiskSectors ());
+#else
+  if (pthread_create (& diskThread, NULL, diskThreadMain, NULL)) {
+    reportDiskTransferError (transferDiskSectors ());
+    return;
+  }
+  diskTransferInProgress = 1;
+#endif
+}
+
+
+
+/* waitForDiskIO ()
+**
+** If a transfer is in progress on the DISK I/O thread, this routine waits
+** for it to finish and reports any error.  Otherwise, it does nothing.
+*/
+void waitForDiskIO () {
+#if !defined(_WIN32) && !defined(_WIN64)
+  if (diskTransferInProgress) {
+    pthread_join (diskThread, NULL);
+    diskTransferInProgress = 0;
+    reportDiskTransferError (diskTransferResult);
+  }
+#endif
+}
+
+
+
+/* reportDiskTransferError (result)
+**
+** This routine is passed the result of transferDiskSectors.  If there was
+** a problem, it prints a message, disables the DISK, and halts execution.
+** A failed msync is only reported, just as syncDiskFile would do.
+*/
+void reportDiskTransferError (int result) {
+  if (result == DISK_TRANSFER_OK) {
+    return;
+  } else if (result == DISK_TRANSFER_SYNC_ERROR) {
+    errno = diskTransferErrno;
+    perror ("Error during msync of DISK file");
+    return;
+  } else if (result == DISK_TRANSFER_SEEK_ERROR) {
+    fprintf (stderr, "\n\rError from host OS during DISK read/fseek; Disk I/O has been disabled!\n\r");
+  } else if (result == DISK_TRANSFER_READ_ERROR) {
+    fprintf (stderr, "\n\rError from host OS during DISK read; Disk I/O has been disabled!\n\r");
+  } else {
+    fprintf (stderr, "\n\rError from host OS during DISK write; Disk I/O has been disabled!\n\r");
+  }
+  errno = diskTransferErrno;
+  if (errno) perror ("Host error");
+  fclose (diskFile);
+  diskFile = NULL;
+  suspendExecution ();
+}
+
+
+
+/* resetDmaController ()
+**
+** This routine turns off the DMA disk controller, forgetting any requests.
+** It is called whenever the machine is reset.
+*/
+void resetDmaController () {
+  dmaRequestRing = 0;
+  dmaCompletionRing = 0;
+  dmaRingSize = 0;
+  dmaRequestTail = 0;
+  dmaCompletionHead = 0;
+  dmaRequestHead = 0;
+  dmaCompletionTail = 0;
+  dmaInterruptCount = 0;
+  dmaInterruptDelay = 0;
+  dmaNumberPending = 0;
+  dmaActiveValid = 0;
+  dmaCompletionsSinceInterrupt = 0;
+  dmaInterruptTime = MAX_TIME;
+  scheduleEvent (& dmaEvent, MAX_TIME);
+}
+
+
+
+/* dmaControllerBusy () --> bool
+**
+** This routine returns TRUE if the DMA disk controller is holding any
+** requests which have not yet completed.
+*/
+int dmaControllerBusy () {
+  return dmaActiveValid || (dmaNumberPending > 0);
+}
+
+
+
+/* getDmaControllerWord (offset) --> int
+**
+** This routine returns the word of the DMA disk controller at the given
+** offset from DMA_CONTROLLER_ADDRESS.
+*/
+int getDmaControllerWord (int offset) {
+  switch (offset) {
+    case DMA_REQUEST_RING_REGISTER:
+      return dmaRequestRing;
+    case DMA_COMPLETION_RING_REGISTER:
+      return dmaCompletionRing;
+    case DMA_RING_SIZE_REGISTER:
+      return dmaRingSize;
+    case DMA_REQUEST_TAIL_REGISTER:
+      return dmaRequestTail;
+    case DMA_COMPLETION_HEAD_REGISTER:
+      return dmaCompletionHead;
+    case DMA_REQUEST_HEAD_REGISTER:
+      return dmaRequestHead;
+    case DMA_COMPLETION_TAIL_REGISTER:
+      return dmaCompletionTail;
+    case DMA_INTERRUPT_COUNT_REGISTER:
+      return dmaInterruptCount;
+    default:
+      return dmaInterruptDelay;
+  }
+}
+
+
+
+/* putDmaControllerWord (offset, value)
+**
+** This routine is called when the BLITZ program stores into the DMA disk
+** controller, at the given offset from DMA_CONTROLLER_ADDRESS.
+*/
+void putDmaControllerWord (int offset, int value) {
+  int consumed;
+
+  /* The ring addresses and size... */
+  if ((offset == DMA_REQUEST_RING_REGISTER) ||
+      (offset == DMA_COMPLETION_RING_REGISTER)) {
+    if (dmaRingSize != 0) {
+      fprintf (stderr, "\n\rERROR: A DMA ring address may only be changed while the DMA ring size is zero\n\r");
+      suspendExecution ();
+    } else if (offset == DMA_REQUEST_RING_REGISTER) {
+      dmaRequestRing = value;
+    } else {
+      dmaCompletionRing = value;
+    }
+  } else if (offset == DMA_RING_SIZE_REGISTER) {
+    if (dmaControllerBusy ()) {
+      fprintf (stderr, "\n\rERROR: The DMA ring size may not be changed while the DMA disk controller is busy\n\r");
+      suspendExecution ();
+    } else if ((value < 0) || (value > DMA_MAX_RING_SIZE)) {
+      fprintf (stderr, "\n\rERROR: The DMA ring size must be between 0 and %d\n\r", DMA_MAX_RING_SIZE);
+      suspendExecution ();
+    } else if ((value > 0) &&
+               (!dmaRingOk (dmaRequestRing, value * DMA_REQUEST_BYTES) ||
+                !dmaRingOk (dmaCompletionRing, value * DMA_COMPLETION_BYTES))) {
+      fprintf (stderr, "\n\rERROR: A DMA ring is not word-aligned, is not all in physical memory, or is in the memory-mapped region\n\r");
+      suspendExecution ();
+    } else {
+      dmaRingSize = value;
+      dmaRequestTail = 0;
+      dmaCompletionHead = 0;
+      dmaRequestHead = 0;
+      dmaCompletionTail = 0;
+    }
+
+  /* The indexes, which are moved by the program... */
+  } else if ((offset == DMA_REQUEST_TAIL_REGISTER) ||
+             (offset == DMA_COMPLETION_HEAD_REGISTER)) {
+    if (dmaRingSize == 0) {
+      fprintf (stderr, "\n\rERROR: The DMA disk controller is not enabled (the DMA ring size is zero)\n\r");
+      suspendExecution ();
+    } else if ((value < 0) || (value >= dmaRingSize)) {
+      fprintf (stderr, "\n\rERROR: The DMA ring index %d is not between 0 and %d\n\r", value, dmaRingSize - 1);
+      suspendExecution ();
+    } else if (offset == DMA_REQUEST_TAIL_REGISTER) {
+      dmaRequestTail = value;
+      takeDmaRequests ();
+      startDmaRequest ();
+      checkDmaInterrupt ();
+    } else {
+      consumed = (value - dmaCompletionHead + dmaRingSize) % dmaRingSize;
+      if (consumed > (dmaCompletionTail - dmaCompletionHead + dmaRingSize) % dmaRingSize) {
+        fprintf (stderr, "\n\rERROR: The DMA completion head has been moved past the DMA completion tail\n\r");
+        suspendExecution ();
+        return;
+      }
+      dmaCompletionHead = value;
+      takeDmaRequests ();
+      startDmaRequest ();
+      checkDmaInterrupt ();
+    }
+
+  /* The indexes, which are moved by the controller... */
+  } else if ((offset == DMA_REQUEST_HEAD_REGISTER) ||
+             (offset == DMA_COMPLETION_TAIL_REGISTER)) {
+    fprintf (stderr, "\n\rERROR: Attempt to write to a read-only DMA disk controller register\n\r");
+    suspendExecution ();
+
+  /* The interrupt count and delay... */
+  } else if (value < 0) {
+    fprintf (stderr, "\n\rERROR: The DMA interrupt count and delay may not be negative\n\r");
+    suspendExecution ();
+  } else if (offset == DMA_INTERRUPT_COUNT_REGISTER) {
+    dmaInterruptCount = value;
+  } else {
+    dmaInterruptDelay = value;
+  }
+}
+
+
+
+/* dmaRingOk (addr, bytes) --> bool
+**
+** This routine returns TRUE if a ring of the given size, beginning at
+** "addr", is word-aligned and lies entirely in physical memory, outside of
+** the memory-mapped region.
+*/
+int dmaRingOk (int addr, int bytes) {
+  return (addr % 4 == 0) &&
+         physicalAddressOk (addr) &&
+         physicalAddressOk (addr + bytes - 1) &&
+         !inMemoryMappedArea (addr) &&
+         !inMemoryMappedArea (addr + bytes - 1);
+}
+
+
+
+/* dmaWordBusy (addr) --> bool
+**
+** This routine returns TRUE if the DMA disk controller may not read or write
+** the ring word at "addr" because it is in the memory-mapped region or in
+** the buffer of a DISK operation in progress.  The controller checks this
+** itself, since getPhysicalWord and putPhysicalWord would report it as an
+** error by the BLITZ program.
+*/
+int dmaWordBusy (int addr) {
+  return (frameFlags [addr / PAGE_SIZE] != 0) &&
+         (inMemoryMappedArea (addr) ||
+          ((currentDiskStatus == DISK_BUSY) &&
+           (addr >= diskBufferLow) && (addr < diskBufferHigh)));
+}
+
+
+
+/* takeDmaRequests ()
+**
+** This routine copies new requests from the request ring into dmaPending,
+** as long as there will be room in the completion ring for all of them.
+*/
+void takeDmaRequests () {
+  int unconsumed;
+  if ((dmaRingSize == 0) || (dmaRequestHead == dmaRequestTail)) {
+    return;
+  }
+  if (diskFile == NULL) {
+    fprintf (stderr, "\n\rERROR:  A request has been given to the DMA disk controller, but the DISK is currently disabled.  (See the \"format\" command.)\n\r");
+    suspendExecution ();
+    return;
+  }
+  unconsumed = (dmaCompletionTail - dmaCompletionHead + dmaRingSize) % dmaRingSize;
+  while ((dmaRequestHead != dmaRequestTail) &&
+         (dmaNumberPending + dmaActiveValid + unconsumed < dmaRingSize - 1)) {
+    readDmaRequest (dmaRequestRing + dmaRequestHead * DMA_REQUEST_BYTES,
+                    & dmaPending [dmaNumberPending++]);
+    dmaRequestHead = (dmaRequestHead + 1) % dmaRingSize;
+  }
+}
+
+
+
+/* readDmaRequest (addr, request)
+**
+** This routine copies the request descriptor at "addr" and checks it.  If
+** there is a problem, the request's status is set to the error which will
+** be returned in its completion.
+*/
+void readDmaRequest (int addr, DmaRequest * request) {
+  int i, frame;
+
+  /* Make sure the descriptor may be read... */
+  for (i = 0; i < 4; i++) {
+    if (dmaWordBusy (addr + 4 * i)) {
+      fprintf (stderr, "\n\rDMA DISK ERROR: The request descriptor at 0x%08X is in the buffer of a DISK operation in progress.  It will complete with an error and a tag of 0 when you proceed!\n\r", addr);
+      request->tag = 0;
+      request->status = OPERATION_COMPLETED_WITH_ERROR_2;
+      suspendExecution ();
+      return;
+    }
+  }
+  request->command = getPhysicalWord (addr);
+  request->sector = getPhysicalWord (addr + 4);
+  request->count = getPhysicalWord (addr + 8);
+  request->tag = getPhysicalWord (addr + 12);
+  request->status = OPERATION_COMPLETED_OK;
+
+  /* Make sure the command is legal... */
+  if ((request->command != DISK_READ_COMMAND) &&
+      (request->command != DISK_WRITE_COMMAND)) {
+    fprintf (stderr, "\n\rDMA DISK ERROR: A request with tag 0x%08X has an invalid command.  It will complete with an error when you proceed!\n\r", request->tag);
+    request->status = OPERATION_COMPLETED_WITH_ERROR_5;
+    suspendExecution ();
+    return;
+  }
+
+  /* Make sure the sector count is legal... */
+  if ((request->count <= 0) || (request->count > DMA_MAX_SECTORS)) {
+    fprintf (stderr, "\n\rDMA DISK ERROR: A request with tag 0x%08X has a sector count which is not between 1 and %d.  It will complete with an error when you proceed!\n\r", request->tag, DMA_MAX_SECTORS);
+    request->status = OPERATION_COMPLETED_WITH_ERROR_1;
+    suspendExecution ();
+    return;
+  }
+
+  /* Copy the frames and make sure each is in physical memory... */
+  for (i = 0; i < request->count; i++) {
+    if (dmaWordBusy (addr + 16 + 4 * i)) {
+      fprintf (stderr, "\n\rDMA DISK ERROR: A request with tag 0x%08X has a descriptor in the buffer of a DISK operation in progress.  It will complete with an error when you proceed!\n\r", request->tag);
+      request->status = OPERATION_COMPLETED_WITH_ERROR_2;
+      suspendExecution ();
+      return;
+    }
+    frame = getPhysicalWord (addr + 16 + 4 * i);
+    request->frames [i] = frame;
+    if (frame % PAGE_SIZE != 0) {
+      fprintf (stderr, "\n\rDMA DISK ERROR: A request with tag 0x%08X has a frame which is not page-aligned.  It will complete with an error when you proceed!\n\r", request->tag);
+      request->status = OPERATION_COMPLETED_WITH_ERROR_1;
+      suspendExecution ();
+      return;
+    }
+    if (!physicalAddressOk (frame) ||
+        !physicalAddressOk (frame + PAGE_SIZE - 1) ||
+        inMemoryMappedArea (frame) ||
+        inMemoryMappedArea (frame + PAGE_SIZE - 1)) {
+      fprintf (stderr, "\n\rDMA DISK ERROR: A request with tag 0x%08X has a frame which is not in physical memory or is in the memory-mapped region.  It will complete with an error when you proceed!\n\r", request->tag);
+      request->status = OPERATION_COMPLETED_WITH_ERROR_2;
+      suspendExecution ();
+      return;
+    }
+  }
+
+  /* Check that we are accessing legal disk sectors... */
+  if ((request->sector < 0) ||
+      (request->sector + request->count > diskSectorCount)) {
+    fprintf (stderr, "\n\rDMA DISK ERROR: A request with tag 0x%08X is for sectors that do not exist on the disk.  It will complete with an error when you proceed!\n\r", request->tag);
+    request->status = OPERATION_COMPLETED_WITH_ERROR_3;
+    suspendExecution ();
+  }
+}
+
+
+
+/* dmaPositioningTime (sector) --> int
+**
+** This routine returns the time needed to move the head from
+** currentDiskSector to the given sector, if it starts now, using the same
+** seek, settle, and rotational delays as performDiskIO.
+*/
+int dmaPositioningTime (int sector) {
+  int accessTime, currentAngle, angleChange;
+  accessTime = DISK_SEEK_TIME * abs (sector / SECTORS_PER_TRACK -
+                                     currentDiskSector / SECTORS_PER_TRACK);
+  if (accessTime) {
+    accessTime = accessTime + DISK_SETTLE_TIME;
+  }
+  currentAngle = ((currentTime + accessTime) / DISK_ROTATIONAL_DELAY) % SECTORS_PER_TRACK;
+  angleChange = sector % SECTORS_PER_TRACK - currentAngle;
+  if (angleChange < 0) {
+    angleChange = angleChange + SECTORS_PER_TRACK;
+  }
+  return accessTime + angleChange * DISK_ROTATIONAL_DELAY;
+}
+
+
+
+/* startDmaRequest ()
+**
+** If the DMA disk controller is not serving a request, this routine picks
+** the pending request which the head can reach soonest and starts it.  A
+** request with an error is always picked first, and completes at once.
+** Ties go to the request given first.
+*/
+void startDmaRequest () {
+  int i, best, time, bestTime;
+  long long futureTime;
+
+  if (dmaActiveValid || (dmaNumberPending == 0)) {
+    return;
+  }
+
+  /* Pick the request and remove it from dmaPending... */
+  best = 0;
+  bestTime = -1;
+  for (i = 0; i < dmaNumberPending; i++) {
+    if (dmaPending [i].status != OPERATION_COMPLETED_OK) {
+      time = 0;
+    } else {
+      time = dmaPositioningTime (dmaPending [i].sector);
+    }
+    if ((bestTime < 0) || (time < bestTime)) {
+      best = i;
+      bestTime = time;
+    }
+  }
+  dmaActive = dmaPending [best];
+  dmaActiveValid = 1;
+  dmaNumberPending--;
+  for (i = best; i < dmaNumberPending; i++) {
+    dmaPending [i] = dmaPending [i+1];
+  }
+
+  /* See if we need to simulate a random disk I/O error... */
+  if (dmaActive.status == OPERATION_COMPLETED_OK) {
+    if (dmaActive.command == DISK_READ_COMMAND) {
+      if ((DISK_READ_ERROR_PROBABILITY > 0) &&
+          (1 == randomBetween (1, DISK_READ_ERROR_PROBABILITY))) {
+        dmaActive.status = OPERATION_COMPLETED_WITH_ERROR_4;
+      }
+    } else {
+      if ((DISK_WRITE_ERROR_PROBABILITY > 0) &&
+          (1 == randomBetween (1, DISK_WRITE_ERROR_PROBABILITY))) {
+        dmaActive.status = OPERATION_COMPLETED_WITH_ERROR_4;
+      }
+    }
+  }
+  if (dmaActive.status != OPERATION_COMPLETED_OK) {
+    dmaActiveTime = currentTime + 1;
+    return;
+  }
+
+  /* Compute a realistic delay, and move the head... */
+  futureTime = currentTime + bestTime
+               + dmaActive.count * DISK_ROTATIONAL_DELAY
+               + randomBetween (0, DISK_ACCESS_VARIATION);
+  if (futureTime <= currentTime) {
+    futureTime = currentTime + 1;
+  }
+  dmaActiveTime = futureTime;
+  currentDiskSector = dmaActive.sector + dmaActive.count;
+
+  diskLatencyTotal += dmaActiveTime - currentTime;
+  if (dmaActive.command == DISK_READ_COMMAND) {
+    numberOfDiskReads++;
+    diskSectorsRead += dmaActive.count;
+  } else {
+    numberOfDiskWrites++;
+    diskSectorsWritten += dmaActive.count;
+  }
+}
+
+
+
+/* finishDmaRequest ()
+**
+** This routine is called when the request being served by the DMA disk
+** controller is done.  It moves the data, one sector per frame, posts the
+** completion, and starts the next request.
+*/
+void finishDmaRequest () {
+  int i, frame;
+
+  if (dmaActive.status == OPERATION_COMPLETED_OK) {
+    /* Finish any transfer on the DISK I/O thread, which uses the same file... */
+    waitForDiskIO ();
+    for (i = 0; (i < dmaActive.count) && (diskFile != NULL); i++) {
+      frame = dmaActive.frames [i];
+      diskTransferCommand = dmaActive.command;
+      diskTransferSector = dmaActive.sector + i;
+      diskTransferCount = 1;
+      diskTransferLow = frame;
+      diskTransferHigh = frame + PAGE_SIZE;
+      reportDiskTransferError (transferDiskSectors ());
+      if (dmaActive.command == DISK_READ_COMMAND) {
+        invalidateDecodedRange (frame, frame + PAGE_SIZE);
+      }
+    }
+    if (dmaActive.command == DISK_READ_COMMAND) {
+      flushTLB ();
+    }
+  }
 
-  // Set up the next disk event, based on the computed time of completion...
-  if (futureTime <= currentTime) {
-    timeOfNextDiskEvent = currentTime + 1;
+  dmaActiveValid = 0;
+  postDmaCompletion (dmaActive.tag, dmaActive.status);
+  takeDmaRequests ();
+  startDmaRequest ();
+}
+
+
+
+/* postDmaCompletion (tag, status)
+**
+** This routine adds an entry to the completion ring.  There is always
+** room, since takeDmaRequests never takes more requests than will fit.
+** If the entry is in the buffer of a DISK operation in progress, it is
+** left unchanged, and an error is printed.
+*/
+void postDmaCompletion (int tag, int status) {
+  int addr;
+  addr = dmaCompletionRing + dmaCompletionTail * DMA_COMPLETION_BYTES;
+  if (dmaWordBusy (addr) || dmaWordBusy (addr + 4)) {
+    fprintf (stderr, "\n\rDMA DISK ERROR: The completion for the request with tag 0x%08X could not be stored, since the completion ring entry at 0x%08X is in the buffer of a DISK operation in progress!\n\r", tag, addr);
+    suspendExecution ();
   } else {
-    timeOfNextDiskEvent = futureTime;
+    putPhysicalWord (addr, tag);
+    putPhysicalWord (addr + 4, status);
+  }
+  dmaCompletionTail = (dmaCompletionTail + 1) % dmaRingSize;
+  dmaCompletionsSinceInterrupt++;
+  if ((dmaCompletionsSinceInterrupt == 1) && (dmaInterruptDelay > 0)) {
+    dmaInterruptTime = currentTime + dmaInterruptDelay;
   }
-  updateTimeOfNextEvent ();
+}
 
-  /* Set the new Current Disk Position... */
-  currentDiskSector = diskSectorNumberRegister + diskSectorCountRegister;
 
-  /* Seek to the proper location in the file... */
-  errno = 0;
-  if (fseek (diskFile, ((long) ((diskSectorNumberRegister * PAGE_SIZE) + 4)), SEEK_SET)) {
-    fprintf (stderr, "\n\rError from host OS during DISK read/fseek; Disk I/O has been disabled!\n\r");
-    if (errno) perror ("Host error");
-    fclose (diskFile);
-    diskFile = NULL;
-    controlCPressed = 1;
-    return;
+
+/* checkDmaInterrupt ()
+**
+** This routine signals a DISK_INTERRUPT if enough completions have been
+** posted since the last one, if the interrupt delay is up, or if the DMA
+** disk controller has nothing more to do.  Then it schedules the next
+** DMA event.
+*/
+void checkDmaInterrupt () {
+  long long nextTime;
+  if ((dmaCompletionsSinceInterrupt > 0) &&
+      ((dmaCompletionsSinceInterrupt >= dmaInterruptCount) ||
+       (currentTime >= dmaInterruptTime) ||
+       !dmaControllerBusy ())) {
+    signalCpu (0, DISK_INTERRUPT);
+    dmaCompletionsSinceInterrupt = 0;
+    dmaInterruptTime = MAX_TIME;
+  }
+  nextTime = dmaInterruptTime;
+  if (dmaActiveValid && (dmaActiveTime < nextTime)) {
+    nextTime = dmaActiveTime;
+  }
+  scheduleEvent (& dmaEvent, nextTime);
+}
+
+
+
+/* doDmaEvent ()
+**
+** This routine is called when a DMA event is due, which is either because
+** the request being served is done or because the interrupt delay is up.
+*/
+void doDmaEvent () {
+  if (dmaActiveValid && (currentTime >= dmaActiveTime)) {
+    finishDmaRequest ();
   }
+  checkDmaInterrupt ();
+}
 
-  if (command == DISK_READ_COMMAND) {
 
-    numberOfDiskReads++;
 
-    /* Read in N sectors of data... */
-    errno = 0;
-    fread ( (void *) (((intptr_t) memory) + diskBufferLow),
-            PAGE_SIZE, diskSectorCountRegister, diskFile );
-    if (errno) {
-      fprintf (stderr, "\n\rError from host OS during DISK read; Disk I/O has been disabled!\n\r");
-      if (errno) perror ("Host error");
+/* mapDiskFile (length)
+**
+** This routine is called when the "-mmap" option was given, after the DISK
+** file has been opened and checked.  It maps the entire file (of "length"
+** bytes) into memory, so that performDiskIO can copy sectors directly.  If
+** the file cannot be mapped, a warning is printed and ordinary file I/O
+** is used instead.
+**
+** In a "-sweep" run, it is always called, and the mapping is private, so
+** that DISK writes are never seen in the file.  If that mapping fails, the
+** DISK is disabled.
+*/
+void mapDiskFile (int length) {
+#if defined(_WIN32) || defined(_WIN64)
+  fprintf (stderr, "WARNING: The -mmap option is not supported on this system; ordinary file I/O will be used for the DISK.\n");
+#else
+  void * p;
+  errno = 0;
+  p = mmap (NULL, (size_t) length, PROT_READ | PROT_WRITE,
+            diskCopyOnWrite ? MAP_PRIVATE : MAP_SHARED,
+            fileno (diskFile), 0);
+  if (p == MAP_FAILED) {
+    if (errno) perror ("Error mapping DISK file");
+    if (diskCopyOnWrite) {
+      fprintf (stderr, "Error in DISK File: The DISK file could not be mapped copy-on-write.  Simulated disk I/O has been disabled!\n");
       fclose (diskFile);
       diskFile = NULL;
-      controlCPressed = 1;
       return;
     }
+    fprintf (stderr, "WARNING: The DISK file could not be memory-mapped; ordinary file I/O will be used.\n");
     return;
+  }
+  diskMapping = (char *) p;
+  diskMappingLength = (size_t) length;
+  diskWritesSinceSync = 0;
+#endif
+}
 
-  } else if (command == DISK_WRITE_COMMAND) {
 
-    numberOfDiskWrites++;
 
-    /* Write in N sectors of data... */
-    errno = 0;
-    fwrite ( (void *) (((intptr_t) memory) + diskBufferLow),
-            PAGE_SIZE, diskSectorCountRegister, diskFile );
-    if (errno) {
-      fprintf (stderr, "\n\rError from host OS during DISK write; Disk I/O has been disabled!\n\r");
-      if (errno) perror ("Host error");
-      fclose (diskFile);
-      diskFile = NULL;
-      controlCPressed = 1;
-      return;
+/* unmapDiskFile ()
+**
+** If the DISK file is mapped, this routine flushes any changes to the file
+** and removes the mapping.  It must be called before the DISK file is
+** closed or altered with ordinary file I/O.
+*/
+void unmapDiskFile () {
+#if !defined(_WIN32) && !defined(_WIN64)
+  waitForDiskIO ();
+  if (diskMapping != NULL) {
+    syncDiskFile ();
+    if (munmap (diskMapping, diskMappingLength)) {
+      perror ("Error unmapping DISK file");
     }
-    return;
+    diskMapping = NULL;
+    diskMappingLength = 0;
   }
+#endif
+}
+
+
+
+/* syncDiskFile ()
+**
+** If the DISK file is mapped, this routine forces all changes made through
+** the mapping out to the file.
+*/
+void syncDiskFile () {
+  errno = flushDiskMapping ();
+  if (errno) {
+    perror ("Error during msync of DISK file");
+  }
+}
+
+
+
+/* flushDiskMapping ()  --> errno
+**
+** This routine does the work of syncDiskFile, but prints nothing, so that
+** it may be called from transferDiskSectors on the DISK I/O thread.  It
+** returns 0, or the value of errno if the msync failed.
+*/
+int flushDiskMapping () {
+#if !defined(_WIN32) && !defined(_WIN64)
+  if (diskMapping != NULL) {
+    diskWritesSinceSync = 0;
+    if (msync (diskMapping, diskMappingLength, MS_SYNC)) {
+      return errno;
+    }
+  }
+#endif
+  return 0;
 }
 
 
@@ -9242,8 +15084,9 @@ void performDiskIO (int command) {
 */
 void checkDiskBufferError (int physAddr) {
   if (currentDiskStatus == DISK_BUSY && physAddr >= diskBufferLow && physAddr < diskBufferHigh) {
+    waitForDiskIO ();
     fprintf (stderr, "\n\rMEMORY ACCESS ERROR: The BLITZ program has attempted to read or write a memory word that is currently involved in a disk read or write operation!\n\r");
-    controlCPressed = 1;
+    suspendExecution ();
   }
 }
 
@@ -9389,6 +15232,20 @@ void setSimulationConstants () {
           } else {
             TERM_OUT_DELAY_VARIATION = i;
           }
+        } else if (!strcmp (first, "SERIAL_FIFO_DEPTH")) {
+          if ((i < 0) || (i > SERIAL_FIFO_MAX)) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  SERIAL_FIFO_DEPTH must be between 0 and %d!\n", SERIAL_FIFO_MAX);
+            errorInValue = 1;
+          } else {
+            SERIAL_FIFO_DEPTH = i;
+          }
+        } else if (!strcmp (first, "SERIAL_FIFO_THRESHOLD")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  SERIAL_FIFO_THRESHOLD must be at least 1!\n");
+            errorInValue = 1;
+          } else {
+            SERIAL_FIFO_THRESHOLD = i;
+          }
         } else if (!strcmp (first, "TIME_SLICE")) {
           if (i < 0) {
             fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  TIME_SLICE is negative!\n");
@@ -9481,6 +15338,98 @@ void setSimulationConstants () {
           DISK_SECTOR_NUMBER_REGISTER = i;
         } else if (!strcmp (first, "DISK_SECTOR_COUNT_REGISTER")) {
           DISK_SECTOR_COUNT_REGISTER = i;
+        } else if (!strcmp (first, "PERF_COUNTER_ADDRESS")) {
+          PERF_COUNTER_ADDRESS = i;
+        } else if (!strcmp (first, "CPU_DEVICE_ADDRESS")) {
+          CPU_DEVICE_ADDRESS = i;
+        } else if (!strcmp (first, "DMA_CONTROLLER_ADDRESS")) {
+          DMA_CONTROLLER_ADDRESS = i;
+        } else if (!strcmp (first, "TIMER_DEVICE_ADDRESS")) {
+          TIMER_DEVICE_ADDRESS = i;
+        } else if (!strcmp (first, "MUL_CYCLES")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  MUL_CYCLES must be >= 1!\n");
+            errorInValue = 1;
+          } else {
+            MUL_CYCLES = i;
+          }
+        } else if (!strcmp (first, "DIV_CYCLES")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  DIV_CYCLES must be >= 1!\n");
+            errorInValue = 1;
+          } else {
+            DIV_CYCLES = i;
+          }
+        } else if (!strcmp (first, "FLOAT_CYCLES")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  FLOAT_CYCLES must be >= 1!\n");
+            errorInValue = 1;
+          } else {
+            FLOAT_CYCLES = i;
+          }
+        } else if (!strcmp (first, "FLOAT_DIV_CYCLES")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  FLOAT_DIV_CYCLES must be >= 1!\n");
+            errorInValue = 1;
+          } else {
+            FLOAT_DIV_CYCLES = i;
+          }
+        } else if (!strcmp (first, "CACHE_LINE_SIZE")) {
+          if (i < 4 || i > PAGE_SIZE || (i & (i-1)) != 0) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  CACHE_LINE_SIZE must be a power of 2, between 4 and the page size!\n");
+            errorInValue = 1;
+          } else {
+            CACHE_LINE_SIZE = i;
+          }
+        } else if (!strcmp (first, "ICACHE_SETS")) {
+          if (i < 0) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  ICACHE_SETS is negative!\n");
+            errorInValue = 1;
+          } else {
+            ICACHE_SETS = i;
+          }
+        } else if (!strcmp (first, "ICACHE_WAYS")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  ICACHE_WAYS must be >= 1!\n");
+            errorInValue = 1;
+          } else {
+            ICACHE_WAYS = i;
+          }
+        } else if (!strcmp (first, "DCACHE_SETS")) {
+          if (i < 0) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  DCACHE_SETS is negative!\n");
+            errorInValue = 1;
+          } else {
+            DCACHE_SETS = i;
+          }
+        } else if (!strcmp (first, "DCACHE_WAYS")) {
+          if (i < 1) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  DCACHE_WAYS must be >= 1!\n");
+            errorInValue = 1;
+          } else {
+            DCACHE_WAYS = i;
+          }
+        } else if (!strcmp (first, "CACHE_MISS_PENALTY")) {
+          if (i < 0) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  CACHE_MISS_PENALTY is negative!\n");
+            errorInValue = 1;
+          } else {
+            CACHE_MISS_PENALTY = i;
+          }
+        } else if (!strcmp (first, "BRANCH_PREDICTOR_SIZE")) {
+          if (i < 0) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  BRANCH_PREDICTOR_SIZE is negative!\n");
+            errorInValue = 1;
+          } else {
+            BRANCH_PREDICTOR_SIZE = i;
+          }
+        } else if (!strcmp (first, "BRANCH_MISPREDICT_PENALTY")) {
+          if (i < 0) {
+            fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  BRANCH_MISPREDICT_PENALTY is negative!\n");
+            errorInValue = 1;
+          } else {
+            BRANCH_MISPREDICT_PENALTY = i;
+          }
         } else {
           fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  An attempt to set non-existent value \"%s\"!\n", first);
           errorInValue = 1;
@@ -9538,6 +15487,35 @@ void setSimulationConstants () {
         fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  DISK_SECTOR_COUNT_REGISTER is not within the Memory Mapped Area or is not word-aligned!\n");
         errorInValue = 1;
       }
+      if (PERF_COUNTER_ADDRESS < MEMORY_MAPPED_AREA_LOW ||
+          PERF_COUNTER_ADDRESS + PERF_COUNTER_BYTES - 1 > MEMORY_MAPPED_AREA_HIGH ||
+          PERF_COUNTER_ADDRESS % 4 != 0) {
+        fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  PERF_COUNTER_ADDRESS is not within the Memory Mapped Area or is not word-aligned!\n");
+        errorInValue = 1;
+      }
+      if ((SERIAL_FIFO_DEPTH > 0) &&
+          (SERIAL_FIFO_THRESHOLD > SERIAL_FIFO_DEPTH)) {
+        fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  SERIAL_FIFO_THRESHOLD is greater than SERIAL_FIFO_DEPTH!\n");
+        errorInValue = 1;
+      }
+      if (CPU_DEVICE_ADDRESS < MEMORY_MAPPED_AREA_LOW ||
+          CPU_DEVICE_ADDRESS + CPU_DEVICE_BYTES - 1 > MEMORY_MAPPED_AREA_HIGH ||
+          CPU_DEVICE_ADDRESS % 4 != 0) {
+        fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  CPU_DEVICE_ADDRESS is not within the Memory Mapped Area or is not word-aligned!\n");
+        errorInValue = 1;
+      }
+      if (DMA_CONTROLLER_ADDRESS < MEMORY_MAPPED_AREA_LOW ||
+          DMA_CONTROLLER_ADDRESS + DMA_CONTROLLER_BYTES - 1 > MEMORY_MAPPED_AREA_HIGH ||
+          DMA_CONTROLLER_ADDRESS % 4 != 0) {
+        fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  DMA_CONTROLLER_ADDRESS is not within the Memory Mapped Area or is not word-aligned!\n");
+        errorInValue = 1;
+      }
+      if (TIMER_DEVICE_ADDRESS < MEMORY_MAPPED_AREA_LOW ||
+          TIMER_DEVICE_ADDRESS + TIMER_DEVICE_BYTES - 1 > MEMORY_MAPPED_AREA_HIGH ||
+          TIMER_DEVICE_ADDRESS % 4 != 0) {
+        fprintf (stderr, "\n*****  ERROR in \".blitzrc\" file:  TIMER_DEVICE_ADDRESS is not within the Memory Mapped Area or is not word-aligned!\n");
+        errorInValue = 1;
+      }
 
       if (errorInValue) {
         fprintf (stderr, "*****  ERROR in \".blitzrc\" file:  All values in the file have been ignored.\n");
@@ -9559,6 +15537,8 @@ void defaultSimulationConstants () {
     KEYBOARD_WAIT_TIME_VARIATION =         100;
     TERM_OUT_DELAY =                       100;
     TERM_OUT_DELAY_VARIATION =              10;
+    SERIAL_FIFO_DEPTH =                      0;
+    SERIAL_FIFO_THRESHOLD =                  1;
     TIME_SLICE =                          5000;
     TIME_SLICE_VARIATION =                  30;
     DISK_SEEK_TIME =                     10000;
@@ -9578,6 +15558,22 @@ void defaultSimulationConstants () {
     DISK_MEMORY_ADDRESS_REGISTER =  0x00ffff0c;
     DISK_SECTOR_NUMBER_REGISTER =   0x00ffff10;
     DISK_SECTOR_COUNT_REGISTER =    0x00ffff14;
+    PERF_COUNTER_ADDRESS =          0x00ffff20;  // Through 0x00ffff53
+    CPU_DEVICE_ADDRESS =            0x00ffff60;  // Through 0x00ffff6f
+    DMA_CONTROLLER_ADDRESS =        0x00ffff70;  // Through 0x00ffff93
+    TIMER_DEVICE_ADDRESS =          0x00ffff94;  // Through 0x00ffffa3
+    MUL_CYCLES =                             1;
+    DIV_CYCLES =                             1;
+    FLOAT_CYCLES =                           1;
+    FLOAT_DIV_CYCLES =                       1;
+    CACHE_LINE_SIZE =                       32;
+    ICACHE_SETS =                            0;  // 0=no instruction cache
+    ICACHE_WAYS =                            2;
+    DCACHE_SETS =                            0;  // 0=no data cache
+    DCACHE_WAYS =                            2;
+    CACHE_MISS_PENALTY =                    10;
+    BRANCH_PREDICTOR_SIZE =                  0;  // 0=no branch prediction
+    BRANCH_MISPREDICT_PENALTY =              3;
 }
 
 
@@ -9727,6 +15723,296 @@ void printCurrentFileLineAndFunction () {
   printf (", line %d)", lineNum);
 
   // Print the cuurent time...
-  printf ("  time = %d", currentTime);
+  printf ("  time = %lld", currentTime);
+
+}
+
+
+
+/* blitzCreate (& m) --> BLITZ_OK or BLITZ_ERROR
+**
+** This routine creates a machine, with no a.out file loaded and no DISK,
+** and stores a pointer to it in "m".  Serial input is empty; serial output
+** goes to stdout.  Since the machine state is kept in the emulator's
+** globals, only one machine may exist at a time; if there is one already,
+** a message is printed on stderr, "m" is set to NULL, and BLITZ_ERROR is
+** returned.
+*/
+int blitzCreate (BlitzMachine ** machine) {
+  BlitzMachine * m;
+  * machine = NULL;
+  if (libraryMachine != NULL) {
+    fprintf (stderr, "BLITZ Emulator Error: Only one BLITZ machine may exist at a time in a process\n");
+    return BLITZ_ERROR;
+  }
+  m = (BlitzMachine *) calloc (1, sizeof (BlitzMachine));
+  if (m == NULL) {
+    return BLITZ_ERROR;
+  }
+  if (MIN == 0) {
+    checkHostCompatibility ();
+    checkArithmetic ();
+    MIN = -MAX - 1;
+    POSITIVE_INFINITY = 1.0 / 0.0;
+    NEGATIVE_INFINITY = -1.0 / 0.0;
+  }
+  termInputFile = fopen ("/dev/null", "rb");
+  if (termInputFile == NULL) {
+    free (m);
+    return BLITZ_ERROR;
+  }
+  termOutputFile = stdout;
+  terminalInRawMode = 0;
+  m->failed = 1;                    /* Nothing has been loaded */
+  libraryMachine = m;
+  * machine = m;
+  return BLITZ_OK;
+}
+
+
+
+/* blitzLoad (m, fileName) --> BLITZ_OK or BLITZ_ERROR
+**
+** This routine resets the machine and loads the given a.out file, as the
+** "reset" command does.  If there is a problem, a message is printed on
+** stderr and BLITZ_ERROR is returned; the machine may not be run until an
+** a.out file has been loaded successfully.
+*/
+int blitzLoad (BlitzMachine * m, char * fileName) {
+  FILE * file;
+  if (!libraryMachineOk (m)) {
+    return BLITZ_ERROR;
+  }
+  file = fopen (fileName, "rb");
+  if (file == NULL) {
+    fprintf (stderr, "BLITZ Emulator Error: Input file \"%s\" could not be opened\n",
+             fileName);
+    return BLITZ_ERROR;
+  }
+  if (executableFile != NULL) {
+    fclose (executableFile);
+  }
+  executableFile = file;
+  executableFileName = copyFileName (& m->executableFileName, fileName);
+  m->failed = 1;
+  if (setjmp (m->errorJump)) {
+    libraryErrorJump = NULL;
+    return BLITZ_ERROR;
+  }
+  libraryErrorJump = & m->errorJump;
+  resetState ();
+  libraryErrorJump = NULL;
+  m->failed = 0;
+  return BLITZ_OK;
+}
+
+
+
+/* blitzAttachDisk (m, fileName) --> BLITZ_OK or BLITZ_ERROR
+**
+** This routine opens the given DISK file, which must already exist and be
+** properly formatted, and attaches it to the machine.  Passing NULL detaches
+** the DISK.  An a.out file must have been loaded; the DISK stays attached
+** when another is loaded.
+*/
+int blitzAttachDisk (BlitzMachine * m, char * fileName) {
+  if (!libraryMachineOk (m) || m->failed) {
+    return BLITZ_ERROR;
+  }
+  waitForDiskIO ();
+  if (fileName == NULL) {
+    diskFileName = NULL;
+  } else {
+    diskFileName = copyFileName (& m->diskFileName, fileName);
+  }
+  if (setjmp (m->errorJump)) {
+    libraryErrorJump = NULL;
+    m->failed = 1;
+    return BLITZ_ERROR;
+  }
+  libraryErrorJump = & m->errorJump;
+  initializeDisk ();
+  libraryErrorJump = NULL;
+  return ((fileName == NULL) || (diskFile != NULL)) ? BLITZ_OK : BLITZ_ERROR;
+}
+
+
+
+/* blitzRun (m, count) --> BLITZ_RUNNING, BLITZ_HALTED, BLITZ_STOPPED, ...
+**
+** This routine executes up to "count" cycles, as the "go" command does but
+** without printing anything or touching the terminal.  It returns
+** BLITZ_RUNNING if all of the cycles were executed, BLITZ_HALTED if a "wait"
+** instruction halted the machine, BLITZ_STOPPED if execution stopped early
+** (at a "debug" instruction, or on an error that would return the user to
+** the command loop), or BLITZ_ERROR if the emulator hit a fatal error.
+*/
+int blitzRun (BlitzMachine * m, long long count) {
+  long long left;
+  if (!libraryMachineOk (m) || m->failed) {
+    return BLITZ_ERROR;
+  }
+  if (setjmp (m->errorJump)) {
+    libraryErrorJump = NULL;
+    m->failed = 1;
+    return BLITZ_ERROR;
+  }
+  libraryErrorJump = & m->errorJump;
+  executionHalted = 0;
+  controlCPressed = 0;
+  wantPrintingInSingleStep = 0;
+  left = runInstructions (count);
+  waitForDiskIO ();
+  libraryErrorJump = NULL;
+  if (executionHalted) {
+    return BLITZ_HALTED;
+  } else if (left > 0) {
+    return BLITZ_STOPPED;
+  }
+  return BLITZ_RUNNING;
+}
+
+
+
+/* blitzReadWord (m, physAddr, &value) --> BLITZ_OK or BLITZ_ERROR
+**
+** This routine reads a word of physical memory.  The address must be
+** aligned, in memory, and not in the memory-mapped area.
+*/
+int blitzReadWord (BlitzMachine * m, int physAddr, int * value) {
+  if (!libraryMachineOk (m) ||
+      (memory == NULL) || !physicalAddressOk (physAddr) ||
+      !isAligned (physAddr) || inMemoryMappedArea (physAddr)) {
+    return BLITZ_ERROR;
+  }
+  waitForDiskIO ();
+  * value = getPhysicalWord (physAddr);
+  return BLITZ_OK;
+}
+
+
+
+/* blitzWriteWord (m, physAddr, value) --> BLITZ_OK or BLITZ_ERROR
+**
+** This routine stores a word into physical memory.  The address must be
+** aligned, in memory, and not in the memory-mapped area.
+*/
+int blitzWriteWord (BlitzMachine * m, int physAddr, int value) {
+  if (!libraryMachineOk (m) ||
+      (memory == NULL) || !physicalAddressOk (physAddr) ||
+      !isAligned (physAddr) || inMemoryMappedArea (physAddr)) {
+    return BLITZ_ERROR;
+  }
+  waitForDiskIO ();
+  putPhysicalWord (physAddr, value);
+  return BLITZ_OK;
+}
+
+
+
+/* blitzGetRegister (m, reg) --> int
+**
+** This routine returns register r0..r15 from the register set selected by
+** the current mode (system or user), or the pc if "reg" is BLITZ_PC.
+*/
+int blitzGetRegister (BlitzMachine * m, int reg) {
+  if (!libraryMachineOk (m)) {
+    return 0;
+  } else if (reg == BLITZ_PC) {
+    return pc;
+  } else if ((reg <= 0) || (reg > 15)) {
+    return 0;
+  } else if (statusS) {
+    return systemRegisters [reg];
+  } else {
+    return userRegisters [reg];
+  }
+}
+
+
+
+/* blitzSetRegister (m, reg, value)
+**
+** This routine sets register r1..r15 in the register set selected by the
+** current mode, or the pc if "reg" is BLITZ_PC.  Other values of "reg" are
+** ignored, since r0 is always zero.
+*/
+void blitzSetRegister (BlitzMachine * m, int reg, int value) {
+  if (!libraryMachineOk (m)) {
+    return;
+  } else if (reg == BLITZ_PC) {
+    pc = value;
+  } else if ((reg <= 0) || (reg > 15)) {
+    return;
+  } else if (statusS) {
+    systemRegisters [reg] = value;
+  } else {
+    userRegisters [reg] = value;
+  }
+}
+
+
+
+/* blitzDestroy (m)
+**
+** This routine closes the machine's files, frees its memory, and discards
+** the machine, after which another may be created.
+*/
+void blitzDestroy (BlitzMachine * m) {
+  if (!libraryMachineOk (m)) {
+    return;
+  }
+  waitForDiskIO ();
+  unmapDiskFile ();
+  if (diskFile != NULL) {
+    fclose (diskFile);
+    diskFile = NULL;
+  }
+  if (executableFile != NULL) {
+    fclose (executableFile);
+    executableFile = NULL;
+  }
+  if ((termInputFile != NULL) && (termInputFile != stdin)) {
+    fclose (termInputFile);
+    termInputFile = NULL;
+  }
+  if (memory != NULL) {
+    free (memory);
+    memory = NULL;
+  }
+  free (m->executableFileName);
+  free (m->diskFileName);
+  executableFileName = NULL;
+  diskFileName = NULL;
+  libraryMachine = NULL;
+  free (m);
+}
+
+
+
+/* libraryMachineOk (m) --> bool
+**
+** This routine returns TRUE if "m" is the machine which currently exists.
+** Since there is only one set of machine state, every other BlitzMachine
+** (including one which has been destroyed) is refused.
+*/
+int libraryMachineOk (BlitzMachine * m) {
+  return (m != NULL) && (m == libraryMachine);
+}
+
 
+
+/* copyFileName (& field, fileName) --> char *
+**
+** This routine replaces the file name kept in the given field of the
+** BlitzMachine with a copy of "fileName", and returns the copy.
+*/
+char * copyFileName (char ** field, char * fileName) {
+  free (* field);
+  * field = (char *) malloc (strlen (fileName) + 1);
+  if (* field == NULL) {
+    fatalError ("Malloc failed - insufficient memory available");
+  }
+  strcpy (* field, fileName);
+  return * field;
 }
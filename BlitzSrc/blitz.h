@@ -0,0 +1,76 @@
+/* blitz.h -- Interface to the BLITZ Machine Emulator as a library
+**
+** Copyright 2001-2007, Harry H. Porter III
+**
+** This file may be freely copied, modified and compiled, on the sole
+** conditions that if you modify it...
+**
+**   (1) Your name and the date of modification is added to this comment
+**       under "Modifications by", and
+**
+**   (2) Your name and the date of modification is added to the
+**       "commandLineHelp()" routine in blitz.c under "Modifications by".
+**
+** Original Author:
+**   02/05/01 - Harry H. Porter III
+**
+** When "blitz.c" is compiled with "-DBLITZ_LIBRARY" (see "libblitz.a" in
+** the makefile), "main" is left out, and a program (such as a test harness)
+** may drive the emulator through the routines below.  Such a program must
+** be linked with the math and thread libraries, for example:
+**
+**     gcc test.c libblitz.a -lm -lpthread
+**
+** Typical use:
+**
+**     blitzCreate (& m);
+**     blitzLoad (m, "a.out");
+**     blitzAttachDisk (m, "DISK");       (optional)
+**     status = blitzRun (m, 1000000);
+**     blitzReadWord (m, addr, & value);
+**     blitzDestroy (m);
+**
+** This is a wrapper around a single machine; it is not reentrant, and
+** running several machines in one process is not supported.  Each
+** routine is passed the machine it applies to, but the machine state is
+** still kept in the emulator's global variables.  So only one machine may
+** exist at a time in a process (blitzCreate returns BLITZ_ERROR while
+** there is one), and it must be used from one thread at a time.  Passing
+** any other BlitzMachine (for example, one already destroyed) makes the
+** routines fail.  Fatal emulator errors, which end the "blitz" program,
+** instead make the routine return BLITZ_ERROR.
+*/
+
+#ifndef BLITZ_H
+#define BLITZ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BlitzMachine BlitzMachine;
+
+#define BLITZ_OK         0
+#define BLITZ_ERROR     -1
+
+#define BLITZ_RUNNING    0      /* Returned by blitzRun: all cycles done */
+#define BLITZ_HALTED     1      /* A "wait" with no more interrupts */
+#define BLITZ_STOPPED    2      /* A "debug" instruction or an error */
+
+#define BLITZ_PC        16      /* Register number for the pc */
+
+int blitzCreate (BlitzMachine ** machine);
+int blitzLoad (BlitzMachine * m, char * fileName);
+int blitzAttachDisk (BlitzMachine * m, char * fileName);
+int blitzRun (BlitzMachine * m, long long count);
+int blitzReadWord (BlitzMachine * m, int physAddr, int * value);
+int blitzWriteWord (BlitzMachine * m, int physAddr, int value);
+int blitzGetRegister (BlitzMachine * m, int reg);
+void blitzSetRegister (BlitzMachine * m, int reg, int value);
+void blitzDestroy (BlitzMachine * m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+/* Program to summarize a BLITZ memory-access trace file
+**
+** Copyright 2000-2007, Harry H. Porter III
+**
+** This file may be freely copied, modified and compiled, on the sole
+** condition that if you modify it...
+**   (1) Your name and the date of modification is added to this comment
+**       under "Modifications by", and
+**   (2) Your name and the date of modification is added to the printHelp()
+**       routine under "Modifications by".
+**
+** The trace file is produced by the BLITZ emulator with the "-trace filename"
+** option; see the comments in blitz.c for its format.  This program divides
+** the trace into windows of a fixed number of cycles and, for each window,
+** prints the number of fetches, loads and stores and the number of distinct
+** virtual pages and physical page frames touched.  The number of distinct
+** pages in a window is its working set.
+**
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* SWAP_BYTES (int)  -->  int
+**
+** This macro is used to swap the bytes in a 32-bit int from Big Endian order
+** to Little Endian order, or vice-versa.
+**
+** For example:
+**     i = SWAP_BYTES (i);
+**
+** This program was originally written for a Big Endian architecture so swapping
+** bytes was never necessary.  When compiled on a Big Endian computer, this macro
+** is a no-op; when compiled on a Little Endian machine, it will swap the bytes.
+**
+*/
+#ifdef BLITZ_HOST_IS_LITTLE_ENDIAN
+#define SWAP_BYTES(x) \
+    ((int)((((int)(x) & 0xff000000) >> 24) | \
+           (((int)(x) & 0x00ff0000) >>  8) | \
+           (((int)(x) & 0x0000ff00) <<  8) | \
+           (((int)(x) & 0x000000ff) << 24)))
+#else
+#define SWAP_BYTES(x) (x)
+#endif
+
+
+
+/*****  Global variables *****/
+
+#define TRACE_MAGIC 0x424C5A74          /* ASCII "BLZt" */
+#define TRACE_RECORD_SIZE 16
+#define RECORDS_PER_READ 4096
+#define DEFAULT_WINDOW 100000
+
+char * commandInFileName = NULL; /* The input filename, if provided */
+FILE * inputFile;                /* The input file */
+long long windowSize = -1;       /* Cycles per window, from the -w option */
+int pageSize;                    /* From the header */
+int memorySize;                  /* From the header */
+int numberOfVirtPages;           /* Entries in virtPageStamp */
+int numberOfFrames;              /* Entries in frameStamp */
+long long * virtPageStamp;       /* Last window to touch each virtual page */
+long long * frameStamp;          /* Last window to touch each frame */
+int windowCounts [3];            /* Fetches, loads and stores this window */
+int windowVirtPages;             /* Distinct virtual pages this window */
+int windowFrames;                /* Distinct frames this window */
+long long totalCounts [3];       /* Fetches, loads and stores, overall */
+long long numberOfWindows;       /* Windows with at least one access */
+int maxVirtPages;                /* Largest working set seen */
+int maxFrames;
+char * kindNames [3] = {"Fetches", "Loads", "Stores"};
+
+
+
+/* Function prototypes */
+
+void processCommandLine (int argc, char ** argv);
+void printHelp ();
+int readInteger ();
+void allocateStamps ();
+void printWindow (long long window);
+void printTotals ();
+void fatalError (char * msg);
+
+
+
+/* main()
+**
+** Read the trace file and print the summary.
+*/
+main (int argc, char ** argv) {
+    int buffer [RECORDS_PER_READ * 4];
+    int n, i, word, kind, paged, virtPage, frame;
+    long long cycle, window, currentWindow;
+
+    processCommandLine (argc, argv);
+    if (readInteger () != TRACE_MAGIC) {
+      fatalError ("Magic number is not 'BLZt'; this is not a BLITZ trace file");
+    }
+    if (readInteger () != TRACE_RECORD_SIZE) {
+      fatalError ("Unexpected record size in the trace file header");
+    }
+    pageSize = readInteger ();
+    memorySize = readInteger ();
+    if (pageSize <= 0 || memorySize <= 0 || memorySize % pageSize != 0) {
+      fatalError ("Invalid PAGE_SIZE or MEMORY_SIZE in the trace file header");
+    }
+    allocateStamps ();
+
+    printf ("Trace file: PAGE_SIZE = %d, MEMORY_SIZE = 0x%08X, window = %lld cycles\n\n",
+            pageSize, memorySize, windowSize);
+    printf ("      Window start     Fetches       Loads      Stores  VirtPages  Frames\n");
+    printf ("  ================  ==========  ==========  ==========  =========  ======\n");
+
+    currentWindow = -1;
+    while (1) {
+      n = fread (buffer, TRACE_RECORD_SIZE, RECORDS_PER_READ, inputFile);
+      if (n <= 0) break;
+      for (i = 0; i < n * 4; i += 4) {
+        cycle = (((long long) SWAP_BYTES (buffer [i])) << 32) |
+                (((long long) SWAP_BYTES (buffer [i+1])) & 0xffffffffLL);
+        word = SWAP_BYTES (buffer [i+2]);
+        frame = SWAP_BYTES (buffer [i+3]) / pageSize;
+        kind = (word >> 30) & 0x3;
+        paged = (word >> 28) & 0x1;
+        if (kind > 2 || frame < 0 || frame >= numberOfFrames) {
+          fatalError ("Invalid record in the trace file");
+        }
+
+        /* Start a new window if this record falls beyond the current one. */
+        window = cycle / windowSize;
+        if (window != currentWindow) {
+          if (currentWindow != -1) {
+            printWindow (currentWindow);
+          }
+          currentWindow = window;
+        }
+
+        /* Count the access.  Paged and unpaged addresses are different
+           address spaces, so their pages are counted separately. */
+        windowCounts [kind]++;
+        totalCounts [kind]++;
+        virtPage = (paged * 0x01000000 + (word & 0x00ffffff)) / pageSize;
+        if (virtPageStamp [virtPage] != window) {
+          virtPageStamp [virtPage] = window;
+          windowVirtPages++;
+        }
+        if (frameStamp [frame] != window) {
+          frameStamp [frame] = window;
+          windowFrames++;
+        }
+      }
+      if (n < RECORDS_PER_READ) break;
+    }
+    if (ferror (inputFile)) {
+      fatalError ("Problem reading from input file");
+    }
+    if (currentWindow != -1) {
+      printWindow (currentWindow);
+    }
+    printTotals ();
+    exit (0);
+}
+
+
+
+/* processCommandLine (argc, argv)
+**
+** This routine processes the command line options.
+*/
+void processCommandLine (int argc, char ** argv) {
+  int argCount;
+  char * endPtr;
+  for (argc--, argv++; argc > 0; argc -= argCount, argv += argCount) {
+    argCount = 1;
+    /* Scan the -h option */
+    if (!strcmp (*argv, "-h")) {
+      printHelp ();
+      exit (1);
+    /* Scan the -w option, which should be followed by a number */
+    } else if (!strcmp (*argv, "-w")) {
+      if (argc <= 1) {
+        fprintf (stderr,
+          "dumpTrace: Expecting number of cycles after -w option;  Use -h for help display\n");
+        exit (1);
+      }
+      argCount++;
+      if (windowSize != -1) {
+        fprintf (stderr,
+          "dumpTrace: Invalid command line;  Multiple occurences of the -w option;  Use -h for help display\n");
+        exit (1);
+      }
+      windowSize = strtoll (*(argv+1), &endPtr, 10);
+      if (*endPtr != '\0' || windowSize <= 0) {
+        fprintf (stderr,
+          "dumpTrace: Invalid number of cycles after -w option;  Use -h for help display\n");
+        exit (1);
+      }
+    /* Scan an input file name */
+    } else if ((*argv)[0] != '-') {
+      if (commandInFileName == NULL) {
+        commandInFileName = *argv;
+      } else {
+        fprintf (stderr,
+          "dumpTrace: Invalid command line;  Multiple input files;  Use -h for help display\n");
+        exit (1);
+      }
+    } else {
+      fprintf (stderr,
+        "dumpTrace: Invalid command line option (%s);  Use -h for help display\n",
+        *argv);
+      exit (1);
+    }
+  }
+  if (windowSize == -1) {
+    windowSize = DEFAULT_WINDOW;
+  }
+
+  /* Open the input (trace) file */
+  if (commandInFileName == NULL) {
+    inputFile = stdin;
+  } else {
+    inputFile = fopen (commandInFileName, "rb");
+    if (inputFile == NULL) {
+      fprintf (stderr,
+          "dumpTrace: Input file \"%s\" could not be opened\n", commandInFileName);
+      exit (1);
+    }
+  }
+}
+
+
+
+/* printHelp ()
+**
+** This routine prints some documentation.  It is invoked whenever
+** the -h option is used on the command line.
+*/
+void printHelp () {
+  printf (
+"==================================================\n"
+"=====                                        =====\n"
+"=====  The BLITZ Memory-Access Trace Dumper  =====\n"
+"=====                                        =====\n"
+"==================================================\n"
+"\n"
+"Copyright 2000-2007, Harry H. Porter III\n"
+"========================================\n"
+"\n"
+"Overview\n"
+"========\n"
+"  This program reads a trace file produced by the BLITZ emulator with the\n"
+"  \"-trace filename\" option, which records every instruction fetch, load\n"
+"  and store.  It divides the trace into windows of a fixed number of cycles\n"
+"  and prints one line per window, giving the number of fetches, loads and\n"
+"  stores and the number of distinct virtual pages and physical page frames\n"
+"  touched (the working set).  Windows with no accesses (for example, while\n"
+"  the CPU is sleeping) are not printed.  Totals are printed at the end.\n"
+"\n"
+"Command Line Options\n"
+"====================\n"
+"  Command line options may be given in any order.\n"
+"    -h\n"
+"      Print this info.  The input source is ignored.\n"
+"    -w cycles\n"
+"      The size of each window, in cycles.  The default is 100000.\n"
+"    filename\n"
+"      The input source will come from this file.  If an input file is not\n"
+"      named on the command line, the source must come from stdin.  Only one\n"
+"      input source is allowed.\n");
+}
+
+
+
+/* readInteger ()
+**
+** Read 4 bytes from the input file and return an integer.
+*/
+int readInteger () {
+  int i, numBytesRead;
+  numBytesRead = fread (&i, 4, 1, inputFile);
+  if (numBytesRead != 1) {
+    fatalError ("Problem reading from input file");
+  }
+  return SWAP_BYTES (i);
+}
+
+
+
+/* allocateStamps ()
+**
+** Allocate the arrays recording the last window in which each virtual page
+** and each frame was touched.  There are two 24-bit virtual address spaces,
+** one for paged and one for unpaged accesses.
+*/
+void allocateStamps () {
+  int i;
+  numberOfVirtPages = 2 * 0x01000000 / pageSize;
+  numberOfFrames = memorySize / pageSize;
+  virtPageStamp = (long long *) malloc (numberOfVirtPages * sizeof (long long));
+  frameStamp = (long long *) malloc (numberOfFrames * sizeof (long long));
+  if (virtPageStamp == NULL || frameStamp == NULL) {
+    fatalError ("Malloc failed - insufficient memory available");
+  }
+  for (i = 0; i < numberOfVirtPages; i++) {
+    virtPageStamp [i] = -1;
+  }
+  for (i = 0; i < numberOfFrames; i++) {
+    frameStamp [i] = -1;
+  }
+}
+
+
+
+/* printWindow (window)
+**
+** Print the line for the given window and reset the counts for the next.
+*/
+void printWindow (long long window) {
+  printf ("  %16lld  %10d  %10d  %10d  %9d  %6d\n", window * windowSize,
+          windowCounts [0], windowCounts [1], windowCounts [2],
+          windowVirtPages, windowFrames);
+  numberOfWindows++;
+  if (windowVirtPages > maxVirtPages) {
+    maxVirtPages = windowVirtPages;
+  }
+  if (windowFrames > maxFrames) {
+    maxFrames = windowFrames;
+  }
+  memset (windowCounts, 0, sizeof (windowCounts));
+  windowVirtPages = 0;
+  windowFrames = 0;
+}
+
+
+
+/* printTotals ()
+**
+** Print the totals for the whole trace.
+*/
+void printTotals () {
+  int i, virtPages, frames;
+  long long total;
+
+  total = totalCounts [0] + totalCounts [1] + totalCounts [2];
+  virtPages = 0;
+  for (i = 0; i < numberOfVirtPages; i++) {
+    if (virtPageStamp [i] != -1) virtPages++;
+  }
+  frames = 0;
+  for (i = 0; i < numberOfFrames; i++) {
+    if (frameStamp [i] != -1) frames++;
+  }
+  printf ("\nTotals:\n");
+  printf ("  Accesses:                     %lld\n", total);
+  for (i = 0; i < 3; i++) {
+    printf ("    %-10s                  %lld (%.1f%%)\n", kindNames [i],
+            totalCounts [i], total ? 100.0 * totalCounts [i] / total : 0.0);
+  }
+  printf ("  Windows with accesses:        %lld\n", numberOfWindows);
+  printf ("  Distinct virtual pages:       %d\n", virtPages);
+  printf ("  Distinct frames:              %d\n", frames);
+  printf ("  Largest working set (pages):  %d\n", maxVirtPages);
+  printf ("  Largest working set (frames): %d\n", maxFrames);
+}
+
+
+
+/* fatalError (msg)
+**
+** Print this message and abort.
+*/
+void fatalError (char * msg) {
+  printf ("\n*****  ERROR: %s  *****\n", msg);
+  exit (1);
+}